@@ -4,20 +4,16 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonDocument>
-#include <QUrl>
-#include <QUrlQuery>
-#include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QCloseEvent>
 #include "QtPlugin.h"
 #include "pluginmain.h"
 
-LoginDialog::LoginDialog(QWidget* parent) : QDialog(parent), ui(new Ui::LoginDialog)
+LoginDialog::LoginDialog(MalcoreClient* client, QWidget* parent) : QDialog(parent), ui(new Ui::LoginDialog), mClient(client)
 {
     ui->setupUi(this);
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
     setFixedSize(size());
-    mHttp = new QNetworkAccessManager(this);
     on_checkBoxApiKey_toggled(false);
 }
 
@@ -49,15 +45,8 @@ void LoginDialog::checkApiKey(const QString& apiKey)
     setEnabled(false);
     qApp->processEvents();
 
-    // Create the request
-    QNetworkRequest request(QUrl("https://api.malcore.io/api/status"));
-    request.setRawHeader("apiKey", apiKey.toUtf8());
-    request.setHeader(QNetworkRequest::UserAgentHeader, "x64dbg");
-
-    // Perform the POST
-    QUrlQuery query;
-    query.addQueryItem("uuid", "");
-    QNetworkReply* reply = mHttp->post(request, query.toString().toUtf8());
+    // Check the key with an empty status request
+    QNetworkReply* reply = mClient->status("", apiKey);
 
     connect(reply, &QNetworkReply::finished, this, [this, reply, apiKey]()
     {
@@ -128,16 +117,7 @@ void LoginDialog::on_buttonBox_accepted()
         setEnabled(false);
         qApp->processEvents();
 
-        // Create the request
-        QNetworkRequest request(QUrl("https://api.malcore.io/auth/login"));
-        request.setRawHeader("Content-Type", "application/json");
-        request.setHeader(QNetworkRequest::UserAgentHeader, "x64dbg");
-
-        // Perform the POST
-        QJsonObject body;
-        body["email"] = ui->editEmail->text();
-        body["password"] = ui->editPassword->text();
-        QNetworkReply* reply = mHttp->post(request, QJsonDocument(body).toJson());
+        QNetworkReply* reply = mClient->login(email, password);
 
         connect(reply, &QNetworkReply::finished, this, [this, reply]()
         {
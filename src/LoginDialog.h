@@ -1,7 +1,8 @@
 #pragma once
 
 #include <QDialog>
-#include <QNetworkAccessManager>
+
+#include "MalcoreClient.h"
 
 namespace Ui
 {
@@ -13,7 +14,7 @@ class LoginDialog : public QDialog
     Q_OBJECT
 
 public:
-    explicit LoginDialog(QWidget* parent);
+    LoginDialog(MalcoreClient* client, QWidget* parent);
     ~LoginDialog();
     void startLogin(bool uploadAfter);
     QString apiKey() const { return mApiKey; }
@@ -31,7 +32,7 @@ private slots:
 
 private:
     Ui::LoginDialog *ui;
-    QNetworkAccessManager* mHttp = nullptr;
+    MalcoreClient* mClient = nullptr;
     QString mApiKey;
     bool mUploadAfter = false;
 };
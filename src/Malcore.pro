@@ -40,7 +40,7 @@ QMAKE_CXXFLAGS += -DQT_NO_UNICODE_LITERAL
 
 TARGET = Malcore
 TEMPLATE = lib
-LIBS += -luser32 -lshlwapi
+LIBS += -luser32 -lshlwapi -lwintrust
 
 !contains(QMAKE_HOST.arch, x86_64) {
     LIBS += -lx32dbg -lx32bridge -L"$$PWD/pluginsdk"
@@ -52,14 +52,21 @@ SOURCES +=\
     pluginmain.cpp \
     QtPlugin.cpp \
     PluginMainWindow.cpp \
-    LoginDialog.cpp
+    LoginDialog.cpp \
+    PerformanceDialog.cpp \
+    PluginCommands.cpp \
+    SearchDialog.cpp \
+    TraceWidget.cpp
 
 HEADERS += \
     pluginmain.h \
     QtPlugin.h \
     PluginMainWindow.h \
     LoginDialog.h \
-    MalcoreReport.h \
+    PerformanceDialog.h \
+    PluginCommands.h \
+    SearchDialog.h \
+    TraceWidget.h \
     pluginsdk/dbghelp/dbghelp.h \
     pluginsdk/DeviceNameResolver/DeviceNameResolver.h \
     pluginsdk/jansson/jansson.h \
@@ -96,7 +103,11 @@ HEADERS += \
 
 FORMS += \
     LoginDialog.ui \
-    PluginMainWindow.ui
+    PerformanceDialog.ui \
+    PluginMainWindow.ui \
+    SearchDialog.ui
 
 RESOURCES += \
     resource.qrc
+
+include(core/core.pri)
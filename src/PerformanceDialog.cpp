@@ -0,0 +1,112 @@
+#include "PerformanceDialog.h"
+#include "ui_PerformanceDialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QSaveFile>
+#include <QMap>
+#include <algorithm>
+#include "PerfTrace.h"
+#include "StallWatchdog.h"
+
+PerformanceDialog::PerformanceDialog(const QString& exportDir, QWidget* parent) : QDialog(parent), ui(new Ui::PerformanceDialog), mExportDir(exportDir)
+{
+    ui->setupUi(this);
+    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
+}
+
+PerformanceDialog::~PerformanceDialog()
+{
+    delete ui;
+}
+
+void PerformanceDialog::showEvent(QShowEvent* event)
+{
+    on_buttonRefresh_clicked();
+    QDialog::showEvent(event);
+}
+
+static QTableWidgetItem* durationItem(qint64 us)
+{
+    auto item = new QTableWidgetItem(QString::number(us / 1000.0, 'f', 2));
+    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+    return item;
+}
+
+void PerformanceDialog::on_buttonRefresh_clicked()
+{
+    auto stats = PerfTrace::stats();
+    ui->tableStats->setRowCount(stats.size());
+    for(int i = 0; i < stats.size(); i++)
+    {
+        const auto& phase = stats[i];
+        auto count = new QTableWidgetItem(QString::number(phase.count));
+        count->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        ui->tableStats->setItem(i, 0, new QTableWidgetItem(phase.phase));
+        ui->tableStats->setItem(i, 1, count);
+        ui->tableStats->setItem(i, 2, durationItem(phase.totalUs));
+        ui->tableStats->setItem(i, 3, durationItem(phase.count ? phase.totalUs / phase.count : 0));
+        ui->tableStats->setItem(i, 4, durationItem(phase.percentile(0.50)));
+        ui->tableStats->setItem(i, 5, durationItem(phase.percentile(0.95)));
+        ui->tableStats->setItem(i, 6, durationItem(phase.maxUs));
+    }
+    ui->tableStats->resizeColumnsToContents();
+    refreshStalls();
+}
+
+void PerformanceDialog::refreshStalls()
+{
+    struct Rank
+    {
+        QString phase;
+        qint64 count = 0;
+        qint64 totalMs = 0;
+        qint64 maxMs = 0;
+    };
+
+    // Rank the operations by total stall time
+    QMap<QString, Rank> ranks;
+    for(const auto& stall : StallWatchdog::readLog(mStallLog))
+    {
+        auto phase = stall.phase.isEmpty() ? QString("(x64dbg)") : stall.phase;
+        auto& rank = ranks[phase];
+        rank.phase = phase;
+        rank.count++;
+        rank.totalMs += stall.duration;
+        rank.maxMs = qMax(rank.maxMs, qint64(stall.duration));
+    }
+    auto sorted = ranks.values();
+    std::sort(sorted.begin(), sorted.end(), [](const Rank& a, const Rank& b)
+    {
+        return a.totalMs > b.totalMs;
+    });
+
+    ui->tableStalls->setRowCount(sorted.size());
+    for(int i = 0; i < sorted.size(); i++)
+    {
+        const auto& rank = sorted[i];
+        auto count = new QTableWidgetItem(QString::number(rank.count));
+        count->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        ui->tableStalls->setItem(i, 0, new QTableWidgetItem(rank.phase));
+        ui->tableStalls->setItem(i, 1, count);
+        ui->tableStalls->setItem(i, 2, durationItem(rank.totalMs * 1000));
+        ui->tableStalls->setItem(i, 3, durationItem(rank.maxMs * 1000));
+    }
+    ui->tableStalls->resizeColumnsToContents();
+}
+
+void PerformanceDialog::on_buttonReset_clicked()
+{
+    PerfTrace::reset();
+    on_buttonRefresh_clicked();
+}
+
+void PerformanceDialog::on_buttonExport_clicked()
+{
+    auto path = QFileDialog::getSaveFileName(this, "Export trace", mExportDir + "\\trace.json", "Chrome trace (*.json)");
+    if(path.isEmpty())
+        return;
+
+    QSaveFile f(path);
+    if(!f.open(QIODevice::WriteOnly) || f.write(PerfTrace::chromeTrace()) < 0 || !f.commit())
+        QMessageBox::critical(this, "Error", QString("Failed to write %1").arg(path));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QDialog>
+
+namespace Ui
+{
+class PerformanceDialog;
+}
+
+// Per-phase timing histograms collected by PerfTrace
+class PerformanceDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    PerformanceDialog(const QString& exportDir, QWidget* parent);
+    ~PerformanceDialog();
+    void setStallLog(const QString& path) { mStallLog = path; }
+
+protected:
+    void showEvent(QShowEvent* event) override;
+
+private slots:
+    void on_buttonRefresh_clicked();
+    void on_buttonReset_clicked();
+    void on_buttonExport_clicked();
+
+private:
+    void refreshStalls();
+
+    Ui::PerformanceDialog* ui;
+    QString mExportDir;
+    QString mStallLog;
+};
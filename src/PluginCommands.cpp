@@ -0,0 +1,215 @@
+#include "PluginCommands.h"
+#include "AnalysisEngine.h"
+#include "MalcoreReport.h"
+#include "ReportCache.h"
+#include "QtPlugin.h"
+#include "pluginmain.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QJsonDocument>
+
+static void usage()
+{
+    dputs("Usage:");
+    dputs("  malcore upload <addr|all-user>  queue the module at addr (or every user module) for analysis");
+    dputs("  malcore status                  list the analysis jobs");
+    dputs("  malcore wait [timeout ms]       wait until all queued jobs are finished");
+    dputs("  malcore export <dir>            copy the finished reports (JSON + HTML) to dir");
+}
+
+static void printJob(const AnalysisEngine::Job& job)
+{
+    auto line = QString("job %1 [%2] %3").arg(job.id).arg(AnalysisEngine::stateName(job.state)).arg(job.path);
+    if(job.cached)
+        line += " (cached)";
+    if(job.duplicateOf != 0)
+        line += QString(" (same hash as job %1)").arg(job.duplicateOf);
+    if(!job.error.isEmpty())
+        line += ": " + job.error;
+    dputs(line.toUtf8().constData());
+}
+
+static bool cmdUpload(AnalysisEngine* engine, const QString& arg)
+{
+    if(!DbgIsDebugging())
+    {
+        dputs("Not debugging!");
+        return false;
+    }
+
+    // The main executable and modules named explicitly are uploaded before the bulk of the DLLs
+    QStringList paths;
+    QStringList interactive;
+    if(arg == "all-user")
+    {
+        auto mainBase = Script::Module::GetMainModuleBase();
+        BridgeList<Script::Module::ModuleInfo> modules;
+        if(!Script::Module::GetList(&modules))
+        {
+            dputs("Failed to get the module list");
+            return false;
+        }
+        for(int i = 0; i < modules.Count(); i++)
+        {
+            if(DbgFunctions()->ModGetParty(modules[i].base) == mod_system)
+                continue;
+            paths.append(QString::fromUtf8(modules[i].path));
+            if(modules[i].base == mainBase)
+                interactive.append(paths.last());
+        }
+    }
+    else
+    {
+        bool success = false;
+        auto addr = DbgEval(arg.toUtf8().constData(), &success);
+        char path[MAX_PATH] = "";
+        if(!success || !Script::Module::PathFromAddr(addr, path))
+        {
+            dprintf("No module at %s\n", arg.toUtf8().constData());
+            return false;
+        }
+        paths.append(QString::fromUtf8(path));
+        interactive.append(paths.last());
+    }
+
+    int id = 0;
+    for(const auto& path : paths)
+    {
+        id = engine->submit(path, interactive.contains(path) ? RateLimiter::Interactive : RateLimiter::Batch);
+        dprintf("job %d: %s\n", id, path.toUtf8().constData());
+    }
+
+    // $result is the id of the last job that was queued
+    DbgValToString("$result", duint(id));
+    return id != 0;
+}
+
+static bool cmdStatus(AnalysisEngine* engine)
+{
+    auto jobs = engine->jobs();
+    for(const auto& job : jobs)
+        printJob(job);
+    dprintf("%d job(s)\n", jobs.size());
+    return true;
+}
+
+static bool cmdWait(AnalysisEngine* engine, const QString& arg)
+{
+    unsigned long timeout = ULONG_MAX;
+    if(!arg.isEmpty())
+    {
+        bool ok = false;
+        timeout = arg.toULong(&ok, 0);
+        if(!ok)
+        {
+            dprintf("Invalid timeout: %s\n", arg.toUtf8().constData());
+            return false;
+        }
+    }
+
+    auto idle = engine->waitForIdle(timeout);
+    int failed = 0;
+    for(const auto& job : engine->jobs())
+    {
+        printJob(job);
+        if(job.state == AnalysisEngine::Failed)
+            failed++;
+    }
+    if(!idle)
+        dputs("Timeout while waiting for the jobs to finish");
+
+    // $result is the number of failed jobs
+    DbgValToString("$result", duint(failed));
+    return idle;
+}
+
+static bool cmdExport(AnalysisEngine* engine, const QString& arg)
+{
+    if(arg.isEmpty())
+    {
+        usage();
+        return false;
+    }
+
+    QDir dir(arg);
+    if(!dir.mkpath("."))
+    {
+        dprintf("Failed to create directory: %s\n", arg.toUtf8().constData());
+        return false;
+    }
+
+    int exported = 0;
+    for(const auto& job : engine->jobs())
+    {
+        if(job.state != AnalysisEngine::Finished)
+            continue;
+
+        QFile f(job.jsonPath);
+        if(!f.open(QIODevice::ReadOnly))
+            continue;
+        auto json = f.readAll();
+
+        // The store is keyed by hash only, name the exported report after the module
+        auto jsonPath = dir.filePath(QString("report-%1-%2.json").arg(QFileInfo(job.path).baseName(), job.sha256));
+        QFile fj(jsonPath);
+        if(!fj.open(QIODevice::WriteOnly) || fj.write(json) != json.size())
+        {
+            dprintf("Failed to write %s\n", jsonPath.toUtf8().constData());
+            continue;
+        }
+
+        // NOTE: the exported HTML is not rebased, the module might not be loaded anymore
+        auto root = QJsonDocument::fromJson(json).object();
+        MalcoreAnalysis analysis(root["data"].toObject(), 0, 0, 0);
+        QFile fh(ReportCache::htmlPath(jsonPath));
+        if(fh.open(QIODevice::WriteOnly))
+            fh.write(analysis.getReportHtml().toUtf8());
+
+        exported++;
+    }
+
+    dprintf("Exported %d report(s) to %s\n", exported, QDir::toNativeSeparators(dir.absolutePath()).toUtf8().constData());
+    DbgValToString("$result", duint(exported));
+    return true;
+}
+
+static bool cbMalcoreCommand(int argc, char** argv)
+{
+    // "malcore upload all-user" arrives as argv[1] == "upload all-user"
+    QStringList args;
+    for(int i = 1; i < argc; i++)
+        args.append(QString::fromUtf8(argv[i]).trimmed());
+    auto line = args.join(' ').trimmed();
+    auto space = line.indexOf(' ');
+    auto subcommand = space == -1 ? line : line.left(space);
+    auto arg = space == -1 ? QString() : line.mid(space + 1).trimmed();
+
+    auto engine = QtPlugin::AcquireEngine();
+    if(engine == nullptr)
+    {
+        dputs("The plugin is not initialized yet");
+        return false;
+    }
+
+    auto result = false;
+    if(subcommand == "upload" && !arg.isEmpty())
+        result = cmdUpload(engine, arg);
+    else if(subcommand == "status")
+        result = cmdStatus(engine);
+    else if(subcommand == "wait")
+        result = cmdWait(engine, arg);
+    else if(subcommand == "export")
+        result = cmdExport(engine, arg);
+    else
+        usage();
+    QtPlugin::ReleaseEngine();
+    return result;
+}
+
+void PluginCommands::Register()
+{
+    _plugin_registercommand(Plugin::handle, "malcore", cbMalcoreCommand, false);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+namespace PluginCommands
+{
+void Register();
+} //PluginCommands
@@ -7,13 +7,10 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
-#include <QHttpPart>
 #include <QFileInfo>
 #include <QNetworkReply>
-#include <QUrlQuery>
 #include <QAbstractListModel>
 #include <QDir>
-#include <QCryptographicHash>
 #include <QKeyEvent>
 #include <QDesktopServices>
 #include <QClipboard>
@@ -21,10 +18,43 @@
 #include "pluginmain.h"
 #include "LoginDialog.h"
 #include "MalcoreReport.h"
+#include "ReportIndex.h"
+#include "ReportCache.h"
+#include "NotificationClient.h"
+#include "PerfTrace.h"
+
+#include <softpub.h>
+#include <wintrust.h>
+
+static bool isSignedFile(const QString& path)
+{
+    // Embedded Authenticode signatures only, catalog-signed files (most of Windows) count as
+    // unsigned. Revocation is not checked, it would go to the network.
+    auto widePath = path.toStdWString();
+    WINTRUST_FILE_INFO fileInfo = {};
+    fileInfo.cbStruct = sizeof(fileInfo);
+    fileInfo.pcwszFilePath = widePath.c_str();
+
+    GUID action = WINTRUST_ACTION_GENERIC_VERIFY_V2;
+    WINTRUST_DATA trustData = {};
+    trustData.cbStruct = sizeof(trustData);
+    trustData.dwUIChoice = WTD_UI_NONE;
+    trustData.fdwRevocationChecks = WTD_REVOKE_NONE;
+    trustData.dwUnionChoice = WTD_CHOICE_FILE;
+    trustData.pFile = &fileInfo;
+    trustData.dwStateAction = WTD_STATEACTION_VERIFY;
+    trustData.dwProvFlags = WTD_CACHE_ONLY_URL_RETRIEVAL;
+    auto status = WinVerifyTrust(static_cast<HWND>(INVALID_HANDLE_VALUE), &action, &trustData);
+
+    trustData.dwStateAction = WTD_STATEACTION_CLOSE;
+    WinVerifyTrust(static_cast<HWND>(INVALID_HANDLE_VALUE), &action, &trustData);
+    return status == ERROR_SUCCESS;
+}
 
 PluginMainWindow::PluginMainWindow(QWidget* parent)
     : QMainWindow(parent)
     , ui(new Ui::PluginMainWindow)
+    , mCreated(PerfTrace::now())
 {
     ui->setupUi(this);
 
@@ -39,34 +69,204 @@ PluginMainWindow::PluginMainWindow(QWidget* parent)
     // Hide the menu bar
     ui->menubar->setVisible(false);
 
+    connect(ui->traceWidget, &TraceWidget::addressActivated, this, [this](quint64 address)
+    {
+        on_editReport_anchorClicked(QUrl(QString("address://0x%1").arg(address, 0, 16)));
+    });
+
+    // x64dbg waits for the constructor, everything else is set up once its event loop runs (or
+    // when the plugin is used before that)
+    QTimer::singleShot(0, this, [this]()
+    {
+        initialize();
+    });
+}
+
+// Loads started by initialize() that run in the background, see startupStepFinished()
+enum StartupStep
+{
+    StartupSearchIndex = 1, // after the report cache metadata
+    StartupSimilarityIndex = 2,
+    StartupJournal = 4,
+};
+
+void PluginMainWindow::initialize()
+{
+    if(mInitialized)
+        return;
+    mInitialized = true;
+    PerfTrace::Scope scope("initialize");
+    auto initStart = PerfTrace::now();
+
     mUserDir = QString::fromUtf16((const ushort*)BridgeUserDirectory());
     mUserDir += "\\Malcore";
     QDir(mUserDir).mkpath(".");
 
+    mClient = new MalcoreClient(this);
     char setting[MAX_SETTING_SIZE]="";
     if(BridgeSettingGet("Malcore", "ApiKey", setting))
-        mApiKey = QString::fromUtf8(setting);
+        mClient->setApiKey(QString::fromUtf8(setting));
+    if(BridgeSettingGet("Malcore", "BaseUrl", setting) && *setting)
+        mClient->setBaseUrl(QUrl(QString::fromUtf8(setting)));
+    // Completion notifications instead of status polling (0 always polls)
+    duint pushNotifications = 1;
+    BridgeSettingGetUint("Malcore", "PushNotifications", &pushNotifications);
+    mClient->notifications()->setEnabled(pushNotifications != 0);
+    // Uploads and status requests share a token bucket (0 is unlimited)
+    duint requestsPerMinute = 60, requestBurst = 5;
+    BridgeSettingGetUint("Malcore", "ApiRequestsPerMinute", &requestsPerMinute);
+    BridgeSettingGetUint("Malcore", "ApiRequestBurst", &requestBurst);
+    mClient->limiter()->setRate(int(requestsPerMinute), int(requestBurst));
+    connect(mClient->limiter(), &RateLimiter::changed, this, &PluginMainWindow::updateStatusLabel);
+    connect(mClient->breaker(), &CircuitBreaker::opened, this, [this]()
+    {
+        logInfo("[api] Malcore is unreachable, requests wait until it is back");
+    });
+    connect(mClient->breaker(), &CircuitBreaker::closed, this, [this]()
+    {
+        logInfo("[api] Malcore is reachable again");
+    });
 
-    mHttp = new QNetworkAccessManager(this);
-    mLogFile = new QFile(QString("%1\\debug.log").arg(mUserDir), this);
-    if(!mLogFile->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+    // Record GUI thread stalls (0 disables the watchdog)
+    duint stallThreshold = 250;
+    BridgeSettingGetUint("Malcore", "StallThresholdMs", &stallThreshold);
+    if(stallThreshold != 0)
     {
-        dputs("Failed to open 'malcore.log'...");
-        delete mLogFile;
-        mLogFile = nullptr;
+        mWatchdog = new StallWatchdog(QString("%1\\stalls.bin").arg(mUserDir), int(stallThreshold), this);
+        mWatchdog->start();
     }
 
-    mPollTimer = new QTimer(this);
-    mPollTimer->setInterval(300);
-    mPollTimer->setSingleShot(true);
-    connect(mPollTimer, &QTimer::timeout, this, &PluginMainWindow::pollTimerSlot);
 
-    mLoginDialog = new LoginDialog(this);
-    connect(mLoginDialog, &LoginDialog::accepted, this, &PluginMainWindow::loginAcceptedSlot);
+    // Reports are kept by file hash, the least recently used ones are evicted past the quota
+    duint reportQuotaMb = 2048;
+    BridgeSettingGetUint("Malcore", "ReportQuotaMb", &reportQuotaMb);
+    mCache = new ReportCache(mUserDir, this);
+    mCache->setQuota(qint64(reportQuotaMb) * 1024 * 1024);
+    connect(mCache, &ReportCache::fileHashed, this, &PluginMainWindow::fileHashedSlot);
+
+    // The indexes load their files and catch up with the cached reports after every compaction
+    mStartupPending = StartupSearchIndex | StartupSimilarityIndex | StartupJournal;
+    mSearchIndex = new ReportSearchIndex(mCache, this);
+    connect(mSearchIndex, &ReportSearchIndex::rescanFinished, this, [this]()
+    {
+        startupStepFinished(StartupSearchIndex);
+    });
+    mSimilarityIndex = new SimilarityIndex(mCache, this);
+    connect(mSimilarityIndex, &SimilarityIndex::rescanFinished, this, [this]()
+    {
+        startupStepFinished(StartupSimilarityIndex);
+    });
+    connect(mCache, &ReportCache::compactFinished, this, [this](int evicted, qint64 freedBytes)
+    {
+        if(evicted > 0)
+            logInfo(QString("[cache] evicted %1 report(s), %2 KiB").arg(evicted).arg(freedBytes / 1024));
+        mSearchIndex->rescanAsync();
+        mSimilarityIndex->rescanAsync();
+    });
+    // Reads the metadata (waiting for other instances) on the cache thread
+    mCache->compactAsync();
+
+    // Reports that were shown stay rendered after StopDebug, for restarting the target (0 disables it)
+    duint sessionCacheMb = 256;
+    BridgeSettingGetUint("Malcore", "SessionCacheMb", &sessionCacheMb);
+    mSession.reset(new SessionCache(qint64(sessionCacheMb) * 1024 * 1024));
+
+    // Reports of user modules are prepared in the background when they load (0 disables it)
+    duint prefetchReports = 1;
+    BridgeSettingGetUint("Malcore", "PrefetchReports", &prefetchReports);
+    if(prefetchReports != 0)
+    {
+        mPrefetcher = new ReportPrefetcher(mCache, mSimilarityIndex, this);
+        connect(mPrefetcher, &ReportPrefetcher::prepared, this, &PluginMainWindow::reportPreparedSlot);
+    }
+
+    // Jobs queued by the malcore command
+    mEngine = new AnalysisEngine(mClient, mCache, this);
+    connect(mEngine, &AnalysisEngine::logMessage, this, &PluginMainWindow::logInfo);
+    connect(mEngine, &AnalysisEngine::jobFinished, this, &PluginMainWindow::jobFinishedSlot);
+    connect(mEngine, &AnalysisEngine::journalReplayed, this, [this]()
+    {
+        startupStepFinished(StartupJournal);
+    });
+    // The malcore command can use it from now on
+    QtPlugin::SetEngine(mEngine);
+
+    // Opt-in: queue modules as they load by the rules in auto-analysis.json (default rules without it)
+    duint autoAnalyze = 0;
+    BridgeSettingGetUint("Malcore", "AutoAnalyze", &autoAnalyze);
+    if(autoAnalyze != 0)
+    {
+        mAutoAnalyzer = new AutoAnalyzer(mEngine, mCache, this);
+        mAutoAnalyzer->setSignatureCheck(isSignedFile);
+        connect(mAutoAnalyzer, &AutoAnalyzer::policyFailed, this, [this](const QString& error)
+        {
+            logInfo("[auto] invalid policy, nothing is analyzed automatically: " + error);
+        });
+        mAutoAnalyzer->loadPolicy(QString("%1\\auto-analysis.json").arg(mUserDir));
+        connect(mAutoAnalyzer, &AutoAnalyzer::decided, this, [this](const QString& path, bool analyze, const QString& rule)
+        {
+            logInfo(QString("[auto] %1: %2 (%3)").arg(path, analyze ? "queued" : "skipped", rule.isEmpty() ? QString("no rule matched") : rule));
+        });
+    }
+
+    // Stale reports are downloaded again if they changed on the server (0 disables it)
+    duint reportRefreshDays = 7;
+    BridgeSettingGetUint("Malcore", "ReportRefreshDays", &reportRefreshDays);
+    mRefresher = new ReportRefresher(mClient, mCache, this);
+    mRefresher->setMaxAge(qint64(reportRefreshDays) * 24 * 60 * 60 * 1000);
+    connect(mRefresher, &ReportRefresher::refreshed, this, &PluginMainWindow::reportRefreshedSlot);
+    connect(mRefresher, &ReportRefresher::refreshFailed, this, [this](const QString& jsonPath, const QString& error)
+    {
+        logInfo(QString("[refresh] %1: %2").arg(jsonPath, error));
+    });
+
+    // Uploads that were still pending when x64dbg exited are polled again in the background
+    mJournal.reset(new JobJournal(QString("%1\\journal.bin").arg(mUserDir)));
+    mClient->setJournal(mJournal.get());
+    mEngine->resumeJournal(mJournal.get());
+
+    // The dialogs, the log file and the network connection are only created when they are used
+    auto initTime = PerfTrace::now() - initStart;
+    logInfo(QString("[startup] plugin setup %1 ms, initialize %2 ms").arg(PerfTrace::phaseStats("startup").maxUs / 1000.0, 0, 'f', 1).arg(initTime / 1000.0, 0, 'f', 1));
+}
+
+void PluginMainWindow::startupStepFinished(int step)
+{
+    // Later rescans finish the same steps again
+    if((mStartupPending & step) == 0)
+        return;
+    mStartupPending &= ~step;
+    if(mStartupPending != 0)
+        return;
+
+    // From the constructor until the cache, the indexes and the journal are loaded
+    auto readyTime = PerfTrace::now() - mCreated;
+    PerfTrace::record("ready", mCreated, readyTime);
+    logInfo(QString("[startup] ready after %1 ms").arg(readyTime / 1000.0, 0, 'f', 1));
+}
+
+LoginDialog* PluginMainWindow::loginDialog()
+{
+    if(mLoginDialog == nullptr)
+    {
+        mLoginDialog = new LoginDialog(mClient, this);
+        connect(mLoginDialog, &LoginDialog::accepted, this, &PluginMainWindow::loginAcceptedSlot);
+    }
+    return mLoginDialog;
 }
 
 PluginMainWindow::~PluginMainWindow()
 {
+    // These use the report cache (also from their threads), children are deleted in creation order
+    delete mPrefetcher;
+    delete mAutoAnalyzer;
+    delete mRefresher;
+    delete mEngine;
+    delete mSearchDialog;
+    delete mSearchIndex;
+    delete mSimilarityIndex;
+    if(mClient != nullptr)
+        mClient->setJournal(nullptr);
     delete ui;
 }
 
@@ -78,6 +278,12 @@ static QString getModulePath(duint base)
     return QString::fromUtf8(pathUtf8);
 }
 
+static QString getModuleLabel(duint base, bool analyzed)
+{
+    auto party = DbgFunctions()->ModGetParty(base) == mod_system ? "system" : "user";
+    return QString("[%1%2] %3").arg(party, analyzed ? ", analyzed" : "", getModulePath(base));
+}
+
 static bool getHeaderInfo(uintptr_t base, uintptr_t& headerBase, uintptr_t& imageSize)
 {
     // NOTE: there currently isn't a function for this in the SDK
@@ -91,6 +297,7 @@ static bool getHeaderInfo(uintptr_t base, uintptr_t& headerBase, uintptr_t& imag
 
 void PluginMainWindow::pluginEvent(QtPlugin::EventType event, const QVariant& data)
 {
+    initialize();
     switch(event)
     {
     case QtPlugin::LoadModule:
@@ -99,22 +306,36 @@ void PluginMainWindow::pluginEvent(QtPlugin::EventType event, const QVariant& da
         {
             mIsDebugging = true;
             enableUi(true);
-            ui->labelStatus->setText("Ready!");
+            setStatus("Ready!");
         }
         auto base = data.toULongLong();
-        auto party = DbgFunctions()->ModGetParty(base);
-        auto path = getModulePath(base);
-        ui->comboModules->addItem(QString("[%1] %2").arg(party == mod_system ? "system" : "user", path), QVariant(base));
+        ui->comboModules->addItem(getModuleLabel(base, false), QVariant(base));
+        if(mAutoAnalyzer != nullptr)
+            mAutoAnalyzer->moduleLoaded(getModulePath(base), DbgFunctions()->ModGetParty(base) == mod_system);
         if(ui->comboModules->count() == 1)
         {
             ui->comboModules->setCurrentIndex(0);
         }
+        else
+        {
+            prefetchModule(base);
+        }
     }
     break;
 
     case QtPlugin::UnloadModule:
     {
         duint base = data.toULongLong();
+        if(mDisplayedModule == base)
+            mDisplayedModule = 0;
+        if(mHashModule == base)
+        {
+            mHashModule = 0;
+            enableUi(true);
+            setStatus("Ready!");
+            ui->progressBar->setMaximum(100);
+            ui->progressBar->setValue(0);
+        }
         for(int i = 0; i < ui->comboModules->count(); i++)
         {
             duint entryBase = ui->comboModules->itemData(i).toULongLong();
@@ -124,15 +345,33 @@ void PluginMainWindow::pluginEvent(QtPlugin::EventType event, const QVariant& da
                 break;
             }
         }
+        if(mPrefetcher != nullptr)
+            mPrefetcher->cancel(base);
     }
     break;
 
     case QtPlugin::StopDebug:
     {
         mIsDebugging = false;
+        // The request keeps going for the jobs that share it
+        if(mAnalysis != nullptr)
+        {
+            disconnect(mAnalysis, nullptr, this, nullptr);
+            mAnalysis = nullptr;
+            mPollModule = 0;
+        }
+        mUploadLock.reset();
+        mHashModule = 0;
+        showAnnotations(nullptr);
+        mDisplayedModule = 0;
         ui->comboModules->clear();
-        ui->labelStatus->setText("Start debugging to analyze a module...");
+        // The session cache remembers them for as long as the files are unchanged
+        mReportPaths.clear();
+        if(mPrefetcher != nullptr)
+            mPrefetcher->clear();
+        setStatus("Start debugging to analyze a module...");
         ui->editReport->clear();
+        ui->traceWidget->setTrace(nullptr);
         enableUi(false);
         ui->buttonOptions->setEnabled(true);
     }
@@ -184,8 +423,21 @@ void PluginMainWindow::enableUi(bool enabled)
 void PluginMainWindow::logInfo(const QString& message)
 {
     qDebug().noquote() << message;
+    // Opened with the first message after initialize()
+    if(mLogFile == nullptr && !mLogFailed && !mUserDir.isEmpty())
+    {
+        mLogFile = new QFile(QString("%1\\debug.log").arg(mUserDir), this);
+        if(!mLogFile->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        {
+            dputs("Failed to open 'malcore.log'...");
+            delete mLogFile;
+            mLogFile = nullptr;
+            mLogFailed = true;
+        }
+    }
     if(mLogFile != nullptr)
     {
+        PerfTrace::Scope scope("log");
         auto date = QString("[%1] ").arg(QDateTime::currentDateTime().toString(Qt::ISODate));
         mLogFile->write(date.toUtf8());
         mLogFile->write(message.toUtf8());
@@ -196,203 +448,162 @@ void PluginMainWindow::logInfo(const QString& message)
 
 void PluginMainWindow::setStatus(const QString& status)
 {
-    ui->labelStatus->setText(status);
-    if(ui->labelStatus->text() != status)
+    if(mStatus != status)
     {
         logInfo("[status] " + status);
     }
+    mStatus = status;
+    updateStatusLabel();
 }
 
-void PluginMainWindow::pollTimerSlot()
+void PluginMainWindow::updateStatusLabel()
 {
-    // Reference: https://malcore.readme.io/reference/status-check
-    logInfo(QString("[poll] %1").arg(mPollUuid));
-
-    // Create the request
-    QNetworkRequest request(QUrl("https://api.malcore.io/api/status"));
-    request.setRawHeader("apiKey", mApiKey.toUtf8());
-    request.setRawHeader("Content-Type", "application/x-www-form-urlencoded");
-    request.setHeader(QNetworkRequest::UserAgentHeader, "x64dbg");
+    // Requests held back by the rate limiter
+    auto limiter = mClient->limiter();
+    auto text = mStatus;
+    if(limiter->queued() > 0)
+        text += QString(" (%1 request(s) queued, ~%2 s)").arg(limiter->queued()).arg((limiter->expectedWait() + 999) / 1000);
+    ui->labelStatus->setText(text);
+}
 
-    // Perform the POST
-    QUrlQuery query;
-    query.addQueryItem("uuid", mPollUuid);
-    QNetworkReply* reply = mHttp->post(request, query.toString().toUtf8());
+void PluginMainWindow::jobFinishedSlot(int id, const QString& path, const QString& jsonPath)
+{
+    // Only the report of the job, a cached one is not parsed again
+    mSearchIndex->updateAsync(jsonPath);
+    mSimilarityIndex->updateAsync(jsonPath);
+    markAnalyzed(path);
 
-    connect(reply, &QNetworkReply::finished, this, [this, reply]()
-    {
-        // Handle the response here
-        if (reply->error() == QNetworkReply::NoError)
-        {
-            QByteArray responseData = reply->readAll();
+    // Show the report if the module is currently selected
+    auto index = ui->comboModules->currentIndex();
+    if(index == -1 || mAnalysis != nullptr)
+        return;
+    duint base = ui->comboModules->itemData(index).toULongLong();
+    if(getModulePath(base) != path)
+        return;
+    setReportJsonPath(path, jsonPath);
+    on_comboModules_currentIndexChanged(index);
+}
 
-            logInfo("[poll] response: " + QString::fromUtf8(responseData));
+void PluginMainWindow::fileHashedSlot(const QString& path, const QString& sha256)
+{
+    if(!sha256.isEmpty())
+        setReportJsonPath(path, mCache->jsonPath(sha256));
 
-            auto json = QJsonDocument::fromJson(responseData).object();
-            auto success = json["success"].toBool();
-            if(!success)
-            {
-                setStatus("Failed to get report!");
-                enableUi(true);
-                ui->progressBar->setMaximum(100);
-                ui->progressBar->setValue(0);
-                QMessageBox::critical(this, "Poll Error", reply->errorString());
-            }
-            else
-            {
-                QJsonObject data = json["data"].toObject();
-                auto status = data["status"].toString();
-                if(status == "pending")
-                {
-                    // Poll again
-                    mPollTimer->start();
-                }
-                else
-                {
-                    // Finish processing
-                    enableUi(true);
-                    setStatus("Ready!");
-                    ui->progressBar->setMaximum(100);
-                    ui->progressBar->setValue(0);
-
-                    // Cache the report
-                    auto jsonPath = getReportJsonPath(mPollModule);
-                    auto loadedBase = mPollModule;
-                    {
-                        QFile f(jsonPath);
-                        if(f.open(QIODevice::WriteOnly))
-                            f.write(responseData);
-                    }
-                    mPollUuid.clear();
-                    mPollModule = 0;
-                    displayReport(std::move(data), jsonPath, loadedBase);
-                }
-            }
-        }
-        else
+    if(mHashModule != 0 && getModulePath(mHashModule) == path)
+    {
+        auto base = mHashModule;
+        mHashModule = 0;
+        if(sha256.isEmpty())
         {
-            logInfo("[poll] error: " + reply->errorString());
-            setStatus(reply->errorString());
+            setStatus("Failed to hash the module");
             enableUi(true);
             ui->progressBar->setMaximum(100);
             ui->progressBar->setValue(0);
-            QMessageBox::critical(this, "Poll Error", reply->errorString());
+            QMessageBox::critical(this, "Error", QString("Failed to hash %1").arg(path));
+            return;
         }
+        startUpload(base, path, mCache->jsonPath(sha256));
+        return;
+    }
 
-        // Clean up
-        reply->deleteLater();
-    });
-    connect(reply, &QNetworkReply::uploadProgress, this, [this](qint64 bytesSent, qint64 bytesTotal)
-    {
-        logInfo(QString("[poll] upload %1/%2").arg(bytesSent).arg(bytesTotal));
-    });
-    connect(reply, &QNetworkReply::downloadProgress, this, [this](qint64 bytesReceived, qint64 bytesTotal)
-    {
-        logInfo(QString("[poll] download %1/%2").arg(bytesReceived).arg(bytesTotal));
-        if(bytesReceived == bytesTotal)
-        {
-            ui->progressBar->setMaximum(0);
-            ui->progressBar->setValue(0);
-        }
-        else
-        {
-            ui->progressBar->setMaximum(bytesTotal);
-            ui->progressBar->setValue(bytesReceived);
-            setStatus("Downloading report...");
-        }
-    });
+    // Show the report of the selected module, if there is one
+    auto index = ui->comboModules->currentIndex();
+    if(sha256.isEmpty() || index == -1 || mAnalysis != nullptr || mDisplayedModule != 0)
+        return;
+    if(getModulePath(ui->comboModules->itemData(index).toULongLong()) == path)
+        on_comboModules_currentIndexChanged(index);
 }
 
 void PluginMainWindow::loginAcceptedSlot()
 {
-    mApiKey = mLoginDialog->apiKey();
-    BridgeSettingSet("Malcore", "ApiKey", mApiKey.toUtf8().constData());
+    mClient->setApiKey(mLoginDialog->apiKey());
+    BridgeSettingSet("Malcore", "ApiKey", mLoginDialog->apiKey().toUtf8().constData());
     if(mLoginDialog->uploadAfter())
     {
         ui->buttonUpload->click();
     }
 }
 
-void PluginMainWindow::uploadFile(uintptr_t moduleBase, const QString& path)
+void PluginMainWindow::uploadFile(uintptr_t moduleBase, const QString& path, const QString& jsonPath)
 {
-    // Reference: https://malcore.readme.io/reference/upload
     logInfo("[upload] file: " + path);
 
-    // Open the file for the form data
-    auto fileName = QFileInfo(path).fileName();
-    QHttpPart filePart;
-    filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QString("form-data; name=\"filename1\"; filename=\"%1\"").arg(fileName));
-    QFile* file = new QFile(path);
-    if(!file->open(QIODevice::ReadOnly))
-    {
-        QMessageBox::critical(this, "Error", QString("Failed to open file: %1").arg(path));
-        return;
-    }
-
-    // Create a multi-part form data object
-    QHttpMultiPart* multiPart = new QHttpMultiPart(QHttpMultiPart::FormDataType);
-    filePart.setBodyDevice(file);
-    file->setParent(multiPart); // Ownership of the file is transferred to the multi-part object
-    multiPart->append(filePart);
+    // Joins the upload of a malcore command job for the same file
+    auto request = mClient->analyze(ReportCache::hashFromPath(jsonPath), path, jsonPath);
+    mAnalysis = request;
+    mPollModule = moduleBase;
 
-    // Create the request and set the necessary headers
-    QNetworkRequest request(QUrl("https://api.malcore.io/api/upload"));
-    request.setRawHeader("apiKey", mApiKey.toUtf8());
-    request.setRawHeader("X-No-Poll", "true");
-    request.setHeader(QNetworkRequest::UserAgentHeader, "x64dbg");
+    connect(request, &AnalysisRequest::uploaded, this, [this](const QByteArray& response)
+    {
+        logInfo("[upload] response: " + QString::fromUtf8(response));
+        setStatus("Waiting for report...");
+        ui->progressBar->setMaximum(0);
+        ui->progressBar->setValue(0);
+    });
+    connect(request, &AnalysisRequest::polled, this, [this](const QByteArray& response)
+    {
+        logInfo("[poll] response: " + QString::fromUtf8(response));
+    });
+    connect(request, &AnalysisRequest::offline, this, [this, request, path]()
+    {
+        // Hand it over to the engine instead of keeping the UI busy, the engine job joins the
+        // request once it has the upload lock
+        disconnect(request, nullptr, this, nullptr);
+        mUploadLock.reset();
+        mAnalysis = nullptr;
+        mPollModule = 0;
+        queueOffline(path);
+    });
+    connect(request, &AnalysisRequest::finished, this, [this, request](const QString& jsonPath)
+    {
+        logInfo(QString("[poll] report: %1 (%2 bytes)").arg(jsonPath).arg(QFileInfo(jsonPath).size()));
 
-    // Send the POST request
-    QNetworkReply* reply = mHttp->post(request, multiPart);
-    multiPart->setParent(reply); // Ownership of the multi-part object is transferred to the reply
+        // Finish processing
+        enableUi(true);
+        setStatus("Ready!");
+        ui->progressBar->setMaximum(100);
+        ui->progressBar->setValue(0);
 
-    // Connect signals for handling the response
-    connect(reply, &QNetworkReply::finished, this, [this, reply, moduleBase]()
+        auto loadedBase = mPollModule;
+        QJsonObject data;
+        {
+            PerfTrace::Scope scope("parse");
+            data = ReportCache::readReport(jsonPath);
+        }
+        {
+            PerfTrace::Scope scope("store");
+            mCache->add(jsonPath, getModulePath(loadedBase), request->uuid(), request->etag());
+            mSearchIndex->update(jsonPath, data);
+            mSimilarityIndex->update(jsonPath, data);
+        }
+        mUploadLock.reset();
+        mAnalysis = nullptr;
+        mPollModule = 0;
+        markAnalyzed(getModulePath(loadedBase));
+        mDisplayedModule = loadedBase;
+        displayReport(std::move(data), jsonPath, loadedBase);
+    });
+    connect(request, &AnalysisRequest::failed, this, [this](const QString& error, int httpStatus)
     {
-        if (reply->error() == QNetworkReply::NoError)
+        logInfo("[upload] error: " + error);
+        mUploadLock.reset();
+        mAnalysis = nullptr;
+        mPollModule = 0;
+        setStatus(error);
+        enableUi(true);
+        ui->progressBar->setMaximum(100);
+        ui->progressBar->setValue(0);
+
+        if(httpStatus == 403)
         {
-            QByteArray responseData = reply->readAll();
-
-            // Process the response data as needed
-            logInfo("[upload] response: " + QString::fromUtf8(responseData));
-
-            auto root = QJsonDocument::fromJson(responseData).object();
-            QJsonObject data = root["data"].toObject();
-            QJsonObject data2 = data["data"].toObject();
-
-            setStatus("Waiting for report...");
-
-            ui->progressBar->setMaximum(0);
-            ui->progressBar->setValue(0);
-
-            // Start polling
-            auto uuid = data2["uuid"].toString();
-            mPollUuid = uuid;
-            mPollModule = moduleBase;
-            mPollTimer->start();
+            loginDialog()->startLogin(true);
         }
         else
         {
-            logInfo("[upload] error: " + reply->errorString());
-            setStatus(reply->errorString());
-            enableUi(true);
-            ui->progressBar->setMaximum(100);
-            ui->progressBar->setValue(0);
-
-            auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-            if(status == 403)
-            {
-                mLoginDialog->startLogin(true);
-            }
-            else
-            {
-                QMessageBox::critical(this, "Upload Error", reply->errorString());
-            }
+            QMessageBox::critical(this, "Error", error);
         }
-
-        // Clean up
-        reply->deleteLater();
     });
-    connect(reply, &QNetworkReply::uploadProgress, this, [this](qint64 bytesSent, qint64 bytesTotal)
+    connect(request, &AnalysisRequest::uploadProgress, this, [this](qint64 bytesSent, qint64 bytesTotal)
     {
         logInfo(QString("[upload] upload %1/%2").arg(bytesSent).arg(bytesTotal));
         if(bytesSent == bytesTotal)
@@ -407,15 +618,27 @@ void PluginMainWindow::uploadFile(uintptr_t moduleBase, const QString& path)
             setStatus("Uploading executable...");
         }
     });
-    connect(reply, &QNetworkReply::downloadProgress, this, [this](qint64 bytesReceived, qint64 bytesTotal)
+    connect(request, &AnalysisRequest::downloadProgress, this, [this](qint64 bytesReceived, qint64 bytesTotal)
     {
-        logInfo(QString("[upload] download %1/%2").arg(bytesReceived).arg(bytesTotal));
+        logInfo(QString("[poll] download %1/%2").arg(bytesReceived).arg(bytesTotal));
+        if(bytesReceived == bytesTotal)
+        {
+            ui->progressBar->setMaximum(0);
+            ui->progressBar->setValue(0);
+        }
+        else
+        {
+            ui->progressBar->setMaximum(bytesTotal);
+            ui->progressBar->setValue(bytesReceived);
+            setStatus("Downloading report...");
+        }
     });
 
     ui->editReport->clear();
+    ui->traceWidget->setTrace(nullptr);
     ui->progressBar->setMaximum(0);
     ui->progressBar->setValue(0);
-    setStatus("Upload started!");
+    setStatus(request->uuid().isEmpty() ? "Upload started!" : "Waiting for report...");
 }
 
 void PluginMainWindow::displayReport(QJsonObject data, const QString& jsonPath, uintptr_t loadedBase)
@@ -424,20 +647,122 @@ void PluginMainWindow::displayReport(QJsonObject data, const QString& jsonPath,
     uintptr_t imageSize = 0;
     getHeaderInfo(loadedBase, headerBase, imageSize);
 
-    MalcoreAnalysis analysis(std::move(data), loadedBase, headerBase, imageSize);
-    auto html = analysis.getReportHtml();
+    // The example report is not associated with a loaded module
+    std::shared_ptr<const TraceQuery> query;
+    {
+        PerfTrace::Scope scope("trace");
+        query = std::make_shared<TraceQuery>(TraceStore::build(data["dynamic_analysis"].toObject()["parsed_output"].toArray(), loadedBase, headerBase, imageSize));
+    }
+
+    std::unique_ptr<const ReportIndex> index;
+    if(loadedBase != 0)
+    {
+        PerfTrace::Scope scope("index");
+        index = ReportIndex::build(query->trace(), data);
+    }
+    SessionCache::Report cached;
+    if(index)
+        cached.index = index->clone();
+    showAnnotations(std::move(index));
+
+    QString html;
+    {
+        PerfTrace::Scope scope("render");
+        auto matches = mSimilarityIndex->similar(data, jsonPath);
+        MalcoreAnalysis analysis(std::move(data), loadedBase, headerBase, imageSize, &query->trace());
+        analysis.setLocalMatches(matches);
+        html = analysis.getReportHtml();
+    }
     if(!jsonPath.isEmpty())
     {
-        auto htmlPath = jsonPath;
-        auto periodIdx = htmlPath.lastIndexOf('.');
-        if(periodIdx != -1)
-            htmlPath.resize(periodIdx);
-        htmlPath += ".html";
-        QFile f(htmlPath);
-        if(f.open(QIODevice::WriteOnly))
-            f.write(html.toUtf8());
+        PerfTrace::Scope scope("store");
+        mCache->store(ReportCache::htmlPath(jsonPath), html.toUtf8());
+    }
+    if(!jsonPath.isEmpty() && loadedBase != 0)
+    {
+        cached.query = query;
+        cached.html = html;
+        mSession->insert(jsonPath, loadedBase, cached);
+    }
+
+    {
+        PerfTrace::Scope scope("layout");
+        ui->editReport->setHtml(html);
+    }
+
+    PerfTrace::Scope scope("query");
+    ui->traceWidget->setTrace(std::move(query));
+}
+
+void PluginMainWindow::displayCached(const SessionCache::Report& report)
+{
+    // Parsed, indexed and rendered already, only the widgets are left
+    showAnnotations(report.index ? report.index->clone() : nullptr);
+    {
+        PerfTrace::Scope scope("layout");
+        ui->editReport->setHtml(report.html);
+    }
+
+    PerfTrace::Scope scope("query");
+    ui->traceWidget->setTrace(report.query);
+}
+
+void PluginMainWindow::prefetchModule(uintptr_t base)
+{
+    // System modules are rarely analyzed
+    if(mPrefetcher == nullptr || DbgFunctions()->ModGetParty(base) == mod_system)
+        return;
+
+    auto path = getModulePath(base);
+    uintptr_t headerBase = 0;
+    uintptr_t imageSize = 0;
+    if(path.isEmpty() || !getHeaderInfo(base, headerBase, imageSize))
+        return;
+
+    // Shown before with the same base, nothing to prepare
+    auto jsonPath = mSession->reportPath(path);
+    if(!jsonPath.isEmpty() && mSession->contains(jsonPath, base))
+    {
+        mReportPaths[path] = jsonPath;
+        markAnalyzed(path);
+        return;
+    }
+    mPrefetcher->prefetch(path, base, headerBase, imageSize);
+}
+
+void PluginMainWindow::markAnalyzed(const QString& modulePath)
+{
+    for(int i = 0; i < ui->comboModules->count(); i++)
+    {
+        duint base = ui->comboModules->itemData(i).toULongLong();
+        if(getModulePath(base) == modulePath)
+            ui->comboModules->setItemText(i, getModuleLabel(base, true));
     }
-    ui->editReport->setHtml(html);
+}
+
+void PluginMainWindow::reportPreparedSlot(qulonglong base, const QString& modulePath, const QString& jsonPath, bool cached)
+{
+    // Selecting the module does not hash it anymore
+    if(!jsonPath.isEmpty())
+        setReportJsonPath(modulePath, jsonPath);
+    if(!cached)
+    {
+        mPrefetcher->cancel(base);
+        return;
+    }
+    markAnalyzed(modulePath);
+}
+
+void PluginMainWindow::showAnnotations(std::unique_ptr<const ReportIndex> index)
+{
+    if(!index && !ReportIndex::Reader())
+        return;
+
+    if(index)
+        logInfo(QString("[annotations] %1 addresses").arg(index->size()));
+    ReportIndex::publish(std::move(index));
+    GuiUpdateDisassemblyView();
+    GuiUpdateDumpView();
 }
 
 QString PluginMainWindow::getReportJsonPath(uintptr_t base)
@@ -446,30 +771,71 @@ QString PluginMainWindow::getReportJsonPath(uintptr_t base)
     if(modulePath.isEmpty())
         return QString();
 
-    auto itr = mReportCache.find(modulePath);
-    if(itr != mReportCache.end())
+    auto itr = mReportPaths.find(modulePath);
+    if(itr != mReportPaths.end())
         return itr.value();
 
-    QFile f(modulePath);
-    if(!f.open(QIODevice::ReadOnly))
-        return QString();
+    // Hashed in an earlier debug session
+    auto jsonPath = mSession->reportPath(modulePath);
+    if(!jsonPath.isEmpty())
+    {
+        mReportPaths[modulePath] = jsonPath;
+        return jsonPath;
+    }
 
-    QCryptographicHash hash(QCryptographicHash::Sha1);
-    if(!hash.addData(&f))
+    // Hashing can take a while, or wait for another instance that hashes the same file
+    auto sha256 = mCache->knownFileHash(modulePath);
+    if(sha256.isEmpty())
+    {
+        mCache->fileHashAsync(modulePath);
         return QString();
+    }
 
-    auto sha1 = QString::fromUtf8(hash.result().toHex());
-    auto moduleName = QFileInfo(modulePath).baseName();
-    auto jsonPath = QString("%1\\report-%2-%3.json").arg(mUserDir, moduleName, sha1);
-    mReportCache[modulePath] = jsonPath;
+    jsonPath = mCache->jsonPath(sha256);
+    setReportJsonPath(modulePath, jsonPath);
     return jsonPath;
 }
 
+void PluginMainWindow::setReportJsonPath(const QString& modulePath, const QString& jsonPath)
+{
+    mReportPaths[modulePath] = jsonPath;
+    mSession->setReportPath(modulePath, jsonPath);
+}
+
+void PluginMainWindow::openReport(const QString& jsonPath)
+{
+    // Select the module if the report belongs to one that is loaded
+    auto nativePath = ReportCache::nativePath(jsonPath);
+    for(int i = 0; i < ui->comboModules->count(); i++)
+    {
+        auto modulePath = getModulePath(ui->comboModules->itemData(i).toULongLong());
+        auto itr = mReportPaths.find(modulePath);
+        if(itr != mReportPaths.end() && ReportCache::nativePath(itr.value()) == nativePath)
+        {
+            ui->comboModules->setCurrentIndex(i);
+            ui->tabWidget->setCurrentWidget(ui->tabReport);
+            return;
+        }
+    }
+
+    mCache->touch(jsonPath);
+    auto data = ReportCache::readReport(jsonPath);
+    if(data.isEmpty())
+    {
+        QMessageBox::critical(this, "Error", QString("Failed to open %1").arg(jsonPath));
+        return;
+    }
+
+    // Not associated with a loaded module, like the example report
+    ui->tabWidget->setCurrentWidget(ui->tabReport);
+    displayReport(std::move(data), QString(), 0);
+}
+
 void PluginMainWindow::on_buttonUpload_clicked()
 {
-    if(mApiKey.isEmpty())
+    if(mClient->apiKey().isEmpty())
     {
-        mLoginDialog->startLogin(true);
+        loginDialog()->startLogin(true);
         return;
     }
 
@@ -494,7 +860,88 @@ void PluginMainWindow::on_buttonUpload_clicked()
     }
 
     enableUi(false);
-    uploadFile(base, path);
+
+    // The report is downloaded straight into the cache, which is keyed by the file hash
+    auto jsonPath = getReportJsonPath(base);
+    if(jsonPath.isEmpty())
+    {
+        mHashModule = base;
+        setStatus("Hashing module...");
+        ui->progressBar->setMaximum(0);
+        ui->progressBar->setValue(0);
+        return;
+    }
+    startUpload(base, path, jsonPath);
+}
+
+void PluginMainWindow::startUpload(uintptr_t base, const QString& path, const QString& jsonPath)
+{
+    // Fail fast while Malcore is unreachable
+    if(mClient->breaker()->isOpen())
+    {
+        queueOffline(path);
+        return;
+    }
+
+    // Only one debugger instance uploads a file, the others wait for its report
+    mUploadLock = mCache->lockUpload(jsonPath);
+    if(!mUploadLock)
+    {
+        setStatus("Another debugger is analyzing this file...");
+        ui->progressBar->setMaximum(0);
+        ui->progressBar->setValue(0);
+        waitForUpload(base, path, jsonPath);
+        return;
+    }
+    uploadFile(base, path, jsonPath);
+}
+
+void PluginMainWindow::queueOffline(const QString& path)
+{
+    // The engine uploads it when the circuit breaker closes, jobFinishedSlot() shows the report
+    logInfo("[upload] Malcore is unreachable, queued: " + path);
+    mEngine->submit(path, RateLimiter::Interactive);
+    setStatus("Malcore is unreachable, the upload is queued and starts when it is back");
+    enableUi(true);
+    ui->progressBar->setMaximum(100);
+    ui->progressBar->setValue(0);
+}
+
+void PluginMainWindow::waitForUpload(uintptr_t base, const QString& path, const QString& jsonPath)
+{
+    QTimer::singleShot(1000, this, [this, base, path, jsonPath]()
+    {
+        // StopDebug resets the UI
+        if(!mIsDebugging)
+            return;
+
+        if(!mCache->touch(jsonPath))
+        {
+            mUploadLock = mCache->lockUpload(jsonPath);
+            if(!mUploadLock)
+            {
+                waitForUpload(base, path, jsonPath);
+                return;
+            }
+
+            // The other instance gave up, upload it ourselves
+            if(!mCache->touch(jsonPath))
+            {
+                uploadFile(base, path, jsonPath);
+                return;
+            }
+            mUploadLock.reset();
+        }
+
+        logInfo("[upload] report stored by another instance: " + jsonPath);
+        mSearchIndex->updateAsync(jsonPath);
+        mSimilarityIndex->updateAsync(jsonPath);
+        enableUi(true);
+        setStatus("Ready!");
+        ui->progressBar->setMaximum(100);
+        ui->progressBar->setValue(0);
+        on_comboModules_currentIndexChanged(ui->comboModules->currentIndex());
+    });
 }
 
 void PluginMainWindow::on_actionExampleReport_triggered()
@@ -509,34 +956,147 @@ void PluginMainWindow::on_actionExampleReport_triggered()
 
 void PluginMainWindow::on_buttonOptions_clicked()
 {
+    initialize();
     ui->editReport->setFocus();
+    // Hold Shift to show the performance panel
+    ui->actionPerformance->setVisible(QApplication::keyboardModifiers() & Qt::ShiftModifier);
     ui->menuOptions->exec(QCursor::pos());
 }
 
 void PluginMainWindow::on_actionLogin_triggered()
 {
-    mLoginDialog->startLogin(false);
+    loginDialog()->startLogin(false);
+}
+
+void PluginMainWindow::on_actionSearch_triggered()
+{
+    if(mSearchDialog == nullptr)
+    {
+        mSearchDialog = new SearchDialog(mSearchIndex, this);
+        connect(mSearchDialog, &SearchDialog::reportActivated, this, &PluginMainWindow::openReport);
+    }
+    mSearchDialog->show();
+    mSearchDialog->raise();
+    mSearchDialog->activateWindow();
+}
+
+void PluginMainWindow::on_actionRefreshReport_triggered()
+{
+    auto index = ui->comboModules->currentIndex();
+    if(index == -1)
+        return;
+
+    auto jsonPath = getReportJsonPath(ui->comboModules->itemData(index).toULongLong());
+    if(jsonPath.isEmpty() || !mCache->touch(jsonPath))
+    {
+        QMessageBox::information(this, "Refresh report", "There is no report for this module yet, upload it first.");
+        return;
+    }
+    if(!mRefresher->refresh(jsonPath))
+    {
+        QMessageBox::information(this, "Refresh report", "This report was cached by an older version of the plugin, upload the module again to update it.");
+        return;
+    }
+    setStatus("Refreshing report...");
+}
+
+void PluginMainWindow::reportRefreshedSlot(const QString& jsonPath, bool changed)
+{
+    logInfo(QString("[refresh] %1: %2").arg(jsonPath, changed ? "updated" : "not modified"));
+    auto index = ui->comboModules->currentIndex();
+    auto isCurrent = index != -1 && ReportCache::nativePath(getReportJsonPath(ui->comboModules->itemData(index).toULongLong())) == ReportCache::nativePath(jsonPath);
+    if(isCurrent && ui->buttonUpload->isEnabled())
+        setStatus(changed ? "Report updated" : "Report is up to date");
+    if(!changed)
+        return;
+
+    auto data = ReportCache::readReport(jsonPath);
+    mSearchIndex->update(jsonPath, data);
+    mSimilarityIndex->update(jsonPath, data);
+    mSession->remove(jsonPath);
+    if(isCurrent)
+        displayReport(std::move(data), jsonPath, ui->comboModules->itemData(index).toULongLong());
+
+    // Reports prepared from the old version are prepared again
+    auto nativePath = ReportCache::nativePath(jsonPath);
+    for(int i = 0; i < ui->comboModules->count(); i++)
+    {
+        duint base = ui->comboModules->itemData(i).toULongLong();
+        auto itr = mReportPaths.find(getModulePath(base));
+        if(i != index && itr != mReportPaths.end() && ReportCache::nativePath(itr.value()) == nativePath)
+            prefetchModule(base);
+    }
+}
+
+void PluginMainWindow::on_actionPerformance_triggered()
+{
+    if(mPerformanceDialog == nullptr)
+    {
+        mPerformanceDialog = new PerformanceDialog(mUserDir, this);
+        if(mWatchdog != nullptr)
+            mPerformanceDialog->setStallLog(mWatchdog->logPath());
+    }
+    mPerformanceDialog->show();
+    mPerformanceDialog->raise();
 }
 
 void PluginMainWindow::on_comboModules_currentIndexChanged(int index)
 {
     // Clear the current report
     ui->editReport->clear();
-
-    if(index < 0 || index >= ui->comboModules->count())
+    ui->traceWidget->setTrace(nullptr);
+    showAnnotations(nullptr);
+
+    duint base = 0;
+    if(index >= 0 && index < ui->comboModules->count())
+        base = ui->comboModules->itemData(index).toULongLong();
+
+    // Prepare the report that was shown for when the module is selected again
+    if(mDisplayedModule != 0 && mDisplayedModule != base)
+        prefetchModule(mDisplayedModule);
+    mDisplayedModule = 0;
+    if(base == 0)
         return;
 
-    duint base = ui->comboModules->itemData(index).toULongLong();
+    auto modulePath = getModulePath(base);
+    std::unique_ptr<ReportPrefetcher::Report> prepared;
+    if(mPrefetcher != nullptr)
+        prepared = mPrefetcher->take(base, modulePath);
+    if(prepared && !prepared->jsonPath.isEmpty())
+        setReportJsonPath(modulePath, prepared->jsonPath);
+
     auto jsonPath = getReportJsonPath(base);
-    if(jsonPath.isEmpty())
+    if(jsonPath.isEmpty() || !mCache->touch(jsonPath, modulePath))
         return;
+    mDisplayedModule = base;
 
-    QFile f(jsonPath);
-    if(!f.open(QIODevice::ReadOnly))
+    // Shown before, also in an earlier debug session
+    auto cached = mSession->find(jsonPath, base);
+    if(cached != nullptr)
+    {
+        displayCached(*cached);
         return;
+    }
 
-    auto root = QJsonDocument::fromJson(f.readAll()).object();
-    displayReport(std::move(root["data"].toObject()), jsonPath, base);
+    if(prepared && prepared->cached && prepared->jsonPath == jsonPath)
+    {
+        SessionCache::Report report;
+        report.query = std::move(prepared->query);
+        report.index = std::move(prepared->index);
+        report.html = prepared->html;
+        mSession->insert(jsonPath, base, report);
+        displayCached(report);
+        return;
+    }
+
+    QJsonObject data;
+    {
+        PerfTrace::Scope scope("parse");
+        data = ReportCache::readReport(jsonPath);
+    }
+    if(data.isEmpty())
+        return;
+    displayReport(std::move(data), jsonPath, base);
 }
 
 void PluginMainWindow::on_editReport_anchorClicked(const QUrl& url)
@@ -564,6 +1124,10 @@ void PluginMainWindow::on_editReport_anchorClicked(const QUrl& url)
             GuiAddStatusBarMessage(tr("The value has been copied to the clipboard.\n").toUtf8().constData());
         }
     }
+    else if(url.scheme() == "report")
+    {
+        openReport(url.path());
+    }
     else
     {
         QDesktopServices::openUrl(url);
@@ -1,13 +1,27 @@
 #pragma once
 
 #include <QMainWindow>
-#include <QNetworkAccessManager>
 #include <QTimer>
 #include <QAbstractListModel>
 #include <QFile>
 
+#include <memory>
+
 #include "LoginDialog.h"
+#include "PerformanceDialog.h"
+#include "SearchDialog.h"
 #include "QtPlugin.h"
+#include "ReportIndex.h"
+#include "AnalysisEngine.h"
+#include "MalcoreClient.h"
+#include "StallWatchdog.h"
+#include "TraceStore.h"
+#include "SimilarityIndex.h"
+#include "JobJournal.h"
+#include "ReportRefresher.h"
+#include "ReportPrefetcher.h"
+#include "AutoAnalysisPolicy.h"
+#include "SessionCache.h"
 
 namespace Ui {
 class PluginMainWindow;
@@ -26,33 +40,72 @@ protected:
     bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
+    void initialize();
+    // A background load of initialize() finished (StartupStep)
+    void startupStepFinished(int step);
+    LoginDialog* loginDialog();
     void enableUi(bool enabled);
     void logInfo(const QString& message);
     void setStatus(const QString& status);
-    void uploadFile(uintptr_t moduleBase, const QString& path);
+    void startUpload(uintptr_t base, const QString& path, const QString& jsonPath);
+    void uploadFile(uintptr_t moduleBase, const QString& path, const QString& jsonPath);
+    void waitForUpload(uintptr_t base, const QString& path, const QString& jsonPath);
+    void queueOffline(const QString& path);
     void displayReport(QJsonObject data, const QString& jsonPath, uintptr_t loadedBase);
+    void displayCached(const SessionCache::Report& report);
+    void prefetchModule(uintptr_t base);
+    void markAnalyzed(const QString& modulePath);
+    void showAnnotations(std::unique_ptr<const ReportIndex> index);
+    // Empty while the module is hashed in the background, see fileHashedSlot()
     QString getReportJsonPath(uintptr_t base);
+    void setReportJsonPath(const QString& modulePath, const QString& jsonPath);
+    void openReport(const QString& jsonPath);
 
 private slots:
-    void pollTimerSlot();
+    void jobFinishedSlot(int id, const QString& path, const QString& jsonPath);
+    void fileHashedSlot(const QString& path, const QString& sha256);
     void loginAcceptedSlot();
     void on_buttonUpload_clicked();
     void on_actionExampleReport_triggered();
     void on_buttonOptions_clicked();
     void on_actionLogin_triggered();
+    void on_actionPerformance_triggered();
+    void on_actionSearch_triggered();
+    void on_actionRefreshReport_triggered();
+    void updateStatusLabel();
+    void reportRefreshedSlot(const QString& jsonPath, bool changed);
+    void reportPreparedSlot(qulonglong base, const QString& modulePath, const QString& jsonPath, bool cached);
     void on_comboModules_currentIndexChanged(int index);
     void on_editReport_anchorClicked(const QUrl& url);
 
 private:
     Ui::PluginMainWindow* ui = nullptr;
     QString mUserDir;
-    QNetworkAccessManager* mHttp = nullptr;
-    QString mApiKey;
-    QTimer* mPollTimer = nullptr;
-    QString mPollUuid;
+    QString mStatus; // labelStatus without the rate limiter queue
+    MalcoreClient* mClient = nullptr;
+    AnalysisRequest* mAnalysis = nullptr; // upload started by this window
     uintptr_t mPollModule = 0;
+    uintptr_t mHashModule = 0; // the upload button waits for its hash
+    uintptr_t mDisplayedModule = 0; // its report is shown
+    std::unique_ptr<QLockFile> mUploadLock; // held from the upload until the report is stored
     bool mIsDebugging = false;
+    bool mInitialized = false; // see initialize()
+    qint64 mCreated = 0; // PerfTrace::now() when the constructor started
+    int mStartupPending = 0; // StartupStep flags of the loads that did not finish yet
     QFile* mLogFile = nullptr;
-    LoginDialog* mLoginDialog = nullptr;
-    QMap<QString, QString> mReportCache;
+    bool mLogFailed = false;
+    LoginDialog* mLoginDialog = nullptr; // created on first use, like the other dialogs
+    PerformanceDialog* mPerformanceDialog = nullptr;
+    ReportCache* mCache = nullptr;
+    ReportSearchIndex* mSearchIndex = nullptr;
+    SimilarityIndex* mSimilarityIndex = nullptr;
+    SearchDialog* mSearchDialog = nullptr;
+    QMap<QString, QString> mReportPaths; // module path -> report (this debug session)
+    std::unique_ptr<SessionCache> mSession; // rendered reports, kept across debug sessions
+    AnalysisEngine* mEngine = nullptr;
+    ReportRefresher* mRefresher = nullptr;
+    ReportPrefetcher* mPrefetcher = nullptr; // nullptr if disabled
+    AutoAnalyzer* mAutoAnalyzer = nullptr; // nullptr unless AutoAnalyze is set
+    std::unique_ptr<JobJournal> mJournal;
+    StallWatchdog* mWatchdog = nullptr;
 };
@@ -2,7 +2,10 @@
 #include "LoginDialog.h"
 #include "PluginMainWindow.h"
 #include "pluginmain.h"
+#include "PerfTrace.h"
+#include "AnalysisEngine.h"
 
+#include <atomic>
 #include <functional>
 
 #include <QFile>
@@ -11,6 +14,9 @@
 static PluginMainWindow* pluginTabWidget;
 static HANDLE hSetupEvent;
 static HANDLE hStopEvent;
+// Read by the command thread, see AcquireEngine
+static std::atomic<AnalysisEngine*> analysisEngine;
+static std::atomic<int> engineUsers;
 
 static QByteArray getResourceBytes(const char* path)
 {
@@ -34,10 +40,13 @@ void QtPlugin::Init()
 
 void QtPlugin::Setup()
 {
+    // x64dbg waits for this, logged by PluginMainWindow::initialize
+    auto start = PerfTrace::now();
     QWidget* parent = getParent();
 
     pluginTabWidget = new PluginMainWindow(parent);
     GuiAddQWidgetTab(pluginTabWidget);
+    PerfTrace::record("startup", start, PerfTrace::now() - start);
     SetEvent(hSetupEvent);
 }
 
@@ -48,9 +57,17 @@ void QtPlugin::WaitForSetup()
 
 void QtPlugin::Stop()
 {
+    // A malcore command might still use the engine (malcore wait blocks), wake it and let it finish
+    auto engine = analysisEngine.exchange(nullptr);
+    if(engine != nullptr)
+        engine->cancelWaiters();
+    while(engineUsers > 0)
+        Sleep(1);
+
     GuiCloseQWidgetTab(pluginTabWidget);
     pluginTabWidget->close();
     delete pluginTabWidget;
+    pluginTabWidget = nullptr;
 
     SetEvent(hStopEvent);
 }
@@ -78,3 +95,23 @@ void QtPlugin::Event(EventType event, const QVariant& data)
         delete fn;
     }, fn);
 }
+
+void QtPlugin::SetEngine(AnalysisEngine* engine)
+{
+    analysisEngine = engine;
+}
+
+AnalysisEngine* QtPlugin::AcquireEngine()
+{
+    // Counted before the load, so Stop() either sees the user or this sees nullptr
+    engineUsers++;
+    auto engine = analysisEngine.load();
+    if(engine == nullptr)
+        engineUsers--;
+    return engine;
+}
+
+void QtPlugin::ReleaseEngine()
+{
+    engineUsers--;
+}
@@ -4,6 +4,8 @@
 
 #include <cstdint>
 
+class AnalysisEngine;
+
 namespace QtPlugin
 {
 enum EventType
@@ -20,4 +22,10 @@ void Stop();
 void WaitForStop();
 void ShowTab();
 void Event(EventType event, const QVariant& data);
+// Called once the engine is connected, Stop() unpublishes it before deleting it
+void SetEngine(AnalysisEngine* engine);
+// Any thread: nullptr before SetEngine() and after Stop(), otherwise the engine stays alive
+// until the matching ReleaseEngine()
+AnalysisEngine* AcquireEngine();
+void ReleaseEngine();
 } //QtPlugin
@@ -0,0 +1,62 @@
+#include "SearchDialog.h"
+#include "ui_SearchDialog.h"
+#include <QElapsedTimer>
+
+SearchDialog::SearchDialog(ReportSearchIndex* index, QWidget* parent) : QDialog(parent), ui(new Ui::SearchDialog), mIndex(index)
+{
+    ui->setupUi(this);
+    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
+    connect(mIndex, &ReportSearchIndex::rescanFinished, this, [this]()
+    {
+        on_editQuery_textChanged(ui->editQuery->text());
+    });
+}
+
+SearchDialog::~SearchDialog()
+{
+    delete ui;
+}
+
+void SearchDialog::showEvent(QShowEvent* event)
+{
+    ui->editQuery->setFocus();
+    ui->editQuery->selectAll();
+    on_editQuery_textChanged(ui->editQuery->text());
+    QDialog::showEvent(event);
+}
+
+void SearchDialog::on_editQuery_textChanged(const QString& text)
+{
+    QElapsedTimer timer;
+    timer.start();
+    auto hits = mIndex->search(text);
+    auto elapsed = timer.nsecsElapsed() / 1000000.0;
+
+    ui->tableResults->setRowCount(hits.size());
+    for(int i = 0; i < hits.size(); i++)
+    {
+        const auto& hit = hits[i];
+        auto module = new QTableWidgetItem(hit.module);
+        module->setData(Qt::UserRole, hit.jsonPath);
+        module->setToolTip(hit.jsonPath);
+        auto term = new QTableWidgetItem(hit.term);
+        if(hit.exact)
+        {
+            auto font = term->font();
+            font.setBold(true);
+            term->setFont(font);
+        }
+        ui->tableResults->setItem(i, 0, module);
+        ui->tableResults->setItem(i, 1, term);
+        ui->tableResults->setItem(i, 2, new QTableWidgetItem(ReportSearchIndex::fieldNames(hit.fields)));
+    }
+
+    ui->labelStatus->setText(QString("%1 matches in %2 reports (%3 ms)").arg(hits.size()).arg(mIndex->documentCount()).arg(elapsed, 0, 'f', 1));
+}
+
+void SearchDialog::on_tableResults_activated(const QModelIndex& index)
+{
+    auto item = ui->tableResults->item(index.row(), 0);
+    if(item != nullptr)
+        emit reportActivated(item->data(Qt::UserRole).toString());
+}
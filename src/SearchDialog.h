@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QDialog>
+
+#include "ReportSearchIndex.h"
+
+namespace Ui
+{
+class SearchDialog;
+}
+
+// Search box over the IOCs, signatures, hashes and YARA rules of all cached reports
+class SearchDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    SearchDialog(ReportSearchIndex* index, QWidget* parent);
+    ~SearchDialog();
+
+signals:
+    void reportActivated(const QString& jsonPath);
+
+protected:
+    void showEvent(QShowEvent* event) override;
+
+private slots:
+    void on_editQuery_textChanged(const QString& text);
+    void on_tableResults_activated(const QModelIndex& index);
+
+private:
+    Ui::SearchDialog* ui;
+    ReportSearchIndex* mIndex = nullptr;
+};
@@ -0,0 +1,321 @@
+#include "TraceWidget.h"
+
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QColor>
+
+#include <algorithm>
+
+enum GroupColumn
+{
+    GroupColumnDll,
+    GroupColumnFunction,
+    GroupColumnCalls,
+    GroupColumnSuspicious,
+    GroupColumnCount
+};
+
+TraceModel::TraceModel(QObject* parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+void TraceModel::setTrace(std::shared_ptr<const TraceQuery> query)
+{
+    mQuery = std::move(query);
+    refresh();
+}
+
+void TraceModel::setFilter(const TraceQuery::Filter& filter)
+{
+    mFilter = filter;
+    refresh();
+}
+
+void TraceModel::setGrouped(bool grouped)
+{
+    if(mGrouped == grouped)
+        return;
+
+    // Groups are shown with the most called API first
+    beginResetModel();
+    mGrouped = grouped;
+    mSortColumn = grouped ? GroupColumnCalls : TraceQuery::ColumnRow;
+    mSortOrder = grouped ? Qt::DescendingOrder : Qt::AscendingOrder;
+    mRows.clear();
+    mGroups.clear();
+    endResetModel();
+    refresh();
+}
+
+uint64_t TraceModel::address(const QModelIndex& index) const
+{
+    if(mGrouped || !index.isValid() || index.row() >= mRows.size())
+        return TraceStore::InvalidAddress;
+    return mQuery->trace().address(mRows[index.row()]);
+}
+
+QString TraceModel::groupQuery(const QModelIndex& index) const
+{
+    if(!mGrouped || !index.isValid() || index.row() >= mGroups.size())
+        return QString();
+    const auto& group = mGroups[index.row()];
+    const auto& trace = mQuery->trace();
+    return QString("dll:=%1 fn:=%2").arg(trace.name(group.dllId), trace.name(group.functionId));
+}
+
+int TraceModel::rowCount(const QModelIndex& parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return mGrouped ? mGroups.size() : mRows.size();
+}
+
+int TraceModel::columnCount(const QModelIndex& parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return mGrouped ? GroupColumnCount : TraceQuery::ColumnCount;
+}
+
+QVariant TraceModel::data(const QModelIndex& index, int role) const
+{
+    if(!index.isValid() || !mQuery)
+        return QVariant();
+    const auto& trace = mQuery->trace();
+
+    if(mGrouped)
+    {
+        const auto& group = mGroups[index.row()];
+        if(role == Qt::DisplayRole)
+        {
+            switch(index.column())
+            {
+            case GroupColumnDll:
+                return trace.name(group.dllId);
+            case GroupColumnFunction:
+                return trace.name(group.functionId);
+            case GroupColumnCalls:
+                return group.calls;
+            case GroupColumnSuspicious:
+                return group.suspicious;
+            }
+        }
+        else if(role == Qt::TextAlignmentRole && index.column() >= GroupColumnCalls)
+        {
+            return int(Qt::AlignRight | Qt::AlignVCenter);
+        }
+        else if(role == Qt::ForegroundRole && index.column() == GroupColumnFunction && group.suspicious > 0)
+        {
+            return QColor(255, 165, 0); // orange, like the report
+        }
+        return QVariant();
+    }
+
+    auto row = mRows[index.row()];
+    if(role == Qt::DisplayRole)
+    {
+        switch(index.column())
+        {
+        case TraceQuery::ColumnRow:
+            return row + 1;
+        case TraceQuery::ColumnAddress:
+        {
+            auto address = trace.address(row);
+            if(address == TraceStore::InvalidAddress)
+                return "?";
+            return QString("%1").arg(qulonglong(address), int(sizeof(void*) * 2), 16, QChar('0')).toUpper();
+        }
+        case TraceQuery::ColumnDll:
+            return trace.dll(row);
+        case TraceQuery::ColumnFunction:
+            return trace.function(row);
+        case TraceQuery::ColumnArguments:
+        {
+            QStringList arguments;
+            for(int i = 0; i < trace.argumentCount(row); i++)
+                arguments.append(trace.argument(row, i));
+            return arguments.join(", ");
+        }
+        case TraceQuery::ColumnReturn:
+            return trace.returnValue(row);
+        }
+    }
+    else if(role == Qt::TextAlignmentRole && index.column() == TraceQuery::ColumnRow)
+    {
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+    else if(role == Qt::ForegroundRole && index.column() == TraceQuery::ColumnFunction && trace.suspicious(row))
+    {
+        return QColor(255, 165, 0);
+    }
+    return QVariant();
+}
+
+QVariant TraceModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    if(mGrouped)
+    {
+        static const char* groupHeaders[GroupColumnCount] = { "Module", "Function", "Calls", "Suspicious" };
+        return section < GroupColumnCount ? groupHeaders[section] : QVariant();
+    }
+    static const char* headers[TraceQuery::ColumnCount] = { "#", "Address", "Module", "Function", "Arguments", "Return" };
+    return section < TraceQuery::ColumnCount ? headers[section] : QVariant();
+}
+
+void TraceModel::sort(int column, Qt::SortOrder order)
+{
+    mSortColumn = column;
+    mSortOrder = order;
+    if(mGrouped)
+    {
+        beginResetModel();
+        sortGroups();
+        endResetModel();
+    }
+    else
+    {
+        refresh();
+    }
+}
+
+void TraceModel::refresh()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    beginResetModel();
+    mRows.clear();
+    mGroups.clear();
+    if(mQuery)
+    {
+        if(mGrouped)
+        {
+            mRows = mQuery->rows(mFilter, TraceQuery::ColumnRow, false);
+            mGroups = mQuery->groups(mRows);
+            sortGroups();
+        }
+        else
+        {
+            mRows = mQuery->rows(mFilter, TraceQuery::Column(mSortColumn), mSortOrder == Qt::DescendingOrder);
+        }
+    }
+    endResetModel();
+
+    mLastQueryUs = timer.nsecsElapsed() / 1000;
+}
+
+void TraceModel::sortGroups()
+{
+    const auto& trace = mQuery->trace();
+    auto column = mSortColumn;
+    std::stable_sort(mGroups.begin(), mGroups.end(), [&trace, column](const TraceQuery::Group& a, const TraceQuery::Group& b)
+    {
+        switch(column)
+        {
+        case GroupColumnDll:
+            return trace.name(a.dllId).compare(trace.name(b.dllId), Qt::CaseInsensitive) < 0;
+        case GroupColumnFunction:
+            return trace.name(a.functionId).compare(trace.name(b.functionId), Qt::CaseInsensitive) < 0;
+        case GroupColumnSuspicious:
+            return a.suspicious < b.suspicious;
+        default:
+            return a.calls < b.calls;
+        }
+    });
+    if(mSortOrder == Qt::DescendingOrder)
+        std::reverse(mGroups.begin(), mGroups.end());
+}
+
+TraceWidget::TraceWidget(QWidget* parent)
+    : QWidget(parent)
+{
+    mQuery = new QLineEdit(this);
+    mQuery->setPlaceholderText("dll:kernel32 fn:=VirtualAlloc sus 140001000-140002000");
+    mQuery->setClearButtonEnabled(true);
+    mGroup = new QCheckBox("&Group by API", this);
+    mSummary = new QLabel(this);
+
+    mModel = new TraceModel(this);
+    mView = new QTableView(this);
+    mView->setModel(mModel);
+    mView->setSortingEnabled(true);
+    mView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    mView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    mView->setWordWrap(false);
+    mView->verticalHeader()->setVisible(false);
+    // Fixed row heights keep the view from measuring every row
+    mView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    mView->verticalHeader()->setDefaultSectionSize(mView->fontMetrics().height() + 4);
+    mView->horizontalHeader()->setStretchLastSection(true);
+    mView->horizontalHeader()->setSortIndicator(TraceQuery::ColumnRow, Qt::AscendingOrder);
+
+    auto top = new QHBoxLayout();
+    top->addWidget(mQuery, 1);
+    top->addWidget(mGroup);
+    top->addWidget(mSummary);
+    auto layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(2);
+    layout->addLayout(top);
+    layout->addWidget(mView);
+
+    // The indexes are built with the query, every keystroke is a single pass
+    connect(mQuery, &QLineEdit::textChanged, this, &TraceWidget::queryChanged);
+    connect(mGroup, &QCheckBox::toggled, this, [this](bool checked)
+    {
+        mModel->setGrouped(checked);
+        mView->horizontalHeader()->setSortIndicator(checked ? GroupColumnCalls : TraceQuery::ColumnRow, checked ? Qt::DescendingOrder : Qt::AscendingOrder);
+        updateSummary();
+    });
+    connect(mView, &QTableView::activated, this, &TraceWidget::activated);
+    updateSummary();
+}
+
+void TraceWidget::setTrace(std::shared_ptr<const TraceQuery> query)
+{
+    mModel->setTrace(std::move(query));
+    updateSummary();
+}
+
+void TraceWidget::queryChanged()
+{
+    mModel->setFilter(TraceQuery::Filter::parse(mQuery->text()));
+    updateSummary();
+}
+
+void TraceWidget::updateSummary()
+{
+    if(mModel->totalRows() == 0)
+    {
+        mSummary->setText("No trace");
+        return;
+    }
+    auto timing = QString::number(mModel->lastQueryUs() / 1000.0, 'f', 1);
+    if(mModel->grouped())
+        mSummary->setText(QString("%1 APIs in %2 of %3 calls (%4 ms)").arg(mModel->rowCount()).arg(mModel->matchedRows()).arg(mModel->totalRows()).arg(timing));
+    else
+        mSummary->setText(QString("%1 of %2 calls (%3 ms)").arg(mModel->matchedRows()).arg(mModel->totalRows()).arg(timing));
+}
+
+void TraceWidget::activated(const QModelIndex& index)
+{
+    if(mModel->grouped())
+    {
+        // Drill down into the calls of the API
+        auto query = mModel->groupQuery(index);
+        mGroup->setChecked(false);
+        mQuery->setText(query);
+        return;
+    }
+
+    auto address = mModel->address(index);
+    if(address != TraceStore::InvalidAddress)
+        emit addressActivated(address);
+}
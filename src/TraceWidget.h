@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QWidget>
+#include <QAbstractTableModel>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QLabel>
+#include <QTableView>
+
+#include <memory>
+
+#include "TraceQuery.h"
+
+// Table model over the result rows of a TraceQuery. Only the visible rows are ever asked for,
+// so the view stays responsive for traces with millions of calls.
+class TraceModel : public QAbstractTableModel
+{
+public:
+    explicit TraceModel(QObject* parent = nullptr);
+
+    // The query is shared with the session cache, it is built with the trace
+    void setTrace(std::shared_ptr<const TraceQuery> query);
+    void setFilter(const TraceQuery::Filter& filter);
+    void setGrouped(bool grouped);
+    bool grouped() const { return mGrouped; }
+    int totalRows() const { return mQuery ? mQuery->trace().size() : 0; }
+    int matchedRows() const { return mRows.size(); }
+    qint64 lastQueryUs() const { return mLastQueryUs; }
+
+    // Rebased address of a row, TraceStore::InvalidAddress for groups
+    uint64_t address(const QModelIndex& index) const;
+    // Query bar text that selects the group at index
+    QString groupQuery(const QModelIndex& index) const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+private:
+    void refresh();
+    void sortGroups();
+
+    std::shared_ptr<const TraceQuery> mQuery;
+    TraceQuery::Filter mFilter;
+    bool mGrouped = false;
+    int mSortColumn = 0;
+    Qt::SortOrder mSortOrder = Qt::AscendingOrder;
+    QVector<int> mRows;
+    QVector<TraceQuery::Group> mGroups;
+    qint64 mLastQueryUs = 0;
+};
+
+// Query bar and virtualized table over the dynamic analysis trace
+class TraceWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit TraceWidget(QWidget* parent = nullptr);
+
+    void setTrace(std::shared_ptr<const TraceQuery> query);
+
+signals:
+    void addressActivated(quint64 address);
+
+private:
+    void queryChanged();
+    void updateSummary();
+    void activated(const QModelIndex& index);
+
+    QLineEdit* mQuery = nullptr;
+    QCheckBox* mGroup = nullptr;
+    QLabel* mSummary = nullptr;
+    QTableView* mView = nullptr;
+    TraceModel* mModel = nullptr;
+};
@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Upload to report latency benchmark
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = malcore-bench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include(../core/core.pri)
+
+INCLUDEPATH += ../standin
+
+SOURCES += \
+    main.cpp \
+    ../standin/StandinServer.cpp
+
+HEADERS += \
+    ../standin/StandinServer.h
+
+RESOURCES += \
+    ../standin/standin.qrc
@@ -0,0 +1,287 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QTimer>
+#include <QFile>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "MalcoreClient.h"
+#include "StandinServer.h"
+
+// Requests that fail with a transient error (429, 5xx, dropped connection) are retried this many times
+static const int MaxAttempts = 5;
+
+struct Sample
+{
+    QString path;
+    QString uuid;
+    QElapsedTimer timer;
+    qint64 latency = -1;
+    int uploads = 0;
+    int polls = 0;
+    int attempts = 0;
+    QString error;
+};
+
+class Benchmark : public QObject
+{
+public:
+    Benchmark(MalcoreClient* client, std::vector<Sample>& samples, int concurrency, int pollInterval)
+        : mClient(client), mSamples(samples), mConcurrency(concurrency), mPollInterval(pollInterval)
+    {
+    }
+
+    void start()
+    {
+        for(int i = 0; i < mConcurrency; i++)
+            next();
+    }
+
+private:
+    void next()
+    {
+        if(mNext == int(mSamples.size()))
+        {
+            if(mActive == 0)
+                QCoreApplication::quit();
+            return;
+        }
+        auto index = mNext++;
+        mActive++;
+        mSamples[index].timer.start();
+        upload(index);
+    }
+
+    void done(int index, const QString& error = QString())
+    {
+        auto& sample = mSamples[index];
+        if(error.isEmpty())
+            sample.latency = sample.timer.elapsed();
+        else
+            sample.error = error;
+        mActive--;
+        next();
+    }
+
+    // Returns the retry delay in ms for transient failures, -1 otherwise
+    int retryDelay(QNetworkReply* reply, Sample& sample)
+    {
+        auto status = MalcoreClient::httpStatus(reply);
+        bool transient = status == 429 || status >= 500 || (status == 0 && reply->error() != QNetworkReply::NoError);
+        if(!transient || ++sample.attempts >= MaxAttempts)
+            return -1;
+        auto retryAfter = reply->rawHeader("Retry-After").toInt();
+        return retryAfter > 0 ? retryAfter * 1000 : mPollInterval;
+    }
+
+    void upload(int index)
+    {
+        auto& sample = mSamples[index];
+        sample.uploads++;
+        QString error;
+        auto reply = mClient->upload(sample.path, &error);
+        if(reply == nullptr)
+        {
+            done(index, error);
+            return;
+        }
+        connect(reply, &QNetworkReply::finished, this, [this, reply, index]()
+        {
+            reply->deleteLater();
+            auto& sample = mSamples[index];
+            if(reply->error() == QNetworkReply::NoError)
+            {
+                sample.uuid = MalcoreClient::parseUploadUuid(reply->readAll());
+                if(sample.uuid.isEmpty())
+                    done(index, "No uuid in the upload response");
+                else
+                    QTimer::singleShot(mPollInterval, this, [this, index]() { poll(index); });
+                return;
+            }
+            auto delay = retryDelay(reply, sample);
+            if(delay < 0)
+                done(index, QString("Upload failed: HTTP %1 %2").arg(MalcoreClient::httpStatus(reply)).arg(reply->errorString()));
+            else
+                QTimer::singleShot(delay, this, [this, index]() { upload(index); });
+        });
+    }
+
+    void poll(int index)
+    {
+        auto& sample = mSamples[index];
+        sample.polls++;
+        auto reply = mClient->status(sample.uuid);
+        connect(reply, &QNetworkReply::finished, this, [this, reply, index]()
+        {
+            reply->deleteLater();
+            auto& sample = mSamples[index];
+            if(reply->error() == QNetworkReply::NoError)
+            {
+                auto result = MalcoreClient::parseStatus(reply->readAll());
+                if(!result.success)
+                    done(index, "Status check failed");
+                else if(result.pending)
+                    QTimer::singleShot(mPollInterval, this, [this, index]() { poll(index); });
+                else
+                    done(index);
+                return;
+            }
+            auto delay = retryDelay(reply, sample);
+            if(delay < 0)
+                done(index, QString("Status failed: HTTP %1 %2").arg(MalcoreClient::httpStatus(reply)).arg(reply->errorString()));
+            else
+                QTimer::singleShot(delay, this, [this, index]() { poll(index); });
+        });
+    }
+
+    MalcoreClient* mClient;
+    std::vector<Sample>& mSamples;
+    int mConcurrency;
+    int mPollInterval;
+    int mNext = 0;
+    int mActive = 0;
+};
+
+// Nearest-rank percentile of a sorted list
+static qint64 percentile(const std::vector<qint64>& sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    auto rank = size_t(std::ceil(p * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("malcore-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure upload to report latency against the Malcore API or a local stand-in.");
+    parser.addHelpOption();
+    QCommandLineOption localOption("local", "Run against an in-process stand-in server (configured with the options below).");
+    QCommandLineOption baseUrlOption("base-url", "Malcore API base URL.", "url", MalcoreClient::DefaultBaseUrl);
+    QCommandLineOption apiKeyOption("api-key", "Malcore API key (default: $MALCORE_API_KEY).", "key");
+    QCommandLineOption samplesOption(QStringList() << "n" << "samples", "Number of samples to upload.", "N", "20");
+    QCommandLineOption sizeOption("sample-size", "Size of each generated sample in bytes.", "bytes", "65536");
+    QCommandLineOption concurrencyOption(QStringList() << "c" << "concurrency", "Samples in flight at once.", "N", "4");
+    QCommandLineOption pollOption("poll-interval", "Status poll interval in milliseconds.", "ms", "300");
+    parser.addOption(localOption);
+    parser.addOption(baseUrlOption);
+    parser.addOption(apiKeyOption);
+    parser.addOption(samplesOption);
+    parser.addOption(sizeOption);
+    parser.addOption(concurrencyOption);
+    parser.addOption(pollOption);
+    StandinServer::addOptions(parser);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    MalcoreClient client;
+    client.setBaseUrl(QUrl(parser.value(baseUrlOption)));
+    auto apiKey = parser.value(apiKeyOption);
+    if(apiKey.isEmpty())
+        apiKey = QString::fromLocal8Bit(qgetenv("MALCORE_API_KEY"));
+
+    std::unique_ptr<StandinServer> server;
+    if(parser.isSet(localOption))
+    {
+        StandinServer::Config config;
+        QString error;
+        if(!StandinServer::parseOptions(parser, config, error))
+        {
+            err << error << endl;
+            return 1;
+        }
+        server.reset(new StandinServer(config));
+        if(!server->listen(QHostAddress::LocalHost))
+        {
+            err << "Failed to listen: " << server->errorString() << endl;
+            return 1;
+        }
+        client.setBaseUrl(QUrl(QString("http://127.0.0.1:%1").arg(server->serverPort())));
+        if(apiKey.isEmpty())
+            apiKey = config.apiKey.isEmpty() ? QString("standin") : config.apiKey;
+    }
+    if(apiKey.isEmpty())
+    {
+        err << "No API key, use --api-key or set MALCORE_API_KEY" << endl;
+        return 1;
+    }
+    client.setApiKey(apiKey);
+
+    // Generate unique samples so the server never answers from its own cache
+    QTemporaryDir sampleDir;
+    if(!sampleDir.isValid())
+    {
+        err << "Failed to create a temporary directory" << endl;
+        return 1;
+    }
+    std::mt19937 random(std::random_device{}());
+    std::vector<Sample> samples(qMax(1, parser.value(samplesOption).toInt()));
+    auto sampleSize = qMax(1, parser.value(sizeOption).toInt());
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        QByteArray data(sampleSize, Qt::Uninitialized);
+        for(auto& ch : data)
+            ch = char(random());
+        samples[i].path = sampleDir.filePath(QString("sample-%1.bin").arg(i));
+        QFile f(samples[i].path);
+        if(!f.open(QIODevice::WriteOnly) || f.write(data) != data.size())
+        {
+            err << "Failed to write " << samples[i].path << endl;
+            return 1;
+        }
+    }
+
+    out << "Uploading " << samples.size() << " samples to " << client.baseUrl().toString() << endl;
+    QElapsedTimer total;
+    total.start();
+    Benchmark benchmark(&client, samples, qMax(1, parser.value(concurrencyOption).toInt()), qMax(1, parser.value(pollOption).toInt()));
+    QTimer::singleShot(0, &benchmark, [&benchmark]() { benchmark.start(); });
+    app.exec();
+
+    std::vector<qint64> latencies;
+    int uploads = 0, polls = 0, failed = 0;
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        const auto& sample = samples[i];
+        uploads += sample.uploads;
+        polls += sample.polls;
+        if(sample.latency < 0)
+        {
+            failed++;
+            out << "  [" << i << "] failed after " << sample.uploads << " uploads, " << sample.polls << " polls: " << sample.error << endl;
+            continue;
+        }
+        latencies.push_back(sample.latency);
+        out << "  [" << i << "] " << sample.latency << " ms, " << sample.uploads << " uploads, " << sample.polls << " polls" << endl;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    out << endl << "Latency (ms, " << latencies.size() << " samples):"
+        << " p50=" << percentile(latencies, 0.50)
+        << " p90=" << percentile(latencies, 0.90)
+        << " p95=" << percentile(latencies, 0.95)
+        << " p99=" << percentile(latencies, 0.99)
+        << " max=" << (latencies.empty() ? 0 : latencies.back()) << endl;
+    out << "Requests per sample: uploads=" << QString::number(double(uploads) / samples.size(), 'f', 2)
+        << " polls=" << QString::number(double(polls) / samples.size(), 'f', 2) << endl;
+    out << "Failed: " << failed << ", wall time: " << total.elapsed() << " ms" << endl;
+    if(server)
+    {
+        auto counts = server->requestCounts();
+        for(auto itr = counts.constBegin(); itr != counts.constEnd(); ++itr)
+            out << "  " << itr.key() << ": " << itr.value() << endl;
+    }
+    return failed ? 2 : 0;
+}
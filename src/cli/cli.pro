@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Command line driver for the portable Malcore core
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = malcore-cli
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include(../core/core.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,121 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <cstdio>
+
+#include "AnalysisEngine.h"
+#include "MalcoreClient.h"
+#include "NotificationClient.h"
+#include "ReportCache.h"
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("malcore-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Hash, look up, upload, poll and render Malcore reports for a directory of samples.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("samples", "Directory with the samples to analyze.");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "Number of concurrent uploads/polls.", "N", "4");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Report cache directory.", "dir", "reports");
+    QCommandLineOption baseUrlOption("base-url", "Malcore API base URL.", "url", MalcoreClient::DefaultBaseUrl);
+    QCommandLineOption apiKeyOption("api-key", "Malcore API key (default: $MALCORE_API_KEY).", "key");
+    QCommandLineOption recursiveOption(QStringList() << "r" << "recursive", "Recurse into subdirectories.");
+    QCommandLineOption pollOption("poll-interval", "Status poll interval in milliseconds.", "ms", "300");
+    QCommandLineOption rateOption("rate", "Maximum API requests per minute (0 is unlimited).", "N", "0");
+    QCommandLineOption noPushOption("no-push", "Poll the status instead of waiting for completion notifications.");
+    QCommandLineOption quotaOption("quota-mb", "Evict the least recently used reports past this size (0 is unlimited).", "MB", "0");
+    parser.addOption(jobsOption);
+    parser.addOption(outputOption);
+    parser.addOption(baseUrlOption);
+    parser.addOption(apiKeyOption);
+    parser.addOption(recursiveOption);
+    parser.addOption(pollOption);
+    parser.addOption(noPushOption);
+    parser.addOption(rateOption);
+    parser.addOption(quotaOption);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    auto positional = parser.positionalArguments();
+    if(positional.size() != 1)
+        parser.showHelp(1);
+
+    auto apiKey = parser.value(apiKeyOption);
+    if(apiKey.isEmpty())
+        apiKey = QString::fromLocal8Bit(qgetenv("MALCORE_API_KEY"));
+
+    MalcoreClient client;
+    client.setBaseUrl(QUrl(parser.value(baseUrlOption)));
+    client.setApiKey(apiKey);
+
+    auto outputDir = parser.value(outputOption);
+    if(!QDir(outputDir).mkpath("."))
+    {
+        err << "Failed to create " << outputDir << endl;
+        return 1;
+    }
+
+    ReportCache cache(outputDir);
+    cache.reload();
+    cache.setQuota(parser.value(quotaOption).toLongLong() * 1024 * 1024);
+    AnalysisEngine engine(&client, &cache);
+    engine.setMaxActiveJobs(qMax(1, parser.value(jobsOption).toInt()));
+    client.setPollInterval(qMax(1, parser.value(pollOption).toInt()));
+    client.notifications()->setEnabled(!parser.isSet(noPushOption));
+    client.limiter()->setRate(parser.value(rateOption).toInt(), qMax(1, parser.value(jobsOption).toInt()));
+    engine.setRenderHtml(true);
+
+    QObject::connect(&engine, &AnalysisEngine::jobFinished, [&out](int id, const QString& path, const QString& jsonPath)
+    {
+        out << "[" << id << "] " << path << " -> " << jsonPath << endl;
+    });
+    QObject::connect(&engine, &AnalysisEngine::jobFailed, [&err](int id, const QString& path, const QString& error)
+    {
+        err << "[" << id << "] " << path << ": " << error << endl;
+    });
+
+    auto flags = parser.isSet(recursiveOption) ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags;
+    QDirIterator itr(positional[0], QDir::Files | QDir::NoDotAndDotDot, flags);
+    int submitted = 0;
+    while(itr.hasNext())
+    {
+        engine.submit(itr.next());
+        submitted++;
+    }
+    if(submitted == 0)
+    {
+        err << "No samples in " << positional[0] << endl;
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QObject::connect(&engine, &AnalysisEngine::idle, &app, &QCoreApplication::quit);
+    app.exec();
+
+    // Summary
+    int finished = 0, cached = 0, failed = 0;
+    for(const auto& job : engine.jobs())
+    {
+        if(job.state == AnalysisEngine::Finished)
+        {
+            finished++;
+            if(job.cached || job.duplicateOf != 0)
+                cached++;
+        }
+        else
+        {
+            failed++;
+        }
+    }
+    out << submitted << " sample(s), " << finished << " finished (" << cached << " cached), " << failed << " failed in " << timer.elapsed() << " ms" << endl;
+    return failed == 0 ? 0 : 2;
+}
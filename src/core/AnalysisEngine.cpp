@@ -0,0 +1,479 @@
+#include "AnalysisEngine.h"
+#include "MalcoreReport.h"
+#include "JobJournal.h"
+
+#include <QFile>
+#include <QTimer>
+#include <QRunnable>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+// Poll for the report of another instance that uploads the same file
+static const int UploadWaitInterval = 1000;
+
+class HashTask : public QRunnable
+{
+public:
+    HashTask(AnalysisEngine* engine, ReportCache* cache, int id, const QString& path)
+        : mEngine(engine), mCache(cache), mId(id), mPath(path)
+    {
+    }
+
+    void run() override
+    {
+        auto sha256 = mCache->fileHash(mPath);
+        QMetaObject::invokeMethod(mEngine, "hashFinished", Qt::QueuedConnection, Q_ARG(int, mId), Q_ARG(QString, sha256));
+    }
+
+private:
+    AnalysisEngine* mEngine;
+    ReportCache* mCache;
+    int mId;
+    QString mPath;
+};
+
+class JournalTask : public QRunnable
+{
+public:
+    JournalTask(AnalysisEngine* engine, JobJournal* journal)
+        : mEngine(engine), mJournal(journal)
+    {
+    }
+
+    void run() override
+    {
+        mEngine->replayJournal(mJournal);
+    }
+
+private:
+    AnalysisEngine* mEngine;
+    JobJournal* mJournal;
+};
+
+AnalysisEngine::AnalysisEngine(MalcoreClient* client, ReportCache* cache, QObject* parent)
+    : QObject(parent)
+    , mClient(client)
+    , mCache(cache)
+{
+    mHashPool.setMaxThreadCount(1);
+}
+
+AnalysisEngine::~AnalysisEngine()
+{
+    mHashPool.waitForDone();
+}
+
+const char* AnalysisEngine::stateName(State state)
+{
+    switch(state)
+    {
+    case Queued:
+        return "queued";
+    case Hashing:
+        return "hashing";
+    case Waiting:
+        return "waiting";
+    case Uploading:
+        return "uploading";
+    case Polling:
+        return "polling";
+    case Finished:
+        return "finished";
+    case Failed:
+        return "failed";
+    }
+    return "unknown";
+}
+
+int AnalysisEngine::submit(const QString& path, RateLimiter::Priority priority)
+{
+    int id = 0;
+    {
+        QMutexLocker lock(&mLock);
+        auto itr = mJobByPath.find(path);
+        if(itr != mJobByPath.end() && mJobs[itr.value()].state != Failed)
+        {
+            // Moves a queued job up, an upload in flight keeps its priority
+            auto& job = mJobs[itr.value()];
+            job.priority = qMin(job.priority, priority);
+            return itr.value();
+        }
+
+        id = mNextId++;
+        Job job;
+        job.id = id;
+        job.path = path;
+        job.priority = priority;
+        job.submitted = QDateTime::currentMSecsSinceEpoch();
+        mJobs.insert(id, job);
+        mJobByPath[path] = id;
+        mPending++;
+    }
+    QMetaObject::invokeMethod(this, "startJob", Qt::QueuedConnection, Q_ARG(int, id));
+    return id;
+}
+
+int AnalysisEngine::resume(const QString& path, const QString& sha256, const QString& uuid, qint64 started)
+{
+    int id = 0;
+    {
+        QMutexLocker lock(&mLock);
+        id = mNextId++;
+        Job job;
+        job.id = id;
+        job.path = path;
+        job.uuid = uuid;
+        job.state = Hashing;
+        job.submitted = started;
+        mJobs.insert(id, job);
+        mJobByPath[path] = id;
+        mPending++;
+    }
+    emit logMessage(QString("[engine] job %1: resuming %2 (uuid %3)").arg(id).arg(path, uuid));
+    // The hash is known, continue with the cache lookup (the upload polls the uuid instead)
+    QMetaObject::invokeMethod(this, "hashFinished", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QString, sha256));
+    return id;
+}
+
+void AnalysisEngine::resumeJournal(JobJournal* journal)
+{
+    // Replaying waits for the journal lock and rewrites the log
+    mHashPool.start(new JournalTask(this, journal));
+}
+
+void AnalysisEngine::replayJournal(JobJournal* journal)
+{
+    auto entries = journal->replay();
+    for(const auto& entry : entries)
+    {
+        // Queued while Malcore was unreachable, not uploaded yet
+        if(entry.uuid.isEmpty())
+            submit(entry.path);
+        else if(!entry.sha256.isEmpty())
+            resume(entry.path, entry.sha256, entry.uuid, entry.started);
+    }
+    emit journalReplayed(entries.size());
+}
+
+bool AnalysisEngine::waitForIdle(unsigned long timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker lock(&mLock);
+    while(mPending > 0)
+    {
+        if(mCancelled)
+            return false;
+        unsigned long remaining = ULONG_MAX;
+        if(timeout != ULONG_MAX)
+        {
+            auto elapsed = (unsigned long)timer.elapsed();
+            if(elapsed >= timeout)
+                return false;
+            remaining = timeout - elapsed;
+        }
+        mIdleCondition.wait(&mLock, remaining);
+    }
+    return true;
+}
+
+void AnalysisEngine::cancelWaiters()
+{
+    QMutexLocker lock(&mLock);
+    mCancelled = true;
+    mIdleCondition.wakeAll();
+}
+
+QList<AnalysisEngine::Job> AnalysisEngine::jobs() const
+{
+    QMutexLocker lock(&mLock);
+    return mJobs.values();
+}
+
+void AnalysisEngine::startJob(int id)
+{
+    QString path;
+    {
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        job.state = Hashing;
+        path = job.path;
+    }
+    emit logMessage(QString("[engine] job %1: %2").arg(id).arg(path));
+    mHashPool.start(new HashTask(this, mCache, id, path));
+}
+
+void AnalysisEngine::hashFinished(int id, const QString& sha256)
+{
+    if(sha256.isEmpty())
+    {
+        failJob(id, "Failed to hash file");
+        return;
+    }
+
+    bool cached = false;
+    bool claim = false;
+    {
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        job.sha256 = sha256;
+        job.jsonPath = mCache->jsonPath(sha256);
+        if(mCache->touch(job.jsonPath, job.path))
+        {
+            job.cached = true;
+            cached = true;
+        }
+        else
+        {
+            auto itr = mJobByHash.find(sha256);
+            if(itr != mJobByHash.end() && mJobs[itr.value()].state != Failed)
+            {
+                // The same bytes are already being analyzed, wait for that job
+                const auto& primary = mJobs[itr.value()];
+                job.duplicateOf = primary.id;
+                job.state = Queued;
+                if(primary.state != Finished)
+                    return;
+                cached = true;
+            }
+            else
+            {
+                mJobByHash[sha256] = id;
+                job.state = Waiting;
+                claim = true;
+            }
+        }
+    }
+
+    if(cached)
+        finishJob(id, nullptr);
+    else if(claim)
+        waitForUpload(id);
+}
+
+void AnalysisEngine::waitForUpload(int id)
+{
+    QString path;
+    QString jsonPath;
+    {
+        QMutexLocker lock(&mLock);
+        const auto& job = mJobs[id];
+        path = job.path;
+        jsonPath = job.jsonPath;
+    }
+
+    // Upload unless another instance does (the report might be stored right before the lock is
+    // released, so check again after acquiring it)
+    auto uploadLock = mCache->lockUpload(jsonPath);
+    if(!uploadLock)
+    {
+        if(!mCache->touch(jsonPath, path))
+        {
+            QTimer::singleShot(UploadWaitInterval, this, [this, id]()
+            {
+                waitForUpload(id);
+            });
+            return;
+        }
+    }
+    else if(!mCache->touch(jsonPath, path))
+    {
+        {
+            QMutexLocker lock(&mLock);
+            mUploadLocks.insert(id, std::shared_ptr<QLockFile>(std::move(uploadLock)));
+            mJobs[id].state = Queued;
+            mUploadQueue.enqueue(id);
+        }
+        scheduleUploads();
+        return;
+    }
+
+    {
+        QMutexLocker lock(&mLock);
+        mJobs[id].cached = true;
+    }
+    emit logMessage(QString("[engine] job %1: analyzed by another instance").arg(id));
+    finishJob(id, nullptr);
+}
+
+void AnalysisEngine::scheduleUploads()
+{
+    while(true)
+    {
+        int id = 0;
+        {
+            QMutexLocker lock(&mLock);
+            if(mActive >= mMaxActiveJobs || mUploadQueue.isEmpty())
+                return;
+            // Highest priority first, in submission order within a priority
+            auto next = 0;
+            for(int i = 1; i < mUploadQueue.size(); i++)
+            {
+                if(mJobs[mUploadQueue[i]].priority < mJobs[mUploadQueue[next]].priority)
+                    next = i;
+            }
+            id = mUploadQueue.takeAt(next);
+            mActive++;
+        }
+        upload(id);
+    }
+}
+
+void AnalysisEngine::upload(int id)
+{
+    QString path;
+    QString sha256;
+    QString jsonPath;
+    QString uuid;
+    qint64 started = 0;
+    auto priority = RateLimiter::Batch;
+    {
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        job.state = Uploading;
+        path = job.path;
+        sha256 = job.sha256;
+        jsonPath = job.jsonPath;
+        priority = job.priority;
+        uuid = job.uuid;
+        started = job.submitted;
+    }
+
+    if(mClient->apiKey().isEmpty())
+    {
+        failJob(id, "Not logged in");
+        return;
+    }
+
+    // Shared with the plugin (and jobs of other paths) analyzing the same file
+    auto request = uuid.isEmpty() ? mClient->analyze(sha256, path, jsonPath, priority) : mClient->resume(sha256, path, jsonPath, uuid, started, priority);
+    auto uploaded = [this, request, id]()
+    {
+        emit logMessage(QString("[engine] job %1: uuid %2").arg(id).arg(request->uuid()));
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        job.uuid = request->uuid();
+        job.state = Polling;
+    };
+    if(!request->uuid().isEmpty())
+        uploaded();
+    connect(request, &AnalysisRequest::uploaded, this, uploaded);
+    connect(request, &AnalysisRequest::offline, this, [this, id]()
+    {
+        emit logMessage(QString("[engine] job %1: Malcore is unreachable, waiting for it to come back").arg(id));
+    });
+    connect(request, &AnalysisRequest::finished, this, [this, request, id]()
+    {
+        {
+            QMutexLocker lock(&mLock);
+            mJobs[id].polls = request->polls();
+        }
+        finishJob(id, request);
+    });
+    connect(request, &AnalysisRequest::failed, this, [this, id](const QString& error, int httpStatus)
+    {
+        failJob(id, httpStatus == 403 ? QString("Invalid API key") : error);
+    });
+}
+
+void AnalysisEngine::finishJob(int id, const AnalysisRequest* request)
+{
+    QString jsonPath;
+    QString path;
+    {
+        QMutexLocker lock(&mLock);
+        jsonPath = mJobs[id].jsonPath;
+        path = mJobs[id].path;
+    }
+
+    // The request streamed the report into the cache, keep where it came from to refresh it
+    if(request != nullptr)
+        mCache->add(jsonPath, path, request->uuid(), request->etag());
+
+    if(mRenderHtml && !QFile::exists(ReportCache::htmlPath(jsonPath)))
+    {
+        auto data = ReportCache::readReport(jsonPath);
+        if(!data.isEmpty())
+        {
+            MalcoreAnalysis analysis(data, 0, 0, 0);
+            mCache->store(ReportCache::htmlPath(jsonPath), analysis.getReportHtml().toUtf8());
+        }
+    }
+
+    QList<Job> completed;
+    bool isIdle = false;
+    {
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        completeJob(job, Finished, QString());
+        completed.append(job);
+
+        // Complete the jobs that were waiting for the same hash
+        for(auto itr = mJobs.begin(); itr != mJobs.end(); ++itr)
+        {
+            auto& duplicate = itr.value();
+            if(duplicate.duplicateOf != id || duplicate.state == Finished || duplicate.state == Failed)
+                continue;
+            completeJob(duplicate, Finished, QString());
+            completed.append(duplicate);
+        }
+        isIdle = mPending == 0;
+    }
+
+    for(const auto& job : completed)
+    {
+        // Duplicates share the report, their module names are recorded as metadata
+        mCache->touch(job.jsonPath, job.path);
+        emit logMessage(QString("[engine] job %1: finished%2").arg(job.id).arg(QString(job.cached ? " (cached)" : "")));
+        emit jobFinished(job.id, job.path, job.jsonPath);
+    }
+    scheduleUploads();
+    if(isIdle)
+        emit idle();
+}
+
+void AnalysisEngine::failJob(int id, const QString& error)
+{
+    QList<Job> failed;
+    bool isIdle = false;
+    {
+        QMutexLocker lock(&mLock);
+        auto& job = mJobs[id];
+        completeJob(job, Failed, error);
+        failed.append(job);
+
+        for(auto itr = mJobs.begin(); itr != mJobs.end(); ++itr)
+        {
+            auto& duplicate = itr.value();
+            if(duplicate.duplicateOf != id || duplicate.state == Finished || duplicate.state == Failed)
+                continue;
+            completeJob(duplicate, Failed, error);
+            failed.append(duplicate);
+        }
+        isIdle = mPending == 0;
+    }
+
+    for(const auto& job : failed)
+    {
+        emit logMessage(QString("[engine] job %1: %2").arg(job.id).arg(job.error));
+        emit jobFailed(job.id, job.path, job.error);
+    }
+    scheduleUploads();
+    if(isIdle)
+        emit idle();
+}
+
+void AnalysisEngine::completeJob(Job& job, State state, const QString& error)
+{
+    // NOTE: mLock has to be held
+    if(job.state == Uploading || job.state == Polling)
+        mActive--;
+    if(state == Failed && mJobByHash.value(job.sha256) == job.id)
+        mJobByHash.remove(job.sha256);
+    mUploadLocks.remove(job.id);
+    job.state = state;
+    job.error = error;
+    job.completed = QDateTime::currentMSecsSinceEpoch();
+    if(--mPending == 0)
+        mIdleCondition.wakeAll();
+}
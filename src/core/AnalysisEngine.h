@@ -0,0 +1,117 @@
+#pragma once
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QMap>
+#include <QHash>
+#include <QQueue>
+#include <QThreadPool>
+
+#include <climits>
+#include <memory>
+
+#include "MalcoreClient.h"
+#include "ReportCache.h"
+
+class JobJournal;
+
+// Background analysis jobs (hash -> cache lookup -> upload -> poll -> render) that are not tied
+// to the UI. submit(), resume(), jobs() and waitForIdle() can be called from any thread, the work itself runs
+// on the thread that owns the engine. Jobs are deduplicated by path on submit and by hash once hashed.
+class AnalysisEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State
+    {
+        Queued,
+        Hashing,
+        Waiting, // for another debugger instance that uploads the same file
+        Uploading,
+        Polling,
+        Finished,
+        Failed,
+    };
+
+    struct Job
+    {
+        int id = 0;
+        QString path;
+        QString sha256;
+        QString uuid;
+        QString jsonPath;
+        QString error;
+        State state = Queued;
+        bool cached = false;
+        int duplicateOf = 0; // job that does the actual work for the same hash
+        int polls = 0;
+        RateLimiter::Priority priority = RateLimiter::Batch;
+        qint64 submitted = 0; // ms since epoch (of the upload for resumed jobs)
+        qint64 completed = 0;
+    };
+
+    AnalysisEngine(MalcoreClient* client, ReportCache* cache, QObject* parent = nullptr);
+    ~AnalysisEngine();
+
+    static const char* stateName(State state);
+
+    // Number of jobs that are uploading or polling at the same time
+    void setMaxActiveJobs(int count) { mMaxActiveJobs = count; }
+    // Write the (not rebased) HTML report next to the JSON
+    void setRenderHtml(bool render) { mRenderHtml = render; }
+
+    int submit(const QString& path, RateLimiter::Priority priority = RateLimiter::Batch);
+    // Poll an upload from a previous session (see JobJournal) and store its report
+    int resume(const QString& path, const QString& sha256, const QString& uuid, qint64 started);
+    // Replays the journal on a background thread and submits or resumes its jobs, emits
+    // journalReplayed(). The journal has to outlive the engine.
+    void resumeJournal(JobJournal* journal);
+    // NOTE: do not call this from the thread that owns the engine
+    bool waitForIdle(unsigned long timeout = ULONG_MAX);
+    // Wakes waitForIdle() callers, which return false from now on (the engine is about to be deleted)
+    void cancelWaiters();
+    QList<Job> jobs() const;
+
+signals:
+    void logMessage(const QString& message);
+    void jobFinished(int id, const QString& path, const QString& jsonPath);
+    void jobFailed(int id, const QString& path, const QString& error);
+    void idle();
+    void journalReplayed(int jobs);
+
+private slots:
+    void startJob(int id);
+    void hashFinished(int id, const QString& sha256);
+
+private:
+    friend class JournalTask;
+
+    void replayJournal(JobJournal* journal);
+    void waitForUpload(int id);
+    void scheduleUploads();
+    void upload(int id);
+    // request is nullptr if the report was cached already
+    void finishJob(int id, const AnalysisRequest* request);
+    void failJob(int id, const QString& error);
+    void completeJob(Job& job, State state, const QString& error);
+
+    MalcoreClient* mClient = nullptr;
+    ReportCache* mCache = nullptr;
+    QThreadPool mHashPool;
+    int mMaxActiveJobs = 2;
+    bool mRenderHtml = false;
+
+    mutable QMutex mLock;
+    QWaitCondition mIdleCondition;
+    QMap<int, Job> mJobs;
+    QHash<QString, int> mJobByPath;
+    QHash<QString, int> mJobByHash;
+    QHash<int, std::shared_ptr<QLockFile>> mUploadLocks; // released when the job completes
+    QQueue<int> mUploadQueue;
+    int mNextId = 1;
+    int mPending = 0;
+    int mActive = 0;
+    bool mCancelled = false;
+};
@@ -0,0 +1,248 @@
+#include "AutoAnalysisPolicy.h"
+#include "AnalysisEngine.h"
+#include "ReportCache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegExp>
+#include <QRunnable>
+#include <QThread>
+
+QList<AutoAnalysisPolicy::Rule> AutoAnalysisPolicy::defaultRules()
+{
+    Rule rule;
+    rule.name = "unsigned user modules";
+    rule.party = User;
+    rule.maxSize = 64 * 1024 * 1024;
+    rule.isSigned = 0;
+    rule.cached = 0;
+    return QList<Rule>() << rule;
+}
+
+static bool parseFlag(const QJsonObject& object, const char* key, int& result, QString* error)
+{
+    auto value = object[key];
+    if(value.isUndefined() || value.isNull())
+        return true;
+    if(!value.isBool())
+    {
+        if(error != nullptr)
+            *error = QString("\"%1\" has to be true or false").arg(key);
+        return false;
+    }
+    result = value.toBool() ? 1 : 0;
+    return true;
+}
+
+bool AutoAnalysisPolicy::parseRules(const QJsonArray& rules, QList<Rule>& result, QString* error)
+{
+    QList<Rule> parsed;
+    for(int i = 0; i < rules.size(); i++)
+    {
+        if(!rules[i].isObject())
+        {
+            if(error != nullptr)
+                *error = QString("rule %1 is not an object").arg(i + 1);
+            return false;
+        }
+        auto object = rules[i].toObject();
+        Rule rule;
+        rule.name = object["name"].toString(QString("rule %1").arg(i + 1));
+
+        auto action = object["action"].toString("analyze");
+        auto party = object["party"].toString();
+        QString ruleError;
+        if(action != "analyze" && action != "skip")
+            ruleError = QString("unknown action \"%1\"").arg(action);
+        else if(!party.isEmpty() && party != "user" && party != "system")
+            ruleError = QString("unknown party \"%1\"").arg(party);
+        rule.analyze = action == "analyze";
+        rule.party = party == "user" ? User : party == "system" ? System : AnyParty;
+
+        for(const auto& pattern : object["paths"].toArray())
+            rule.paths.append(QDir::fromNativeSeparators(pattern.toString()));
+        rule.maxSize = qint64(object["maxSizeMb"].toDouble(0) * 1024 * 1024);
+
+        if(ruleError.isEmpty() && parseFlag(object, "signed", rule.isSigned, &ruleError))
+            parseFlag(object, "cached", rule.cached, &ruleError);
+        if(!ruleError.isEmpty())
+        {
+            if(error != nullptr)
+                *error = QString("%1: %2").arg(rule.name, ruleError);
+            return false;
+        }
+        parsed.append(rule);
+    }
+    result = parsed;
+    return true;
+}
+
+bool AutoAnalysisPolicy::load(const QString& path, QString* error)
+{
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly))
+    {
+        if(error != nullptr)
+            *error = QString("Failed to open %1").arg(path);
+        return false;
+    }
+
+    QJsonParseError parseError;
+    auto root = QJsonDocument::fromJson(f.readAll(), &parseError).object();
+    if(parseError.error != QJsonParseError::NoError)
+    {
+        if(error != nullptr)
+            *error = QString("%1: %2").arg(path, parseError.errorString());
+        return false;
+    }
+    return parseRules(root["rules"].toArray(), mRules, error);
+}
+
+const AutoAnalysisPolicy::Rule* AutoAnalysisPolicy::match(const Module& module) const
+{
+    // The signature and the cache are only looked up once, and only if a rule gets that far
+    auto modulePath = QDir::fromNativeSeparators(module.path);
+    int isSigned = -1;
+    int cached = -1;
+    for(const auto& rule : mRules)
+    {
+        if(rule.party == User && module.system)
+            continue;
+        if(rule.party == System && !module.system)
+            continue;
+        if(rule.maxSize > 0 && module.size > rule.maxSize)
+            continue;
+        if(!rule.paths.isEmpty())
+        {
+            auto matched = false;
+            for(const auto& pattern : rule.paths)
+            {
+                if(QRegExp(pattern, Qt::CaseInsensitive, QRegExp::Wildcard).exactMatch(modulePath))
+                {
+                    matched = true;
+                    break;
+                }
+            }
+            if(!matched)
+                continue;
+        }
+        if(rule.isSigned != -1)
+        {
+            if(isSigned == -1)
+                isSigned = module.isSigned && module.isSigned() ? 1 : 0;
+            if(isSigned != rule.isSigned)
+                continue;
+        }
+        if(rule.cached != -1)
+        {
+            if(cached == -1)
+                cached = module.isCached && module.isCached() ? 1 : 0;
+            if(cached != rule.cached)
+                continue;
+        }
+        return &rule;
+    }
+    return nullptr;
+}
+
+class AutoAnalysisTask : public QRunnable
+{
+public:
+    AutoAnalysisTask(AutoAnalyzer* analyzer, const QString& path, bool system)
+        : mAnalyzer(analyzer), mPath(path), mSystem(system)
+    {
+    }
+
+    void run() override
+    {
+        // Nobody is waiting for the result, the debuggee and the GUI come first
+        QThread::currentThread()->setPriority(QThread::LowestPriority);
+        mAnalyzer->evaluate(mPath, mSystem);
+    }
+
+private:
+    AutoAnalyzer* mAnalyzer;
+    QString mPath;
+    bool mSystem;
+};
+
+class PolicyLoadTask : public QRunnable
+{
+public:
+    PolicyLoadTask(AutoAnalyzer* analyzer, const QString& path)
+        : mAnalyzer(analyzer), mPath(path)
+    {
+    }
+
+    void run() override
+    {
+        QThread::currentThread()->setPriority(QThread::LowestPriority);
+        AutoAnalysisPolicy policy;
+        QString error;
+        if(!QFile::exists(mPath))
+            policy.setRules(AutoAnalysisPolicy::defaultRules());
+        else if(!policy.load(mPath, &error))
+            emit mAnalyzer->policyFailed(error);
+        mAnalyzer->mPolicy = policy;
+    }
+
+private:
+    AutoAnalyzer* mAnalyzer;
+    QString mPath;
+};
+
+AutoAnalyzer::AutoAnalyzer(AnalysisEngine* engine, ReportCache* cache, QObject* parent)
+    : QObject(parent)
+    , mEngine(engine)
+    , mCache(cache)
+{
+    mPool.setMaxThreadCount(1);
+}
+
+AutoAnalyzer::~AutoAnalyzer()
+{
+    mPool.clear();
+    mPool.waitForDone();
+}
+
+void AutoAnalyzer::moduleLoaded(const QString& path, bool system)
+{
+    // The policy belongs to the pool thread, which evaluates the module after loading it
+    if(path.isEmpty())
+        return;
+    mPool.start(new AutoAnalysisTask(this, path, system));
+}
+
+void AutoAnalyzer::loadPolicy(const QString& path)
+{
+    mPool.start(new PolicyLoadTask(this, path));
+}
+
+void AutoAnalyzer::evaluate(const QString& path, bool system)
+{
+    if(mPolicy.rules().isEmpty())
+        return;
+    AutoAnalysisPolicy::Module module;
+    module.path = path;
+    module.system = system;
+    module.size = QFileInfo(path).size();
+    module.isSigned = [this, &path]()
+    {
+        return mSignatureCheck && mSignatureCheck(path);
+    };
+    module.isCached = [this, &path]()
+    {
+        // Shares the hash with the engine, which does not hash the file again
+        auto sha256 = mCache->fileHash(path);
+        return !sha256.isEmpty() && QFile::exists(mCache->jsonPath(sha256));
+    };
+
+    auto rule = mPolicy.match(module);
+    auto analyze = rule != nullptr && rule->analyze;
+    if(analyze)
+        mEngine->submit(path);
+    emit decided(path, analyze, rule != nullptr ? rule->name : QString());
+}
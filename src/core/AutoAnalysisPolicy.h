@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QJsonArray>
+#include <QThreadPool>
+
+#include <functional>
+
+class AnalysisEngine;
+class ReportCache;
+
+// Rules that decide which loaded modules are analyzed without the user asking for it. The first
+// rule that matches a module decides, a module that matches no rule is not analyzed.
+//
+// Policy file (JSON): { "rules": [ rule, ... ] } where every condition of a rule is optional:
+//   "name": shown in the log
+//   "action": "analyze" (default) or "skip"
+//   "party": "user" or "system"
+//   "paths": wildcard patterns for the full module path (case-insensitive, / or \)
+//   "maxSizeMb": files larger than this do not match
+//   "signed": true or false, Authenticode signature embedded in the file
+//   "cached": true or false, a report of the file is in the report cache
+class AutoAnalysisPolicy
+{
+public:
+    enum Party
+    {
+        AnyParty,
+        User,
+        System,
+    };
+
+    struct Rule
+    {
+        QString name;
+        bool analyze = true;
+        Party party = AnyParty;
+        QStringList paths;
+        qint64 maxSize = 0; // bytes, 0 is unlimited
+        int isSigned = -1; // -1 is either
+        int cached = -1;
+    };
+
+    // What is known about a module, the expensive facts are only looked up if a rule needs them
+    struct Module
+    {
+        QString path;
+        bool system = false;
+        qint64 size = 0;
+        std::function<bool()> isSigned;
+        std::function<bool()> isCached;
+    };
+
+    // Unsigned user modules up to 64 MiB that were not analyzed before
+    static QList<Rule> defaultRules();
+    static bool parseRules(const QJsonArray& rules, QList<Rule>& result, QString* error = nullptr);
+
+    void setRules(const QList<Rule>& rules) { mRules = rules; }
+    const QList<Rule>& rules() const { return mRules; }
+    // Returns false if the file is missing or invalid, the rules are unchanged then
+    bool load(const QString& path, QString* error = nullptr);
+    // The rule that decides, nullptr if none matches
+    const Rule* match(const Module& module) const;
+
+private:
+    QList<Rule> mRules;
+};
+
+// Applies an AutoAnalysisPolicy to modules as they load and submits the ones it selects to the
+// analysis engine, which deduplicates them by path and hash and does not upload cached reports.
+// The policy is loaded and evaluated on a low priority thread because the signature check and the
+// hash can take a while.
+class AutoAnalyzer : public QObject
+{
+    Q_OBJECT
+
+public:
+    AutoAnalyzer(AnalysisEngine* engine, ReportCache* cache, QObject* parent = nullptr);
+    ~AutoAnalyzer();
+
+    // Before the first moduleLoaded(), loadPolicy() can be called any time
+    void setPolicy(const AutoAnalysisPolicy& policy) { mPolicy = policy; }
+    // Loads the policy on the pool, modules that load before are evaluated after it. The default
+    // rules are used if the file does not exist, no rules (and policyFailed()) if it is invalid.
+    void loadPolicy(const QString& path);
+    // Checks the Authenticode signature of a file, without it "signed" never matches
+    void setSignatureCheck(const std::function<bool(const QString&)>& check) { mSignatureCheck = check; }
+    void moduleLoaded(const QString& path, bool system);
+
+signals:
+    // Emitted from the pool thread, rule is empty if no rule matched
+    void decided(const QString& path, bool analyze, const QString& rule);
+    void policyFailed(const QString& error);
+
+private:
+    friend class AutoAnalysisTask;
+    friend class PolicyLoadTask;
+
+    void evaluate(const QString& path, bool system);
+
+    AnalysisEngine* mEngine = nullptr;
+    ReportCache* mCache = nullptr;
+    AutoAnalysisPolicy mPolicy;
+    std::function<bool(const QString&)> mSignatureCheck;
+    QThreadPool mPool;
+};
@@ -0,0 +1,75 @@
+#include "CircuitBreaker.h"
+#include "MalcoreClient.h"
+
+CircuitBreaker::CircuitBreaker(MalcoreClient* client)
+    : QObject(client)
+    , mClient(client)
+{
+    mProbeTimer = new QTimer(this);
+    mProbeTimer->setSingleShot(true);
+    connect(mProbeTimer, &QTimer::timeout, this, &CircuitBreaker::probe);
+}
+
+void CircuitBreaker::recordSuccess()
+{
+    mFailures = 0;
+    if(mState == Closed)
+        return;
+
+    mState = Closed;
+    mCooldown = MinCooldown;
+    mProbeTimer->stop();
+    emit closed();
+}
+
+void CircuitBreaker::recordFailure()
+{
+    if(mState != Closed || ++mFailures < FailureThreshold)
+        return;
+
+    mState = Open;
+    mCooldown = MinCooldown;
+    mProbeTimer->start(mCooldown);
+    emit opened();
+}
+
+bool CircuitBreaker::isOutage(QNetworkReply* reply)
+{
+    auto status = MalcoreClient::httpStatus(reply);
+    if(status != 0)
+        return status >= 500;
+    return reply->error() != QNetworkReply::NoError;
+}
+
+void CircuitBreaker::probe()
+{
+    // The status of no upload, the same request that checks the API key
+    mState = HalfOpen;
+    auto reply = mClient->status(QString());
+
+    // A probe that hangs is a failed one, the breaker would stay half-open forever otherwise
+    auto deadline = new QTimer(reply);
+    deadline->setSingleShot(true);
+    connect(deadline, &QTimer::timeout, reply, &QNetworkReply::abort);
+    deadline->start(MalcoreClient::ResponseTimeout);
+    connect(reply, &QNetworkReply::readyRead, deadline, [deadline]()
+    {
+        deadline->start(MalcoreClient::StallTimeout);
+    });
+
+    connect(reply, &QNetworkReply::finished, this, [this, reply]()
+    {
+        reply->deleteLater();
+        if(mState != HalfOpen)
+            return;
+
+        if(!isOutage(reply))
+        {
+            recordSuccess();
+            return;
+        }
+        mState = Open;
+        mCooldown = qMin(mCooldown * 2, MaxCooldown);
+        mProbeTimer->start(mCooldown);
+    });
+}
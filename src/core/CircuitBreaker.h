@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include <QNetworkReply>
+
+class MalcoreClient;
+
+// Tracks whether the Malcore API is reachable. After FailureThreshold consecutive outages (network
+// errors and 5xx responses) the breaker opens: requests stop hitting the dead service and wait for
+// closed() instead. While open a cheap status request probes the service in the background, with
+// a cooldown that doubles up to MaxCooldown between probes.
+class CircuitBreaker : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State
+    {
+        Closed,
+        Open,
+        HalfOpen, // a probe is in flight
+    };
+
+    static const int FailureThreshold = 3;
+    static const int MinCooldown = 5000;
+    static const int MaxCooldown = 5 * 60 * 1000;
+
+    explicit CircuitBreaker(MalcoreClient* client);
+
+    State state() const { return mState; }
+    bool isOpen() const { return mState != Closed; }
+    // Report the outcome of every API request
+    void recordSuccess();
+    void recordFailure();
+
+    // The request failed because of the service, not because of what was sent
+    static bool isOutage(QNetworkReply* reply);
+
+signals:
+    void opened();
+    // The service answered again, parked requests can be retried
+    void closed();
+
+private:
+    void probe();
+
+    MalcoreClient* mClient = nullptr;
+    QTimer* mProbeTimer = nullptr;
+    State mState = Closed;
+    int mFailures = 0;
+    int mCooldown = MinCooldown;
+};
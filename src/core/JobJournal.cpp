@@ -0,0 +1,184 @@
+#include "JobJournal.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QLockFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QHash>
+#include <QRunnable>
+
+#include <cstring>
+
+static const char LogMagic[4] = { 'M', 'J', 'R', 'N' };
+static const quint32 LogVersion = 1;
+// Appends are tiny, only another instance compacting the log holds the lock for longer
+static const int LockTimeout = 5000;
+
+static void writeHeader(QDataStream& stream)
+{
+    stream.writeRawData(LogMagic, sizeof(LogMagic));
+    stream << LogVersion;
+}
+
+static void writeString(QDataStream& stream, const QString& str)
+{
+    auto utf8 = str.toUtf8();
+    stream << quint16(utf8.size());
+    stream.writeRawData(utf8.constData(), utf8.size());
+}
+
+static bool readString(QDataStream& stream, QString& str)
+{
+    quint16 length = 0;
+    stream >> length;
+    QByteArray utf8(length, Qt::Uninitialized);
+    if(stream.readRawData(utf8.data(), length) != length || stream.status() != QDataStream::Ok)
+        return false;
+    str = QString::fromUtf8(utf8);
+    return true;
+}
+
+static void writeEntry(QDataStream& stream, const JobJournal::Entry& entry)
+{
+    stream << quint8(entry.state) << entry.started << entry.updated;
+    writeString(stream, entry.sha256);
+    writeString(stream, entry.path);
+    writeString(stream, entry.uuid);
+}
+
+static QString entryKey(const JobJournal::Entry& entry)
+{
+    return entry.sha256.isEmpty() ? entry.uuid : entry.sha256;
+}
+
+class JournalAppendTask : public QRunnable
+{
+public:
+    JournalAppendTask(JobJournal* journal, const JobJournal::Entry& entry)
+        : mJournal(journal), mEntry(entry)
+    {
+    }
+
+    void run() override
+    {
+        mJournal->write(mEntry);
+    }
+
+private:
+    JobJournal* mJournal;
+    JobJournal::Entry mEntry;
+};
+
+JobJournal::JobJournal(const QString& logPath)
+    : mLogPath(logPath)
+    , mLockPath(logPath + ".lock")
+{
+    // One writer keeps the records in order
+    mPool.setMaxThreadCount(1);
+}
+
+JobJournal::~JobJournal()
+{
+    mPool.waitForDone();
+}
+
+void JobJournal::append(State state, const QString& sha256, const QString& path, const QString& uuid, qint64 started)
+{
+    Entry entry;
+    entry.state = state;
+    entry.started = started;
+    entry.updated = QDateTime::currentMSecsSinceEpoch();
+    entry.sha256 = sha256;
+    entry.path = path;
+    entry.uuid = uuid;
+    mPool.start(new JournalAppendTask(this, entry));
+}
+
+bool JobJournal::write(const Entry& entry)
+{
+    QLockFile lock(mLockPath);
+    if(!lock.tryLock(LockTimeout))
+        return false;
+
+    QFile f(mLogPath);
+    if(!f.open(QIODevice::ReadWrite))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    if(f.size() == 0)
+        writeHeader(stream);
+    f.seek(f.size());
+    writeEntry(stream, entry);
+    // Survive a crash right after the upload
+    return stream.status() == QDataStream::Ok && f.flush();
+}
+
+QList<JobJournal::Entry> JobJournal::replay()
+{
+    QList<Entry> pending;
+    QLockFile lock(mLockPath);
+    if(!lock.tryLock(LockTimeout))
+        return pending;
+
+    // The last record of a file decides its state, a queued upload is superseded by its upload
+    QHash<QString, int> latest; // sha256 (uuid for old records without one) -> index
+    QList<Entry> entries = readLog(mLogPath);
+    for(int i = 0; i < entries.size(); i++)
+        latest[entryKey(entries[i])] = i;
+
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    for(int i = 0; i < entries.size(); i++)
+    {
+        const auto& entry = entries[i];
+        if(latest.value(entryKey(entry)) != i)
+            continue;
+        if((entry.state == Uploaded && now - entry.started < MaxAge) || (entry.state == Queued && now - entry.started < MaxQueuedAge))
+            pending.append(entry);
+    }
+
+    // Keep the log small, only the pending and queued uploads are carried over
+    QSaveFile f(mLogPath);
+    if(f.open(QIODevice::WriteOnly))
+    {
+        QDataStream stream(&f);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        writeHeader(stream);
+        for(const auto& entry : pending)
+            writeEntry(stream, entry);
+        if(stream.status() == QDataStream::Ok)
+            f.commit();
+    }
+    return pending;
+}
+
+QList<JobJournal::Entry> JobJournal::readLog(const QString& path)
+{
+    QList<Entry> entries;
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly))
+        return entries;
+
+    QDataStream stream(&f);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    char magic[sizeof(LogMagic)];
+    quint32 version = 0;
+    if(stream.readRawData(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, LogMagic, sizeof(magic)) != 0)
+        return entries;
+    stream >> version;
+    if(version != LogVersion)
+        return entries;
+
+    while(!stream.atEnd())
+    {
+        Entry entry;
+        quint8 state = 0;
+        stream >> state >> entry.started >> entry.updated;
+        if(!readString(stream, entry.sha256) || !readString(stream, entry.path) || !readString(stream, entry.uuid))
+            break; // truncated record
+        entry.state = State(state);
+        entries.append(entry);
+    }
+    return entries;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QThreadPool>
+
+// Append-only log of the uploads that are in flight, so an analysis that was still pending when
+// x64dbg exited (or crashed) resumes polling its uuid instead of uploading the file again. Uploads
+// that were waiting for the service to come back (see CircuitBreaker) are logged without a uuid and
+// uploaded on the next start. The log is shared by the debugger instances, appends and the
+// compaction in replay() hold a lock file. Appends are written on a background thread in the order
+// they were made, waiting for another instance's lock must not block the GUI.
+//
+// Log format (little endian): "MJRN" magic, uint32 version, then one record per state change:
+// uint8 state, int64 started, int64 updated (ms since epoch), then sha256, module path and uuid
+// as uint16 length + UTF-8.
+class JobJournal
+{
+public:
+    enum State
+    {
+        Uploaded = 1, // the server has the file, the report is pending
+        Finished = 2, // the report is in the cache
+        Failed = 3,   // the server rejected the analysis
+        Queued = 4,   // offline queue, the file was not uploaded yet (no uuid)
+    };
+
+    struct Entry
+    {
+        State state = Uploaded;
+        qint64 started = 0;
+        qint64 updated = 0;
+        QString sha256;
+        QString path;
+        QString uuid;
+    };
+
+    // Pending uploads older than this are dropped, the server does not keep them
+    static const qint64 MaxAge = 24 * 60 * 60 * 1000;
+    // Only local state, queued uploads are kept longer
+    static const qint64 MaxQueuedAge = 7 * MaxAge;
+
+    explicit JobJournal(const QString& logPath);
+    // Writes the appends that are still queued
+    ~JobJournal();
+
+    QString logPath() const { return mLogPath; }
+    // Queues the record, it is timestamped now
+    void append(State state, const QString& sha256, const QString& path, const QString& uuid, qint64 started);
+    // Fold the log into the uploads that are still pending or queued and rewrite it with only those
+    QList<Entry> replay();
+
+    static QList<Entry> readLog(const QString& path);
+
+private:
+    friend class JournalAppendTask;
+
+    bool write(const Entry& entry);
+
+    QString mLogPath;
+    QString mLockPath;
+    QThreadPool mPool;
+};
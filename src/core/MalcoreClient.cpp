@@ -0,0 +1,782 @@
+#include "MalcoreClient.h"
+#include "PerfTrace.h"
+#include "JobJournal.h"
+#include "NotificationClient.h"
+
+#include <QTimer>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHttpPart>
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QVector>
+
+#include <memory>
+
+const char* MalcoreClient::DefaultBaseUrl = "https://api.malcore.io";
+
+// Consecutive 429 responses before a request fails
+static const int MaxRateLimited = 8;
+
+// Requests that failed without an answer (network errors, timeouts, 5xx) are retried MaxOutages
+// times, or until the circuit breaker opens and they wait for the service instead
+static const int MaxOutages = 3;
+
+// Status requests that did not answer within the p95 of the earlier ones get a duplicate, the
+// first one to answer is used
+static const qint64 HedgeMinSamples = 20;
+static const qint64 DefaultHedgeDelay = 3000;
+static const qint64 MinHedgeDelay = 250;
+
+// Pending responses are a few hundred bytes, only their start is passed to polled()
+static const int MaxPolledSize = 64 * 1024;
+
+MalcoreClient::MalcoreClient(QObject* parent)
+    : QObject(parent)
+    , mBaseUrl(DefaultBaseUrl)
+{
+    mNotifications = new NotificationClient(this);
+    mLimiter = new RateLimiter(this);
+    mBreaker = new CircuitBreaker(this);
+}
+
+QNetworkAccessManager* MalcoreClient::http() const
+{
+    if(mHttp == nullptr)
+        mHttp = new QNetworkAccessManager(const_cast<MalcoreClient*>(this));
+    return mHttp;
+}
+
+QNetworkRequest MalcoreClient::request(const char* endpoint, const QString& apiKey) const
+{
+    auto url = mBaseUrl;
+    auto path = url.path();
+    if(path.endsWith('/'))
+        path.chop(1);
+    url.setPath(path + endpoint);
+
+    // Accept-Encoding is left to QNetworkAccessManager, it asks for gzip and deflate and decodes
+    // the responses before they are read
+    QNetworkRequest request(url);
+    if(!apiKey.isEmpty())
+        request.setRawHeader("apiKey", apiKey.toUtf8());
+    request.setHeader(QNetworkRequest::UserAgentHeader, "x64dbg");
+    return request;
+}
+
+QNetworkReply* MalcoreClient::upload(const QString& path, QString* error)
+{
+    // Open the file for the form data
+    QFile* file = new QFile(path);
+    if(!file->open(QIODevice::ReadOnly))
+    {
+        if(error != nullptr)
+            *error = QString("Failed to open file: %1").arg(path);
+        delete file;
+        return nullptr;
+    }
+
+    // Create a multi-part form data object
+    QHttpPart filePart;
+    filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QString("form-data; name=\"filename1\"; filename=\"%1\"").arg(QFileInfo(path).fileName()));
+    QHttpMultiPart* multiPart = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+    filePart.setBodyDevice(file);
+    file->setParent(multiPart); // Ownership of the file is transferred to the multi-part object
+    multiPart->append(filePart);
+
+    auto req = request("/api/upload", mApiKey);
+    req.setRawHeader("X-No-Poll", "true");
+
+    QNetworkReply* reply = http()->post(req, multiPart);
+    multiPart->setParent(reply); // Ownership of the multi-part object is transferred to the reply
+    return reply;
+}
+
+QNetworkReply* MalcoreClient::status(const QString& uuid, const QString& apiKey, const QByteArray& etag)
+{
+    auto req = request("/api/status", apiKey.isEmpty() ? mApiKey : apiKey);
+    req.setRawHeader("Content-Type", "application/x-www-form-urlencoded");
+    // An unchanged report is answered with an empty 304
+    if(!etag.isEmpty())
+        req.setRawHeader("If-None-Match", etag);
+
+    QUrlQuery query;
+    query.addQueryItem("uuid", uuid);
+    return http()->post(req, query.toString().toUtf8());
+}
+
+QNetworkReply* MalcoreClient::login(const QString& email, const QString& password)
+{
+    auto req = request("/auth/login", QString());
+    req.setRawHeader("Content-Type", "application/json");
+
+    QJsonObject body;
+    body["email"] = email;
+    body["password"] = password;
+    return http()->post(req, QJsonDocument(body).toJson());
+}
+
+AnalysisRequest* MalcoreClient::coalesce(const QString& sha256, RateLimiter::Priority priority, const std::function<AnalysisRequest*()>& create)
+{
+    // A caller that joins at a higher priority moves the request up in the rate limiter queue
+    if(!sha256.isEmpty())
+    {
+        auto itr = mAnalyses.constFind(sha256);
+        if(itr != mAnalyses.constEnd())
+        {
+            itr.value()->raisePriority(priority);
+            return itr.value();
+        }
+    }
+
+    auto request = create();
+    request->mPriority = priority;
+    if(!sha256.isEmpty())
+        mAnalyses.insert(sha256, request);
+    // Start from the event loop, so the caller can connect to the signals first
+    QTimer::singleShot(0, request, [request]()
+    {
+        request->start();
+    });
+    return request;
+}
+
+AnalysisRequest* MalcoreClient::analyze(const QString& sha256, const QString& path, const QString& reportPath, RateLimiter::Priority priority)
+{
+    return coalesce(sha256, priority, [&]()
+    {
+        return new AnalysisRequest(this, sha256, path, reportPath, QString(), QDateTime::currentMSecsSinceEpoch());
+    });
+}
+
+AnalysisRequest* MalcoreClient::resume(const QString& sha256, const QString& path, const QString& reportPath, const QString& uuid, qint64 started, RateLimiter::Priority priority)
+{
+    return coalesce(sha256, priority, [&]()
+    {
+        return new AnalysisRequest(this, sha256, path, reportPath, uuid, started);
+    });
+}
+
+AnalysisRequest* MalcoreClient::refresh(const QString& sha256, const QString& reportPath, const QString& uuid, const QByteArray& etag, RateLimiter::Priority priority)
+{
+    return coalesce(sha256, priority, [&]()
+    {
+        auto request = new AnalysisRequest(this, sha256, QString(), reportPath, uuid, QDateTime::currentMSecsSinceEpoch());
+        request->mRefresh = true;
+        request->mEtag = etag;
+        return request;
+    });
+}
+
+AnalysisRequest::AnalysisRequest(MalcoreClient* client, const QString& sha256, const QString& path, const QString& reportPath, const QString& uuid, qint64 started)
+    : QObject(client)
+    , mClient(client)
+    , mSha256(sha256)
+    , mPath(path)
+    , mReportPath(reportPath)
+    , mUuid(uuid)
+    , mStarted(started)
+{
+}
+
+void AnalysisRequest::start()
+{
+    // Resumed from the journal, the file is on the server already
+    if(!mUuid.isEmpty())
+    {
+        mQueueStart = PerfTrace::now();
+        poll();
+        return;
+    }
+
+    mClient->limiter()->acquire(mPriority, this, [this]()
+    {
+        if(!waitForService())
+            upload();
+    });
+}
+
+void AnalysisRequest::upload()
+{
+    QString error;
+    auto uploadStart = PerfTrace::now();
+    QNetworkReply* reply = mClient->upload(mPath, &error);
+    if(reply == nullptr)
+    {
+        fail(error, 0);
+        return;
+    }
+
+    // The upload is aborted when it stalls
+    auto deadline = new QTimer(reply);
+    deadline->setSingleShot(true);
+    auto timedOut = std::make_shared<bool>(false);
+    connect(deadline, &QTimer::timeout, this, [reply, timedOut]()
+    {
+        *timedOut = true;
+        reply->abort();
+    });
+    deadline->start(MalcoreClient::StallTimeout);
+    connect(reply, &QNetworkReply::uploadProgress, this, [this, deadline](qint64 bytesSent, qint64 bytesTotal)
+    {
+        deadline->start(bytesSent == bytesTotal ? MalcoreClient::ResponseTimeout : MalcoreClient::StallTimeout);
+        emit uploadProgress(bytesSent, bytesTotal);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply, uploadStart, timedOut]()
+    {
+        reply->deleteLater();
+        mQueueStart = PerfTrace::now();
+        PerfTrace::record("upload", uploadStart, mQueueStart - uploadStart);
+        PerfTrace::record("api/upload", uploadStart, mQueueStart - uploadStart);
+        if(MalcoreClient::httpStatus(reply) == 429)
+        {
+            if(rateLimited(reply))
+                start();
+            return;
+        }
+        mRateLimited = 0;
+
+        if(*timedOut || reply->error() != QNetworkReply::NoError)
+        {
+            if(retryOutage(reply, *timedOut))
+                start();
+            else
+                fail(*timedOut ? QString("Upload timed out") : reply->errorString(), MalcoreClient::httpStatus(reply));
+            return;
+        }
+        mOutages = 0;
+        mClient->breaker()->recordSuccess();
+
+        auto response = reply->readAll();
+        mUuid = MalcoreClient::parseUploadUuid(response);
+        if(mUuid.isEmpty())
+        {
+            fail("Upload response did not contain a uuid", MalcoreClient::httpStatus(reply));
+            return;
+        }
+        if(mClient->mJournal != nullptr)
+            mClient->mJournal->append(JobJournal::Uploaded, mSha256, mPath, mUuid, mStarted);
+        emit uploaded(response);
+        QTimer::singleShot(mClient->pollInterval(), this, [this]()
+        {
+            poll();
+        });
+    });
+}
+
+// Picks the top-level "success" and "data.status" out of a status response while it is being
+// downloaded, without keeping the response in memory. Strings are only captured up to a few bytes,
+// the report values themselves are skipped.
+class StatusScanner
+{
+public:
+    void feed(const char* data, qint64 size)
+    {
+        for(qint64 i = 0; i < size; i++)
+        {
+            auto c = data[i];
+            if(mInString)
+            {
+                if(mEscape)
+                    mEscape = false;
+                else if(c == '\\')
+                    mEscape = true;
+                else if(c == '"')
+                    endString();
+                else if(mString.size() < 64)
+                    mString.append(c);
+                continue;
+            }
+
+            switch(c)
+            {
+            case '"':
+                mInString = true;
+                mIsKey = !mStack.isEmpty() && mStack.last() == '{' && !mAfterColon;
+                mString.clear();
+                break;
+            case '{':
+            case '[':
+                mStack.append(c);
+                if(mStack.size() <= 2)
+                    mKeys[mStack.size() - 1].clear();
+                mAfterColon = false;
+                break;
+            case '}':
+            case ']':
+                if(!mStack.isEmpty())
+                    mStack.removeLast();
+                mAfterColon = false;
+                break;
+            case ':':
+                mAfterColon = true;
+                break;
+            case ',':
+                mAfterColon = false;
+                break;
+            case 't':
+            case 'f':
+                if(mAfterColon && isObjectPath(1) && mKeys[0] == "success")
+                    mSuccess = c == 't';
+                mAfterColon = false;
+                break;
+            default:
+                // Whitespace keeps the colon, numbers and null end the value
+                if(c != ' ' && c != '\t' && c != '\r' && c != '\n')
+                    mAfterColon = false;
+                break;
+            }
+        }
+    }
+
+    bool success() const { return mSuccess; }
+    bool pending() const { return mStatus == "pending"; }
+
+private:
+    bool isObjectPath(int depth) const
+    {
+        if(mStack.size() != depth)
+            return false;
+        for(auto type : mStack)
+            if(type != '{')
+                return false;
+        return true;
+    }
+
+    void endString()
+    {
+        mInString = false;
+        if(mIsKey)
+        {
+            if(mStack.size() <= 2)
+                mKeys[mStack.size() - 1] = mString;
+            return;
+        }
+        if(isObjectPath(2) && mKeys[0] == "data" && mKeys[1] == "status")
+            mStatus = mString;
+        mAfterColon = false;
+    }
+
+    QVector<char> mStack;
+    QByteArray mKeys[2];
+    QByteArray mString;
+    QByteArray mStatus;
+    bool mInString = false;
+    bool mEscape = false;
+    bool mIsKey = false;
+    bool mAfterColon = false;
+    bool mSuccess = false;
+};
+
+void AnalysisRequest::poll()
+{
+    mPolling = true;
+    mClient->limiter()->acquire(mPriority, this, [this]()
+    {
+        if(waitForService())
+            mPolling = false;
+        else
+            sendPoll();
+    });
+}
+
+// The finished report is written to a temporary file next to the report path while it
+// downloads, the pending responses are small and kept for polled()
+struct AnalysisRequest::Download
+{
+    std::unique_ptr<QSaveFile> file;
+    StatusScanner scanner;
+    QByteArray head;
+    bool timedOut = false;
+
+    void read(QNetworkReply* reply)
+    {
+        char chunk[64 * 1024];
+        qint64 size;
+        while((size = reply->read(chunk, sizeof(chunk))) > 0)
+        {
+            scanner.feed(chunk, size);
+            if(head.size() < MaxPolledSize)
+                head.append(chunk, int(qMin<qint64>(size, MaxPolledSize - head.size())));
+            if(file->write(chunk, size) != size)
+            {
+                reply->abort();
+                return;
+            }
+        }
+    }
+};
+
+// One status request, with its hedged duplicate if the first one is slow to answer
+struct AnalysisRequest::Poll
+{
+    qint64 start = 0;
+    QList<QNetworkReply*> replies; // in flight
+    QNetworkReply* primary = nullptr; // the first attempt, the other one is the hedge
+    QNetworkReply* winner = nullptr; // answered first
+    QTimer* hedgeTimer = nullptr;
+};
+
+qint64 AnalysisRequest::hedgeDelay()
+{
+    // Until there are enough samples the p95 estimate is mostly noise
+    auto stats = PerfTrace::phaseStats("api/status");
+    if(stats.count < HedgeMinSamples)
+        return DefaultHedgeDelay;
+    return qBound(MinHedgeDelay, stats.percentile(0.95) / 1000, qint64(MalcoreClient::ResponseTimeout));
+}
+
+void AnalysisRequest::sendPoll()
+{
+    mPolls++;
+    auto poll = std::make_shared<Poll>();
+    poll->start = PerfTrace::now();
+
+    // A duplicate costs one request and bypasses the rate limiter, at most one per poll
+    poll->hedgeTimer = new QTimer(this);
+    poll->hedgeTimer->setSingleShot(true);
+    connect(poll->hedgeTimer, &QTimer::timeout, this, [this, poll]()
+    {
+        if(poll->winner != nullptr || poll->replies.isEmpty())
+            return;
+        PerfTrace::record("hedge", poll->start, PerfTrace::now() - poll->start);
+        sendAttempt(poll);
+    });
+    poll->hedgeTimer->start(int(hedgeDelay()));
+    sendAttempt(poll);
+}
+
+void AnalysisRequest::sendAttempt(const std::shared_ptr<Poll>& poll)
+{
+    auto download = std::make_shared<Download>();
+    download->file.reset(new QSaveFile(mReportPath));
+    if(!download->file->open(QIODevice::WriteOnly))
+    {
+        if(!poll->replies.isEmpty())
+            return;
+        poll->hedgeTimer->deleteLater();
+        mPolling = false;
+        fail(QString("Failed to write report: %1").arg(mReportPath), 0);
+        return;
+    }
+
+    auto attemptStart = PerfTrace::now();
+    QNetworkReply* reply = mClient->status(mUuid, QString(), mEtag);
+    poll->replies.append(reply);
+    if(poll->primary == nullptr)
+        poll->primary = reply;
+
+    // Qt 5.6 has no transfer timeout: abort if the server does not answer or the transfer stalls
+    auto deadline = new QTimer(reply);
+    deadline->setSingleShot(true);
+    connect(deadline, &QTimer::timeout, this, [reply, download]()
+    {
+        download->timedOut = true;
+        reply->abort();
+    });
+    deadline->start(MalcoreClient::ResponseTimeout);
+
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this, poll, reply, deadline, attemptStart]()
+    {
+        deadline->start(MalcoreClient::StallTimeout);
+        if(poll->winner != nullptr)
+            return;
+
+        // Take the first response and drop the other attempt
+        poll->winner = reply;
+        poll->hedgeTimer->stop();
+        // From the start of the poll: with the winning attempt's own time a fast hedge would hide
+        // the slow primary, and the p95 the hedge delay is based on would keep dropping
+        auto now = PerfTrace::now();
+        PerfTrace::record("api/status", poll->start, now - poll->start);
+        if(reply != poll->primary)
+            PerfTrace::record("hedge/won", attemptStart, now - attemptStart);
+        for(auto other : poll->replies)
+        {
+            if(other == reply)
+                continue;
+            other->disconnect(this);
+            other->abort();
+            other->deleteLater();
+        }
+        poll->replies.clear();
+        poll->replies.append(reply);
+    });
+    connect(reply, &QNetworkReply::readyRead, this, [reply, download, deadline]()
+    {
+        deadline->start(MalcoreClient::StallTimeout);
+        download->read(reply);
+    });
+    connect(reply, &QNetworkReply::downloadProgress, this, [this, poll, reply](qint64 bytesReceived, qint64 bytesTotal)
+    {
+        if(poll->winner == reply)
+            emit downloadProgress(bytesReceived, bytesTotal);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, poll, reply, download]()
+    {
+        reply->deleteLater();
+        poll->replies.removeOne(reply);
+        // An attempt that failed without an answer, the other one might still get one
+        if(poll->winner == nullptr && !poll->replies.isEmpty())
+            return;
+
+        poll->hedgeTimer->deleteLater();
+        mPolling = false;
+        completePoll(reply, download, poll->start);
+    });
+}
+
+void AnalysisRequest::completePoll(QNetworkReply* reply, const std::shared_ptr<Download>& download, qint64 pollStart)
+{
+    if(MalcoreClient::httpStatus(reply) == 429)
+    {
+        download->file->cancelWriting();
+        if(rateLimited(reply))
+            poll();
+        return;
+    }
+    mRateLimited = 0;
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        auto writeError = download->file->error() != QFileDevice::NoError;
+        download->file->cancelWriting();
+        if(writeError)
+        {
+            fail(QString("Failed to write report: %1").arg(mReportPath), 0);
+        }
+        else if(retryOutage(reply, download->timedOut))
+        {
+            poll();
+        }
+        else if(download->timedOut)
+        {
+            // Leaves the upload in the journal if it keeps timing out
+            fail("Timed out waiting for the report", 0);
+        }
+        else
+        {
+            fail(reply->errorString(), MalcoreClient::httpStatus(reply));
+        }
+        return;
+    }
+    mOutages = 0;
+    mClient->breaker()->recordSuccess();
+
+    download->read(reply);
+    if(MalcoreClient::httpStatus(reply) == 304)
+    {
+        // The cached report is still current
+        download->file->cancelWriting();
+        mNotModified = true;
+        PerfTrace::record("download", pollStart, PerfTrace::now() - pollStart);
+        finish();
+        return;
+    }
+    if(!download->scanner.success())
+    {
+        download->file->cancelWriting();
+        fail("Failed to get report", MalcoreClient::httpStatus(reply));
+        return;
+    }
+
+    if(download->scanner.pending())
+    {
+        download->file->cancelWriting();
+        PerfTrace::record("poll", pollStart, PerfTrace::now() - pollStart);
+        emit polled(download->head);
+        if(mClient->notifications()->isAvailable())
+        {
+            waitForPush();
+            return;
+        }
+        stopWaiting();
+        QTimer::singleShot(mClient->pollInterval(), this, [this]()
+        {
+            poll();
+        });
+        return;
+    }
+
+    // Rename the complete report into place, another instance never sees a partial one
+    if(!download->file->commit())
+    {
+        fail(QString("Failed to write report: %1").arg(mReportPath), 0);
+        return;
+    }
+
+    // The server was queueing until the request that returned the report
+    mEtag = reply->rawHeader("ETag");
+    PerfTrace::record("queue", mQueueStart, pollStart - mQueueStart);
+    PerfTrace::record("download", pollStart, PerfTrace::now() - pollStart);
+    finish();
+}
+
+void AnalysisRequest::finish()
+{
+    detach();
+    emit finished(mReportPath);
+    if(mClient->mJournal != nullptr && !mRefresh)
+        mClient->mJournal->append(JobJournal::Finished, mSha256, mPath, mUuid, mStarted);
+    deleteLater();
+}
+
+bool AnalysisRequest::rateLimited(QNetworkReply* reply)
+{
+    // Without Retry-After back off exponentially, give up if the server keeps refusing
+    if(++mRateLimited > MaxRateLimited)
+    {
+        fail("Rate limited by the server, try again later", 429);
+        return false;
+    }
+    auto delay = MalcoreClient::retryAfter(reply, 1000 << qMin(mRateLimited - 1, 5));
+    mClient->limiter()->pause(delay);
+    return true;
+}
+
+void AnalysisRequest::raisePriority(RateLimiter::Priority priority)
+{
+    if(priority >= mPriority)
+        return;
+    mPriority = priority;
+    mClient->limiter()->setPriority(this, priority);
+}
+
+bool AnalysisRequest::waitForService()
+{
+    auto breaker = mClient->breaker();
+    if(!breaker->isOpen())
+        return false;
+    if(mServiceConnection)
+        return true;
+
+    // Not uploaded yet, it is uploaded on the next start if x64dbg exits before the service is back
+    if(mUuid.isEmpty() && !mQueued && mClient->mJournal != nullptr && !mRefresh)
+    {
+        mClient->mJournal->append(JobJournal::Queued, mSha256, mPath, QString(), mStarted);
+        mQueued = true;
+    }
+    mServiceConnection = connect(breaker, &CircuitBreaker::closed, this, [this]()
+    {
+        disconnect(mServiceConnection);
+        mServiceConnection = QMetaObject::Connection();
+        mOutages = 0;
+        if(mUuid.isEmpty())
+            start();
+        else if(!mPolling)
+            poll();
+    });
+    emit offline();
+    return true;
+}
+
+bool AnalysisRequest::retryOutage(QNetworkReply* reply, bool timedOut)
+{
+    auto breaker = mClient->breaker();
+    if(!timedOut && !CircuitBreaker::isOutage(reply))
+    {
+        // The service answered, it refused the request
+        breaker->recordSuccess();
+        return false;
+    }
+    breaker->recordFailure();
+    // Once the breaker is open the retry waits for the service in waitForService()
+    return breaker->isOpen() || ++mOutages <= MaxOutages;
+}
+
+void AnalysisRequest::waitForPush()
+{
+    if(mCompletedConnection)
+        return;
+
+    // Fetch the report when the server says it is done. Poll once whenever events might have been
+    // missed, if push became unavailable that poll falls back to the timer.
+    auto notifications = mClient->notifications();
+    mCompletedConnection = connect(notifications, &NotificationClient::completed, this, [this](const QString& uuid)
+    {
+        if(uuid == mUuid && !mPolling)
+            poll();
+    });
+    mInterruptedConnection = connect(notifications, &NotificationClient::interrupted, this, [this]()
+    {
+        if(!mPolling)
+            poll();
+    });
+    notifications->subscribe(mUuid);
+}
+
+void AnalysisRequest::stopWaiting()
+{
+    if(!mCompletedConnection)
+        return;
+
+    disconnect(mCompletedConnection);
+    disconnect(mInterruptedConnection);
+    mCompletedConnection = QMetaObject::Connection();
+    mClient->notifications()->unsubscribe(mUuid);
+}
+
+void AnalysisRequest::fail(const QString& error, int httpStatus)
+{
+    // Network errors, server errors and an expired login leave the upload in the journal, it is
+    // resumed on the next start
+    auto rejected = httpStatus != 0 && httpStatus < 500 && httpStatus != 401 && httpStatus != 403;
+    if(rejected && (!mUuid.isEmpty() || mQueued) && mClient->mJournal != nullptr && !mRefresh)
+        mClient->mJournal->append(JobJournal::Failed, mSha256, mPath, mUuid, mStarted);
+    detach();
+    emit failed(error, httpStatus);
+    deleteLater();
+}
+
+void AnalysisRequest::detach()
+{
+    stopWaiting();
+    // Requests for the same hash from now on start a new upload
+    auto itr = mClient->mAnalyses.find(mSha256);
+    if(itr != mClient->mAnalyses.end() && itr.value() == this)
+        mClient->mAnalyses.erase(itr);
+}
+
+QString MalcoreClient::parseUploadUuid(const QByteArray& response)
+{
+    auto root = QJsonDocument::fromJson(response).object();
+    QJsonObject data = root["data"].toObject();
+    QJsonObject data2 = data["data"].toObject();
+    return data2["uuid"].toString();
+}
+
+qint64 MalcoreClient::retryAfter(QNetworkReply* reply, qint64 defaultMs)
+{
+    // Retry-After is either a number of seconds or an HTTP date
+    auto value = reply->rawHeader("Retry-After").trimmed();
+    if(value.isEmpty())
+        return defaultMs;
+    bool ok = false;
+    auto seconds = value.toLongLong(&ok);
+    if(ok)
+        return qMax<qint64>(0, seconds * 1000);
+    auto date = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+    if(!date.isValid())
+        return defaultMs;
+    return qMax<qint64>(0, QDateTime::currentDateTimeUtc().msecsTo(date));
+}
+
+MalcoreClient::StatusResult MalcoreClient::parseStatus(const QByteArray& response)
+{
+    StatusResult result;
+    auto json = QJsonDocument::fromJson(response).object();
+    result.success = json["success"].toBool();
+    if(result.success)
+    {
+        result.data = json["data"].toObject();
+        result.pending = result.data["status"].toString() == "pending";
+    }
+    return result;
+}
+
+int MalcoreClient::httpStatus(QNetworkReply* reply)
+{
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+}
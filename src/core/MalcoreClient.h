@@ -0,0 +1,179 @@
+#pragma once
+
+#include <QObject>
+#include <QUrl>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QHash>
+
+#include <functional>
+#include <memory>
+
+#include "RateLimiter.h"
+#include "CircuitBreaker.h"
+
+class MalcoreClient;
+class JobJournal;
+class NotificationClient;
+
+// Upload of a file followed by polling until the report is ready, shared by every caller that asks
+// MalcoreClient::analyze() for the same content hash while it is in flight. All callers get the
+// same signals. The request deletes itself after finished() or failed(), do not keep the pointer.
+class AnalysisRequest : public QObject
+{
+    Q_OBJECT
+
+public:
+    QString sha256() const { return mSha256; }
+    QString path() const { return mPath; }
+    QString reportPath() const { return mReportPath; }
+    // Empty until uploaded() (callers that join later should check this)
+    QString uuid() const { return mUuid; }
+    int polls() const { return mPolls; }
+    // Of the downloaded report, send it to refresh the report later
+    QByteArray etag() const { return mEtag; }
+    // A refresh found the report unchanged, reportPath() was not rewritten
+    bool notModified() const { return mNotModified; }
+    qint64 started() const { return mStarted; }
+
+signals:
+    void uploadProgress(qint64 bytesSent, qint64 bytesTotal);
+    void uploaded(const QByteArray& response);
+    // The report is still pending
+    void polled(const QByteArray& response);
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    // The service is unreachable, the request waits until the circuit breaker closes
+    void offline();
+    // The /api/status response with the report was written to reportPath()
+    void finished(const QString& reportPath);
+    void failed(const QString& error, int httpStatus);
+
+private:
+    friend class MalcoreClient;
+
+    AnalysisRequest(MalcoreClient* client, const QString& sha256, const QString& path, const QString& reportPath, const QString& uuid, qint64 started);
+    void start();
+    void upload();
+    struct Download;
+    struct Poll;
+
+    void poll();
+    void sendPoll();
+    void sendAttempt(const std::shared_ptr<Poll>& poll);
+    void completePoll(QNetworkReply* reply, const std::shared_ptr<Download>& download, qint64 pollStart);
+    static qint64 hedgeDelay();
+    // Returns false if the request failed because the server kept refusing it
+    bool rateLimited(QNetworkReply* reply);
+    void raisePriority(RateLimiter::Priority priority);
+    // Returns true if the request waits for the service instead of being sent
+    bool waitForService();
+    // Returns true if the request is sent again after an outage
+    bool retryOutage(QNetworkReply* reply, bool timedOut);
+    void waitForPush();
+    void stopWaiting();
+    void finish();
+    void fail(const QString& error, int httpStatus);
+    void detach();
+
+    MalcoreClient* mClient = nullptr;
+    QString mSha256;
+    QString mPath;
+    QString mReportPath;
+    QString mUuid;
+    QByteArray mEtag;
+    int mPolls = 0;
+    bool mPolling = false; // waiting for the rate limiter or the status response
+    int mRateLimited = 0; // consecutive 429 responses
+    int mOutages = 0; // consecutive requests without an answer from the service
+    bool mQueued = false; // in the offline queue of the journal
+    RateLimiter::Priority mPriority = RateLimiter::Interactive;
+    bool mRefresh = false;
+    bool mNotModified = false;
+    QMetaObject::Connection mCompletedConnection; // waiting for a push, see waitForPush()
+    QMetaObject::Connection mInterruptedConnection;
+    QMetaObject::Connection mServiceConnection; // see waitForService()
+    qint64 mStarted = 0; // ms since epoch
+    qint64 mQueueStart = 0; // PerfTrace time the upload finished
+};
+
+// Thin wrapper around the Malcore REST API. The caller owns the returned replies and has to
+// deleteLater() them in the finished handler, like with QNetworkAccessManager.
+class MalcoreClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MalcoreClient(QObject* parent = nullptr);
+
+    static const char* DefaultBaseUrl;
+    // Qt 5.6 has no transfer timeout. A request is aborted if the server did not answer within
+    // ResponseTimeout or the transfer stalled for StallTimeout.
+    static const int ResponseTimeout = 30000;
+    static const int StallTimeout = 60000;
+
+    void setBaseUrl(const QUrl& baseUrl) { mBaseUrl = baseUrl; }
+    QUrl baseUrl() const { return mBaseUrl; }
+    void setApiKey(const QString& apiKey) { mApiKey = apiKey; }
+    QString apiKey() const { return mApiKey; }
+    // Created with the first request, it takes a while to set up
+    QNetworkAccessManager* http() const;
+    void setPollInterval(int ms) { mPollInterval = ms; }
+    int pollInterval() const { return mPollInterval; }
+    // Completion notifications, pending reports are only polled when they are not available
+    NotificationClient* notifications() const { return mNotifications; }
+    // Paces the uploads and status requests of analyze(), resume() and refresh()
+    RateLimiter* limiter() const { return mLimiter; }
+    // Opens when the service is down, analyze(), resume() and refresh() wait for it to close
+    CircuitBreaker* breaker() const { return mBreaker; }
+    // Record the uploads in flight, so they can be resumed after a restart
+    void setJournal(JobJournal* journal) { mJournal = journal; }
+
+    // Reference: https://malcore.readme.io/reference/upload
+    QNetworkReply* upload(const QString& path, QString* error = nullptr);
+    // Reference: https://malcore.readme.io/reference/status-check
+    QNetworkReply* status(const QString& uuid, const QString& apiKey = QString(), const QByteArray& etag = QByteArray());
+    QNetworkReply* login(const QString& email, const QString& password);
+    // Upload and poll, coalesced by sha256: while a request for the hash is in flight the same
+    // request is returned (the path passed first is uploaded). An empty sha256 is not coalesced.
+    // The report is streamed to reportPath as it downloads and renamed into place when complete.
+    // A request that is joined at a higher priority moves up in the rate limiter queue.
+    AnalysisRequest* analyze(const QString& sha256, const QString& path, const QString& reportPath, RateLimiter::Priority priority = RateLimiter::Interactive);
+    // Poll an upload from a previous session (see JobJournal), coalesced like analyze()
+    AnalysisRequest* resume(const QString& sha256, const QString& path, const QString& reportPath, const QString& uuid, qint64 started, RateLimiter::Priority priority = RateLimiter::Batch);
+    // Download the report of an earlier upload again if it changed since the download with etag,
+    // coalesced like analyze(). Nothing is uploaded and nothing is journaled.
+    AnalysisRequest* refresh(const QString& sha256, const QString& reportPath, const QString& uuid, const QByteArray& etag, RateLimiter::Priority priority = RateLimiter::Background);
+
+    struct StatusResult
+    {
+        bool success = false;
+        bool pending = false;
+        QJsonObject data;
+    };
+
+    static QString parseUploadUuid(const QByteArray& response);
+    static StatusResult parseStatus(const QByteArray& response);
+    static int httpStatus(QNetworkReply* reply);
+    // Delay requested by a 429 or 503 response in ms
+    static qint64 retryAfter(QNetworkReply* reply, qint64 defaultMs);
+
+private:
+    friend class AnalysisRequest;
+    friend class NotificationClient;
+
+    QNetworkRequest request(const char* endpoint, const QString& apiKey) const;
+    // Single-flight for analyze(), resume() and refresh(): returns the request in flight for
+    // sha256, or the one create() makes (started from the event loop)
+    AnalysisRequest* coalesce(const QString& sha256, RateLimiter::Priority priority, const std::function<AnalysisRequest*()>& create);
+
+    mutable QNetworkAccessManager* mHttp = nullptr;
+    NotificationClient* mNotifications = nullptr;
+    RateLimiter* mLimiter = nullptr;
+    CircuitBreaker* mBreaker = nullptr;
+    QUrl mBaseUrl;
+    QString mApiKey;
+    int mPollInterval = 300;
+    JobJournal* mJournal = nullptr;
+    QHash<QString, AnalysisRequest*> mAnalyses; // sha256 -> in-flight request
+};
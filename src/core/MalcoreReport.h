@@ -3,6 +3,14 @@
 #include <QString>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QStringList>
+#include <QUrl>
+
+#include <cstdint>
+#include <memory>
+
+#include "TraceStore.h"
+#include "SimilarityIndex.h"
 
 /*
 Requirements:
@@ -19,11 +27,13 @@ Requirements:
 */
 struct MalcoreAnalysis
 {
-    MalcoreAnalysis(QJsonObject root, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize)
+    // The trace is built from the report if it is not passed in (it has to use the same bases)
+    MalcoreAnalysis(QJsonObject root, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize, const TraceStore* trace = nullptr)
         : mData(std::move(root))
           , mLoadedBase(loadedBase)
           , mHeaderBase(headerBase)
           , mImageSize(imageSize)
+          , mTrace(trace)
     {
         open("head");
         open("style");
@@ -39,9 +49,27 @@ td {
         close("head");
     }
 
+    // Adjust an address from the report to the loaded module base if applicable
+    static uintptr_t rebase(uintptr_t value, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize)
+    {
+        if(value >= headerBase && value < headerBase + imageSize)
+        {
+            value -= headerBase;
+            value += loadedBase;
+        }
+        return value;
+    }
+
+    // Reports in the local cache that are similar to this one
+    void setLocalMatches(const QList<SimilarityIndex::Match>& matches)
+    {
+        mLocalMatches = matches;
+    }
+
     QString getReportHtml()
     {
         threatSummary();
+        localMatches();
         dynamicAnalysis();
         IOCs();
         yaraRule();
@@ -183,6 +211,45 @@ private:
         close("ul");
     }
 
+    void localMatches()
+    {
+        if(mLocalMatches.isEmpty())
+            return;
+
+        section("Similar Local Samples");
+        open("p");
+        open("table");
+
+        open("tr");
+        tag("td/u", "Score");
+        tag("td/u", "Module");
+        tag("td/u", "Imphash");
+        tag("td/u", "ssdeep");
+        tag("td/u", "Imports");
+        close("tr");
+
+        for(const auto& match : mLocalMatches)
+        {
+            open("tr");
+            tag("td/p", QString::number(match.score));
+
+            QUrl url;
+            url.setScheme("report");
+            url.setPath(QString(match.jsonPath).replace('\\', '/'));
+            open("td");
+            mReport += QString("<a href=\"%1\">%2</a>").arg(QString::fromUtf8(url.toEncoded()).toHtmlEscaped(), match.module.toHtmlEscaped());
+            close("td");
+
+            tag("td/p", match.imphash ? "match" : "-");
+            tag("td/p", match.ssdeep < 0 ? "-" : QString::number(match.ssdeep));
+            tag("td/p", match.imports < 0 ? "-" : QString("%1%").arg(qRound(match.imports * 100)));
+            close("tr");
+        }
+
+        close("table");
+        close("p");
+    }
+
     void dynamicAnalysis()
     {
         section("Dynamic Analysis");
@@ -196,14 +263,15 @@ private:
         tag("td/u", "Function");
         close("tr");
 
-        QJsonArray analysis = mData["dynamic_analysis"].toObject()["parsed_output"].toArray();
-        for(int i = 0; i < analysis.count(); i++)
+        std::unique_ptr<TraceStore> ownTrace;
+        if(mTrace == nullptr)
+            ownTrace = TraceStore::build(mData["dynamic_analysis"].toObject()["parsed_output"].toArray(), mLoadedBase, mHeaderBase, mImageSize);
+
+        const auto& trace = ownTrace ? *ownTrace : *mTrace;
+        for(int i = 0; i < trace.size(); i++)
         {
             open("tr");
 
-            QJsonObject entry = analysis[i].toObject();
-            auto location = entry["location"].toString();
-
             auto makeAddressLink = [this](const QString& str)
             {
                 // TODO: find all 0x prefixes and do this conversion
@@ -215,17 +283,10 @@ private:
                 }
                 else
                 {
-                    // Adjust the value to the loaded module base if applicable
-                    if(value >= mHeaderBase && value < mHeaderBase + mImageSize)
-                    {
-                        value -= mHeaderBase;
-                        value += mLoadedBase;
-                    }
-
-                    char hex[64]="";
-                    sprintf_s(hex, "0x%llX", value);
-                    QString result = "<a href=\"address://";
-                    result += hex;
+                    value = rebase(value, mLoadedBase, mHeaderBase, mImageSize);
+
+                    QString result = "<a href=\"address://0x";
+                    result += QString::number(qulonglong(value), 16).toUpper();
                     result += "\">";
                     result += str.toHtmlEscaped();
                     result += "</a>";
@@ -235,19 +296,31 @@ private:
 
             open("td");
             open("code");
-            mReport += makeAddressLink(location);
+            if(trace.address(i) == TraceStore::InvalidAddress)
+            {
+                mReport += trace.location(i).toHtmlEscaped();
+            }
+            else
+            {
+                // The link goes to the rebased address, the text is the one from the report
+                QString result = "<a href=\"address://0x";
+                result += QString::number(qulonglong(trace.address(i)), 16).toUpper();
+                result += "\">";
+                result += trace.location(i).toHtmlEscaped();
+                result += "</a>";
+                mReport += result;
+            }
             close("code");
             close("td");
 
-            auto dll = entry["dll_name"].toString();
-            tag("td/p", dll);
+            tag("td/p", trace.dll(i));
 
             open("td");
             open("code");
             QString summary = "";
 
-            auto function = entry["function_called"].toString();
-            auto suspicious = entry["known_suspicious_function"].toBool();
+            const auto& function = trace.function(i);
+            auto suspicious = trace.suspicious(i);
             if(suspicious)
             {
                 summary += "<span style=\"color: orange;\">";
@@ -261,21 +334,20 @@ private:
             }
             summary += "(";
 
-            auto arguments = entry["arguments_passed"].toArray();
-            for(int j = 0; j < arguments.count(); j++)
+            for(int j = 0; j < trace.argumentCount(i); j++)
             {
                 if(j > 0)
                 {
                     summary += ", ";
                 }
-                auto arg = arguments[j].toString();
+                auto arg = trace.argument(i, j);
                 //summary += makeAddressLink(arg);
                 summary += arg.toHtmlEscaped();
             }
             summary += ")";
 
-            auto result = entry["function_return_value"].toString();
-            if(!result.isEmpty() && result.toLower() != "none")
+            auto result = trace.returnValue(i);
+            if(!result.isEmpty())
             {
                 summary += " -> ";
                 summary += makeAddressLink(result);
@@ -299,4 +371,6 @@ private:
     uintptr_t mLoadedBase;
     uintptr_t mHeaderBase;
     uintptr_t mImageSize;
+    const TraceStore* mTrace;
+    QList<SimilarityIndex::Match> mLocalMatches;
 };
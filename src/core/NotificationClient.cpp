@@ -0,0 +1,187 @@
+#include "NotificationClient.h"
+#include "MalcoreClient.h"
+#include "PerfTrace.h"
+
+#include <QUrlQuery>
+#include <QStringList>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+
+// A failed stream is reopened with exponential backoff, requests poll once per failure meanwhile
+static const int MinRetryDelay = 1000;
+static const int MaxRetryDelay = 30000;
+
+NotificationClient::NotificationClient(MalcoreClient* client)
+    : QObject(client)
+    , mClient(client)
+{
+    mOpenTimer = new QTimer(this);
+    mOpenTimer->setSingleShot(true);
+    connect(mOpenTimer, &QTimer::timeout, this, &NotificationClient::open);
+}
+
+void NotificationClient::setEnabled(bool enabled)
+{
+    mEnabled = enabled;
+    if(!enabled && !mUuids.isEmpty())
+    {
+        mUuids.clear();
+        mOpenTimer->stop();
+        close();
+        emit interrupted();
+    }
+}
+
+bool NotificationClient::isAvailable() const
+{
+    return mEnabled && mClient->baseUrl() != mUnavailableUrl;
+}
+
+void NotificationClient::subscribe(const QString& uuid)
+{
+    if(uuid.isEmpty() || !isAvailable() || mUuids.contains(uuid))
+        return;
+
+    mUuids.insert(uuid);
+    if(mReply != nullptr)
+    {
+        // Reopen the stream with the new uuid, once for all subscriptions of this event loop
+        // iteration. The server sends the current state of every uuid when a stream opens.
+        if(!mStreamUuids.contains(uuid) && !mOpenTimer->isActive())
+            mOpenTimer->start(0);
+    }
+    else if(!mOpenTimer->isActive())
+    {
+        mOpenTimer->start(mRetryDelay);
+    }
+}
+
+void NotificationClient::unsubscribe(const QString& uuid)
+{
+    if(!mUuids.remove(uuid) || !mUuids.isEmpty())
+        return;
+
+    // Nothing to wait for, no idle connection
+    mOpenTimer->stop();
+    close();
+}
+
+void NotificationClient::open()
+{
+    close();
+    if(mUuids.isEmpty() || !isAvailable())
+        return;
+
+    auto uuids = mUuids.toList();
+    std::sort(uuids.begin(), uuids.end());
+    QUrlQuery query;
+    query.addQueryItem("uuids", uuids.join(','));
+
+    auto request = mClient->request("/api/events", mClient->apiKey());
+    auto url = request.url();
+    url.setQuery(query);
+    request.setUrl(url);
+    request.setRawHeader("Accept", "text/event-stream");
+    request.setRawHeader("Cache-Control", "no-cache");
+
+    mStreamUuids = mUuids;
+    mOpenStart = PerfTrace::now();
+    mReply = mClient->http()->get(request);
+    connect(mReply, &QNetworkReply::readyRead, this, &NotificationClient::readyRead);
+    connect(mReply, &QNetworkReply::finished, this, &NotificationClient::finished);
+}
+
+void NotificationClient::close()
+{
+    if(mReply == nullptr)
+        return;
+
+    auto reply = mReply;
+    mReply = nullptr;
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+    mStreamUuids.clear();
+    mBuffer.clear();
+    mData.clear();
+    mConnected = false;
+}
+
+void NotificationClient::readyRead()
+{
+    // Error responses are handled in finished()
+    if(MalcoreClient::httpStatus(mReply) != 200)
+        return;
+
+    if(!mConnected)
+    {
+        PerfTrace::record("api/events", mOpenStart, PerfTrace::now() - mOpenStart);
+        mConnected = true;
+        mRetryDelay = 0;
+    }
+
+    mBuffer += mReply->readAll();
+    QStringList completedUuids;
+    int start = 0;
+    for(;;)
+    {
+        auto end = mBuffer.indexOf('\n', start);
+        if(end == -1)
+            break;
+        auto line = mBuffer.mid(start, end - start);
+        start = end + 1;
+        if(line.endsWith('\r'))
+            line.chop(1);
+
+        // Only data fields are used, comments (keep-alives) and other fields are ignored
+        if(line.isEmpty())
+        {
+            auto event = QJsonDocument::fromJson(mData).object();
+            mData.clear();
+            auto uuid = event["uuid"].toString();
+            if(!uuid.isEmpty() && event["status"].toString() != "pending" && mUuids.contains(uuid))
+                completedUuids.append(uuid);
+        }
+        else if(line.startsWith("data:"))
+        {
+            auto value = line.mid(5);
+            if(value.startsWith(' '))
+                value.remove(0, 1);
+            if(!mData.isEmpty())
+                mData += '\n';
+            mData += value;
+        }
+    }
+    mBuffer.remove(0, start);
+
+    // The handlers unsubscribe, which might close the stream
+    for(const auto& uuid : completedUuids)
+        emit completed(uuid);
+}
+
+void NotificationClient::finished()
+{
+    auto reply = mReply;
+    mReply = nullptr;
+    reply->deleteLater();
+    mStreamUuids.clear();
+    mBuffer.clear();
+    mData.clear();
+
+    auto status = MalcoreClient::httpStatus(reply);
+    if(status == 404 || status == 405 || status == 501)
+    {
+        // The server does not push, poll until the base URL changes
+        mUnavailableUrl = mClient->baseUrl();
+        mUuids.clear();
+    }
+    else if(!mUuids.isEmpty())
+    {
+        mRetryDelay = mConnected ? MinRetryDelay : qBound(MinRetryDelay, mRetryDelay * 2, MaxRetryDelay);
+        mOpenTimer->start(mRetryDelay);
+    }
+    mConnected = false;
+    emit interrupted();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QObject>
+#include <QUrl>
+#include <QSet>
+#include <QTimer>
+#include <QNetworkReply>
+
+class MalcoreClient;
+
+// Server-sent events from /api/events that push the completion of uploads, so pending reports do
+// not have to be polled. One stream covers every subscribed uuid and is reopened when new ones are
+// added, it is closed when there is nothing to wait for. If the server does not offer the endpoint
+// push stays off for that base URL and the requests poll like before.
+class NotificationClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit NotificationClient(MalcoreClient* client);
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return mEnabled; }
+    // Enabled and not rejected by the current server
+    bool isAvailable() const;
+    void subscribe(const QString& uuid);
+    void unsubscribe(const QString& uuid);
+
+signals:
+    // The job is no longer pending (it might have failed, fetch its status)
+    void completed(const QString& uuid);
+    // Events might have been missed: the stream failed or push became unavailable
+    void interrupted();
+
+private:
+    void open();
+    void close();
+    void scheduleOpen(int delay);
+    void readyRead();
+    void finished();
+    void dispatch();
+
+    MalcoreClient* mClient = nullptr;
+    QNetworkReply* mReply = nullptr;
+    QTimer* mOpenTimer = nullptr;
+    QSet<QString> mUuids;
+    QSet<QString> mStreamUuids; // uuids the open stream was requested for
+    QUrl mUnavailableUrl;
+    QByteArray mBuffer;
+    QByteArray mData;
+    bool mEnabled = true;
+    bool mConnected = false;
+    int mRetryDelay = 0;
+    qint64 mOpenStart = 0; // PerfTrace time
+};
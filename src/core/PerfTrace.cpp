@@ -0,0 +1,212 @@
+#include "PerfTrace.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QHash>
+#include <QMap>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    const int BucketCount = 40; // 2^40 us is about 12 days
+    const int MaxEvents = 16384;
+
+    struct Event
+    {
+        const char* phase;
+        qint64 start;
+        qint64 duration;
+        int thread;
+    };
+
+    struct Histogram
+    {
+        Histogram() { memset(buckets, 0, sizeof(buckets)); }
+
+        qint64 count = 0;
+        qint64 total = 0;
+        qint64 min = 0;
+        qint64 max = 0;
+        qint64 buckets[BucketCount];
+    };
+
+    struct State
+    {
+        State() { clock.start(); }
+
+        QMutex mutex;
+        QElapsedTimer clock;
+        QMap<QByteArray, Histogram> histograms; // keys point to the phase literals
+        QVector<Event> events;
+        int nextEvent = 0;
+        QHash<Qt::HANDLE, int> threads;
+    };
+
+    State state;
+    std::atomic<Qt::HANDLE> watchedThread(nullptr);
+    std::atomic<const char*> watchedPhase(nullptr);
+
+    int bucketIndex(qint64 us)
+    {
+        int index = 0;
+        while(us > 1 && index < BucketCount - 1)
+        {
+            us >>= 1;
+            index++;
+        }
+        return index;
+    }
+}
+
+qint64 PerfTrace::now()
+{
+    return state.clock.nsecsElapsed() / 1000;
+}
+
+void PerfTrace::watchThread(Qt::HANDLE thread)
+{
+    watchedThread = thread;
+}
+
+const char* PerfTrace::activePhase()
+{
+    return watchedPhase;
+}
+
+PerfTrace::Scope::Scope(const char* phase)
+    : mPhase(phase)
+    , mParent(nullptr)
+    , mWatched(QThread::currentThreadId() == watchedThread)
+    , mStart(now())
+{
+    if(mWatched)
+        mParent = watchedPhase.exchange(phase);
+}
+
+PerfTrace::Scope::~Scope()
+{
+    record(mPhase, mStart, now() - mStart);
+    if(mWatched)
+        watchedPhase = mParent;
+}
+
+void PerfTrace::record(const char* phase, qint64 startUs, qint64 durationUs)
+{
+    QMutexLocker lock(&state.mutex);
+
+    auto& histogram = state.histograms[QByteArray::fromRawData(phase, int(qstrlen(phase)))];
+    if(histogram.count == 0 || durationUs < histogram.min)
+        histogram.min = durationUs;
+    if(durationUs > histogram.max)
+        histogram.max = durationUs;
+    histogram.count++;
+    histogram.total += durationUs;
+    histogram.buckets[bucketIndex(durationUs)]++;
+
+    auto thread = state.threads.value(QThread::currentThreadId(), -1);
+    if(thread == -1)
+    {
+        thread = state.threads.size() + 1;
+        state.threads.insert(QThread::currentThreadId(), thread);
+    }
+
+    Event event = { phase, startUs, durationUs, thread };
+    if(state.events.size() < MaxEvents)
+        state.events.append(event);
+    else
+        state.events[state.nextEvent] = event;
+    state.nextEvent = (state.nextEvent + 1) % MaxEvents;
+}
+
+qint64 PerfTrace::PhaseStats::percentile(double p) const
+{
+    if(count == 0)
+        return 0;
+    auto target = qint64(std::ceil(p * count));
+    qint64 seen = 0;
+    for(int i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if(seen >= target)
+            return qBound(minUs, (qint64(1) << (i + 1)) - 1, maxUs);
+    }
+    return maxUs;
+}
+
+static PerfTrace::PhaseStats toStats(const QByteArray& name, const Histogram& histogram)
+{
+    PerfTrace::PhaseStats phase;
+    phase.phase = QString::fromUtf8(name);
+    phase.count = histogram.count;
+    phase.totalUs = histogram.total;
+    phase.minUs = histogram.min;
+    phase.maxUs = histogram.max;
+    phase.buckets.resize(BucketCount);
+    for(int i = 0; i < BucketCount; i++)
+        phase.buckets[i] = histogram.buckets[i];
+    return phase;
+}
+
+QList<PerfTrace::PhaseStats> PerfTrace::stats()
+{
+    QMutexLocker lock(&state.mutex);
+    QList<PhaseStats> result;
+    for(auto itr = state.histograms.constBegin(); itr != state.histograms.constEnd(); ++itr)
+        result.append(toStats(itr.key(), itr.value()));
+    return result;
+}
+
+PerfTrace::PhaseStats PerfTrace::phaseStats(const char* phase)
+{
+    QMutexLocker lock(&state.mutex);
+    auto key = QByteArray::fromRawData(phase, int(qstrlen(phase)));
+    auto itr = state.histograms.constFind(key);
+    if(itr == state.histograms.constEnd())
+        return toStats(key, Histogram());
+    return toStats(itr.key(), itr.value());
+}
+
+QByteArray PerfTrace::chromeTrace()
+{
+    QJsonArray events;
+    {
+        QMutexLocker lock(&state.mutex);
+
+        // Oldest event first once the ring has wrapped
+        auto first = state.events.size() < MaxEvents ? 0 : state.nextEvent;
+        for(int i = 0; i < state.events.size(); i++)
+        {
+            const auto& event = state.events[(first + i) % state.events.size()];
+            QJsonObject json;
+            json["name"] = event.phase;
+            json["cat"] = "malcore";
+            json["ph"] = "X";
+            json["ts"] = double(event.start);
+            json["dur"] = double(event.duration);
+            json["pid"] = 1;
+            json["tid"] = event.thread;
+            events.append(json);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+void PerfTrace::reset()
+{
+    QMutexLocker lock(&state.mutex);
+    state.histograms.clear();
+    state.events.clear();
+    state.nextEvent = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+
+// Lightweight timing spans. Every finished span is added to a per-phase histogram (log2 buckets
+// in microseconds) and to a bounded ring of events that can be exported in the Chrome
+// trace-event format (chrome://tracing or https://ui.perfetto.dev).
+// Phase names must be string literals, only the pointer is kept.
+namespace PerfTrace
+{
+    // Microseconds since the process started tracing
+    qint64 now();
+    void record(const char* phase, qint64 startUs, qint64 durationUs);
+
+    // Scopes opened on the watched thread (the GUI thread) are tracked as the active phase,
+    // which the stall watchdog reads from its own thread.
+    void watchThread(Qt::HANDLE thread);
+    const char* activePhase();
+
+    // Records the lifetime of the object as a span
+    class Scope
+    {
+    public:
+        explicit Scope(const char* phase);
+        ~Scope();
+
+    private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        const char* mPhase;
+        const char* mParent;
+        bool mWatched;
+        qint64 mStart;
+    };
+
+    struct PhaseStats
+    {
+        QString phase;
+        qint64 count = 0;
+        qint64 totalUs = 0;
+        qint64 minUs = 0;
+        qint64 maxUs = 0;
+        QVector<qint64> buckets; // buckets[i] counts spans in [2^i, 2^(i+1)) us
+
+        // Estimated from the buckets (upper bound, clamped to min/max)
+        qint64 percentile(double p) const;
+    };
+
+    QList<PhaseStats> stats();
+    PhaseStats phaseStats(const char* phase);
+    QByteArray chromeTrace();
+    void reset();
+}
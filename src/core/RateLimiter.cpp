@@ -0,0 +1,111 @@
+#include "RateLimiter.h"
+
+#include <QList>
+
+#include <cmath>
+
+RateLimiter::RateLimiter(QObject* parent)
+    : QObject(parent)
+{
+    mTimer = new QTimer(this);
+    mTimer->setSingleShot(true);
+    connect(mTimer, &QTimer::timeout, this, &RateLimiter::dispatch);
+    mClock.start();
+}
+
+void RateLimiter::setRate(int perMinute, int burst)
+{
+    mPerMinute = qMax(0, perMinute);
+    mBurst = qMax(1, burst);
+    mTokens = mBurst;
+    mRefilled = mClock.elapsed();
+    dispatch();
+}
+
+void RateLimiter::acquire(Priority priority, QObject* context, const std::function<void()>& callback)
+{
+    Waiter waiter;
+    waiter.context = context;
+    waiter.callback = callback;
+    mQueue.insert(qMakePair(int(priority), mSequence++), waiter);
+    dispatch();
+}
+
+void RateLimiter::setPriority(QObject* context, Priority priority)
+{
+    QList<QPair<Key, Waiter>> moved;
+    for(auto itr = mQueue.begin(); itr != mQueue.end();)
+    {
+        if(itr->context == context && itr.key().first != int(priority))
+        {
+            moved.append(qMakePair(qMakePair(int(priority), itr.key().second), itr.value()));
+            itr = mQueue.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+    // Keep the original sequence, so it does not get ahead of older requests of the new priority
+    for(const auto& item : moved)
+        mQueue.insert(item.first, item.second);
+    if(!moved.isEmpty())
+        emit changed();
+}
+
+void RateLimiter::pause(qint64 ms)
+{
+    mPausedUntil = qMax(mPausedUntil, mClock.elapsed() + ms);
+    // Whatever burst was left is what got us limited
+    mTokens = qMin(mTokens, 0.0);
+    mTimer->start(int(qMax<qint64>(0, mPausedUntil - mClock.elapsed())));
+    emit changed();
+}
+
+qint64 RateLimiter::expectedWait() const
+{
+    auto now = mClock.elapsed();
+    auto wait = qMax<qint64>(0, mPausedUntil - now);
+    if(mPerMinute > 0)
+    {
+        auto missing = mQueue.size() - mTokens;
+        if(missing > 0)
+            wait += qint64(std::ceil(missing * 60000.0 / mPerMinute));
+    }
+    return wait;
+}
+
+void RateLimiter::refill()
+{
+    auto now = mClock.elapsed();
+    if(mPerMinute > 0)
+        mTokens = qMin(double(mBurst), mTokens + (now - mRefilled) * mPerMinute / 60000.0);
+    mRefilled = now;
+}
+
+void RateLimiter::dispatch()
+{
+    refill();
+    auto sent = false;
+    while(!mQueue.isEmpty() && mClock.elapsed() >= mPausedUntil && (mPerMinute == 0 || mTokens >= 1.0))
+    {
+        auto waiter = mQueue.take(mQueue.firstKey());
+        if(waiter.context.isNull())
+            continue;
+        if(mPerMinute > 0)
+            mTokens -= 1.0;
+        sent = true;
+        // The callback may acquire again (a retry), the queue is consistent at this point
+        waiter.callback();
+    }
+
+    if(!mQueue.isEmpty())
+    {
+        auto delay = qMax<qint64>(0, mPausedUntil - mClock.elapsed());
+        if(delay == 0 && mPerMinute > 0)
+            delay = qint64(std::ceil((1.0 - mTokens) * 60000.0 / mPerMinute));
+        mTimer->start(int(qMax<qint64>(1, delay)));
+    }
+    if(sent || !mQueue.isEmpty())
+        emit changed();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QObject>
+#include <QMap>
+#include <QPair>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <functional>
+
+// Token bucket shared by every API request of a MalcoreClient. Requests wait in priority order
+// (first come, first served within a priority) until a token is available, so bulk analysis is
+// spread out instead of spending the API quota in bursts. A 429 from the server pauses all requests
+// for its Retry-After. Not thread-safe, use it from the thread that owns the client.
+class RateLimiter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority
+    {
+        Interactive, // the main executable and modules the user selected
+        Batch, // modules queued in bulk (malcore upload all-user, resumed uploads)
+        Background, // report refreshes
+    };
+
+    explicit RateLimiter(QObject* parent = nullptr);
+
+    // perMinute 0 is unlimited, burst is the number of requests that can be sent at once
+    void setRate(int perMinute, int burst);
+    int rate() const { return mPerMinute; }
+    // Call callback once a request can be sent, dropped if context is destroyed first
+    void acquire(Priority priority, QObject* context, const std::function<void()>& callback);
+    // Move the waiting requests of context to another priority
+    void setPriority(QObject* context, Priority priority);
+    // The server asked to slow down, send nothing for ms
+    void pause(qint64 ms);
+
+    int queued() const { return mQueue.size(); }
+    // Until the last waiting request is sent
+    qint64 expectedWait() const;
+
+signals:
+    // The queue or the pause changed
+    void changed();
+
+private:
+    struct Waiter
+    {
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+    typedef QPair<int, quint64> Key; // priority, sequence
+
+    void refill();
+    void dispatch();
+
+    QMap<Key, Waiter> mQueue;
+    QTimer* mTimer = nullptr;
+    QElapsedTimer mClock;
+    quint64 mSequence = 0;
+    int mPerMinute = 0;
+    int mBurst = 1;
+    double mTokens = 0.0;
+    qint64 mRefilled = 0;
+    qint64 mPausedUntil = 0;
+};
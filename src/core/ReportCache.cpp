@@ -0,0 +1,696 @@
+#include "ReportCache.h"
+#include "PerfTrace.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRunnable>
+#include <QSet>
+#include <QVector>
+#include <QPair>
+#include <QCryptographicHash>
+
+#include <algorithm>
+#include <climits>
+
+static const quint32 IndexMagic = 0x5453524D; // "MRST"
+static const quint32 IndexVersion = 3;
+// Module names recorded per report (the same file copied around a lot)
+static const int MaxModules = 8;
+// Module hashes remembered across sessions
+static const int MaxFileHashes = 4096;
+// The metadata lock is only held to read or write reports.idx
+static const int IndexLockTimeout = 5000;
+// Give up waiting for another instance that is hashing the same file (it might be huge)
+static const int HashLockTimeout = 60000;
+
+class CompactTask : public QRunnable
+{
+public:
+    explicit CompactTask(ReportCache* cache)
+        : mCache(cache)
+    {
+    }
+
+    void run() override
+    {
+        mCache->compact();
+    }
+
+private:
+    ReportCache* mCache;
+};
+
+class FileHashTask : public QRunnable
+{
+public:
+    FileHashTask(ReportCache* cache, const QString& path)
+        : mCache(cache), mPath(path)
+    {
+    }
+
+    void run() override
+    {
+        auto sha256 = mCache->mStop ? QString() : mCache->fileHash(mPath);
+        {
+            QMutexLocker lock(&mCache->mLock);
+            mCache->mHashing.remove(ReportCache::nativePath(mPath));
+        }
+        emit mCache->fileHashed(mPath, sha256);
+    }
+
+private:
+    ReportCache* mCache;
+    QString mPath;
+};
+
+static bool isSha256(const QString& str)
+{
+    if(str.size() != 64)
+        return false;
+    for(auto ch : str)
+    {
+        if(!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f')))
+            return false;
+    }
+    return true;
+}
+
+static void addModule(QStringList& modules, const QString& modulePath)
+{
+    if(modulePath.isEmpty())
+        return;
+    auto name = QFileInfo(modulePath).baseName();
+    if(modules.size() < MaxModules && !modules.contains(name, Qt::CaseInsensitive))
+        modules.append(name);
+}
+
+ReportCache::ReportCache(const QString& directory, QObject* parent)
+    : QObject(parent)
+    , mLegacyDirectory(directory)
+    , mDirectory(QDir(directory).filePath("reports"))
+    , mIndexPath(QDir(mDirectory).filePath("reports.idx"))
+    , mLockPath(QDir(mDirectory).filePath("reports.lock"))
+    , mCompactQueued(false)
+    , mStop(false)
+{
+    QDir(mDirectory).mkpath(".");
+    mPool.setMaxThreadCount(1);
+    mHashPool.setMaxThreadCount(1);
+}
+
+ReportCache::~ReportCache()
+{
+    mStop = true;
+    mHashPool.clear();
+    mHashPool.waitForDone();
+    mPool.waitForDone();
+    bool dirty = false;
+    {
+        QMutexLocker lock(&mLock);
+        dirty = mDirty;
+    }
+    if(dirty)
+        save();
+}
+
+QString ReportCache::jsonPath(const QString& sha256) const
+{
+    return QDir(mDirectory).filePath(sha256.toLower() + ".json");
+}
+
+QString ReportCache::hashFromPath(const QString& path)
+{
+    auto name = QFileInfo(path).completeBaseName().toLower();
+    return isSha256(name) ? name : QString();
+}
+
+bool ReportCache::store(const QString& path, const QByteArray& data, const QString& modulePath)
+{
+    {
+        // Another instance never sees a partially written report
+        QSaveFile f(path);
+        if(!f.open(QIODevice::WriteOnly) || f.write(data) != data.size() || !f.commit())
+            return false;
+    }
+    return add(path, modulePath);
+}
+
+bool ReportCache::add(const QString& path, const QString& modulePath, const QString& uuid, const QByteArray& etag)
+{
+    auto sha256 = hashFromPath(path);
+    if(sha256.isEmpty())
+        return QFile::exists(path);
+
+    bool overQuota = false;
+    {
+        QMutexLocker lock(&mLock);
+        auto& entry = mEntries[sha256];
+        entry.lastAccess = QDateTime::currentMSecsSinceEpoch();
+        addModule(entry.modules, modulePath);
+        if(!uuid.isEmpty())
+        {
+            entry.uuid = uuid;
+            entry.etag = etag;
+            entry.fetched = entry.lastAccess;
+        }
+        updateSizeLocked(sha256, entry);
+        mDirty = true;
+        overQuota = mQuota > 0 && mTotalSize > mQuota;
+    }
+    if(overQuota)
+        compactAsync();
+    return true;
+}
+
+bool ReportCache::touch(const QString& jsonPath, const QString& modulePath)
+{
+    auto sha256 = hashFromPath(jsonPath);
+    if(sha256.isEmpty())
+        return false;
+
+    QMutexLocker lock(&mLock);
+    auto itr = mEntries.find(sha256);
+    if(!QFile::exists(jsonPath))
+    {
+        if(itr != mEntries.end())
+            removeLocked(sha256);
+        return false;
+    }
+    if(itr == mEntries.end())
+    {
+        // Written before the metadata was saved
+        itr = mEntries.insert(sha256, Entry());
+        updateSizeLocked(sha256, itr.value());
+    }
+    itr->lastAccess = QDateTime::currentMSecsSinceEpoch();
+    addModule(itr->modules, modulePath);
+    mDirty = true;
+    return true;
+}
+
+bool ReportCache::setFetched(const QString& jsonPath, const QByteArray& etag)
+{
+    auto sha256 = hashFromPath(jsonPath);
+    if(sha256.isEmpty())
+        return false;
+
+    QMutexLocker lock(&mLock);
+    auto itr = mEntries.find(sha256);
+    if(itr == mEntries.end())
+        return false;
+    // Not an access, a background refresh does not keep a report from being evicted
+    if(!etag.isEmpty())
+        itr->etag = etag;
+    itr->fetched = QDateTime::currentMSecsSinceEpoch();
+    updateSizeLocked(sha256, itr.value());
+    mDirty = true;
+    return true;
+}
+
+ReportCache::Origin ReportCache::origin(const QString& jsonPath) const
+{
+    Origin origin;
+    auto sha256 = hashFromPath(jsonPath);
+    QMutexLocker lock(&mLock);
+    auto itr = mEntries.constFind(sha256);
+    if(itr != mEntries.constEnd())
+    {
+        origin.uuid = itr->uuid;
+        origin.etag = itr->etag;
+        origin.fetched = itr->fetched;
+    }
+    return origin;
+}
+
+QStringList ReportCache::staleReports(qint64 maxAge) const
+{
+    // Reports cached before the uuid was recorded cannot be refreshed
+    auto before = QDateTime::currentMSecsSinceEpoch() - maxAge;
+    QVector<QPair<qint64, QString>> stale;
+    {
+        QMutexLocker lock(&mLock);
+        for(auto itr = mEntries.constBegin(); itr != mEntries.constEnd(); ++itr)
+            if(!itr->uuid.isEmpty() && itr->fetched < before)
+                stale.append(qMakePair(itr->fetched, itr.key()));
+    }
+
+    // Oldest first
+    std::sort(stale.begin(), stale.end());
+    QStringList jsonPaths;
+    for(const auto& item : stale)
+        jsonPaths.append(jsonPath(item.second));
+    return jsonPaths;
+}
+
+QString ReportCache::moduleName(const QString& jsonPath) const
+{
+    auto sha256 = hashFromPath(jsonPath);
+    if(sha256.isEmpty())
+        return QFileInfo(jsonPath).completeBaseName();
+
+    QMutexLocker lock(&mLock);
+    auto itr = mEntries.constFind(sha256);
+    if(itr != mEntries.constEnd() && !itr->modules.isEmpty())
+        return itr->modules.first();
+    return sha256.left(12);
+}
+
+QString ReportCache::fileHash(const QString& path)
+{
+    QFileInfo info(path);
+    if(!info.exists())
+        return QString();
+
+    auto key = nativePath(path);
+    auto size = info.size();
+    auto modified = info.lastModified().toMSecsSinceEpoch();
+    auto lookup = [&]()
+    {
+        QMutexLocker lock(&mLock);
+        return lookupFileHashLocked(key, size, modified);
+    };
+
+    auto sha256 = lookup();
+    if(!sha256.isEmpty())
+        return sha256;
+
+    // Wait for another instance that is hashing the same file, it publishes the result in the
+    // metadata before releasing the lock (hash it ourselves if it takes too long)
+    auto lockName = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Md5).toHex().left(16);
+    QLockFile hashLock(QDir(mDirectory).filePath(QString("hash-%1.lock").arg(QString::fromUtf8(lockName))));
+    hashLock.tryLock(HashLockTimeout);
+    reload();
+    sha256 = lookup();
+    if(!sha256.isEmpty())
+        return sha256;
+
+    sha256 = hashFile(path);
+    if(sha256.isEmpty())
+        return QString();
+    {
+        QMutexLocker lock(&mLock);
+        auto& fileHash = mFileHashes[key];
+        fileHash.size = size;
+        fileHash.modified = modified;
+        fileHash.sha256 = sha256;
+        fileHash.used = QDateTime::currentMSecsSinceEpoch();
+        mDirty = true;
+    }
+    save();
+    return sha256;
+}
+
+QString ReportCache::knownFileHash(const QString& path)
+{
+    QFileInfo info(path);
+    if(!info.exists())
+        return QString();
+    QMutexLocker lock(&mLock);
+    return lookupFileHashLocked(nativePath(path), info.size(), info.lastModified().toMSecsSinceEpoch());
+}
+
+QString ReportCache::lookupFileHashLocked(const QString& key, qint64 size, qint64 modified)
+{
+    auto itr = mFileHashes.find(key);
+    if(itr == mFileHashes.end() || itr->size != size || itr->modified != modified)
+        return QString();
+    itr->used = QDateTime::currentMSecsSinceEpoch();
+    return itr->sha256;
+}
+
+void ReportCache::fileHashAsync(const QString& path)
+{
+    {
+        QMutexLocker lock(&mLock);
+        auto key = nativePath(path);
+        if(mHashing.contains(key))
+            return;
+        mHashing.insert(key);
+    }
+    mHashPool.start(new FileHashTask(this, path));
+}
+
+std::unique_ptr<QLockFile> ReportCache::lockUpload(const QString& jsonPath) const
+{
+    std::unique_ptr<QLockFile> uploadLock(new QLockFile(jsonPath + ".lock"));
+    // Uploads can take minutes, the lock of a crashed instance is detected by its process id
+    uploadLock->setStaleLockTime(0);
+    if(!uploadLock->tryLock(0))
+        return nullptr;
+    return uploadLock;
+}
+
+void ReportCache::reload()
+{
+    QLockFile indexLock(mLockPath);
+    indexLock.tryLock(IndexLockTimeout);
+    QMutexLocker lock(&mLock);
+    readIndexLocked();
+}
+
+void ReportCache::setQuota(qint64 bytes)
+{
+    bool overQuota = false;
+    {
+        QMutexLocker lock(&mLock);
+        mQuota = bytes;
+        overQuota = mQuota > 0 && mTotalSize > mQuota;
+    }
+    if(overQuota)
+        compactAsync();
+}
+
+qint64 ReportCache::quota() const
+{
+    QMutexLocker lock(&mLock);
+    return mQuota;
+}
+
+qint64 ReportCache::totalSize() const
+{
+    QMutexLocker lock(&mLock);
+    return mTotalSize;
+}
+
+void ReportCache::compactAsync()
+{
+    if(mCompactQueued.exchange(true))
+        return;
+    mPool.start(new CompactTask(this));
+}
+
+void ReportCache::updateSizeLocked(const QString& sha256, Entry& entry)
+{
+    auto json = jsonPath(sha256);
+    auto size = QFileInfo(json).size() + QFileInfo(htmlPath(json)).size();
+    mTotalSize += size - entry.size;
+    entry.size = size;
+}
+
+void ReportCache::removeLocked(const QString& sha256)
+{
+    auto itr = mEntries.find(sha256);
+    if(itr == mEntries.end())
+        return;
+    mTotalSize -= itr->size;
+    mEntries.erase(itr);
+    auto json = jsonPath(sha256);
+    QFile::remove(json);
+    QFile::remove(htmlPath(json));
+    mDirty = true;
+}
+
+void ReportCache::migrateLegacy()
+{
+    auto files = QDir(mLegacyDirectory).entryInfoList(QStringList() << "report-*.json", QDir::Files);
+    for(const auto& file : files)
+    {
+        if(mStop)
+            return;
+
+        // The legacy name is report-<module>-<sha1>.json, the report has the SHA-256
+        auto data = readReport(file.filePath());
+        auto sha256 = data["hashes"].toObject()["sha256"].toString().toLower();
+        if(!isSha256(sha256))
+            continue;
+
+        auto legacyHtml = htmlPath(file.filePath());
+        auto json = jsonPath(sha256);
+        if(QFile::exists(json))
+            QFile::remove(file.filePath());
+        else if(!QFile::rename(file.filePath(), json))
+            continue;
+        if(QFile::exists(htmlPath(json)) || !QFile::rename(legacyHtml, htmlPath(json)))
+            QFile::remove(legacyHtml);
+
+        auto module = file.completeBaseName().mid(7);
+        module.truncate(module.lastIndexOf('-'));
+
+        QMutexLocker lock(&mLock);
+        auto& entry = mEntries[sha256];
+        addModule(entry.modules, module);
+        entry.lastAccess = std::max(entry.lastAccess, file.lastModified().toMSecsSinceEpoch());
+        updateSizeLocked(sha256, entry);
+        mDirty = true;
+    }
+}
+
+void ReportCache::compact()
+{
+    mCompactQueued = false;
+    // Evict by the access times of all instances
+    reload();
+    migrateLegacy();
+
+    // Reconcile the metadata with the directory (reports deleted by hand, metadata not saved)
+    QSet<QString> reports;
+    QStringList orphans;
+    auto files = QDir(mDirectory).entryInfoList(QStringList() << "*.json" << "*.html", QDir::Files);
+    for(const auto& file : files)
+    {
+        auto sha256 = hashFromPath(file.fileName());
+        if(!sha256.isEmpty() && file.suffix() == "json")
+            reports.insert(sha256);
+    }
+    for(const auto& file : files)
+    {
+        auto sha256 = hashFromPath(file.fileName());
+        if(!sha256.isEmpty() && file.suffix() == "html" && !reports.contains(sha256))
+            orphans.append(file.filePath());
+    }
+    for(const auto& orphan : orphans)
+        QFile::remove(orphan);
+
+    int evicted = 0;
+    qint64 freed = 0;
+    {
+        QMutexLocker lock(&mLock);
+        for(auto itr = mEntries.begin(); itr != mEntries.end();)
+        {
+            if(reports.contains(itr.key()))
+            {
+                ++itr;
+                continue;
+            }
+            mTotalSize -= itr->size;
+            itr = mEntries.erase(itr);
+            mDirty = true;
+        }
+        for(const auto& sha256 : reports)
+        {
+            if(mEntries.contains(sha256))
+                continue;
+            Entry entry;
+            entry.lastAccess = QFileInfo(jsonPath(sha256)).lastModified().toMSecsSinceEpoch();
+            updateSizeLocked(sha256, entry);
+            mEntries.insert(sha256, entry);
+            mDirty = true;
+        }
+
+        // Evict the least recently used reports, to 90% of the quota so the next few stores do
+        // not trigger another compaction
+        if(mQuota > 0 && mTotalSize > mQuota)
+        {
+            QVector<QPair<qint64, QString>> order;
+            order.reserve(mEntries.size());
+            for(auto itr = mEntries.constBegin(); itr != mEntries.constEnd(); ++itr)
+                order.append(qMakePair(itr->lastAccess, itr.key()));
+            std::sort(order.begin(), order.end());
+
+            auto target = mQuota - mQuota / 10;
+            for(const auto& item : order)
+            {
+                if(mTotalSize <= target || mStop)
+                    break;
+                freed += mEntries[item.second].size;
+                removeLocked(item.second);
+                evicted++;
+            }
+        }
+    }
+
+    save();
+    emit compactFinished(evicted, freed);
+}
+
+bool ReportCache::readIndexLocked()
+{
+    // NOTE: mLock has to be held
+    QFile f(mIndexPath);
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0, count = 0;
+    stream >> magic >> version >> count;
+    if(magic != IndexMagic || version < 1 || version > IndexVersion)
+        return false;
+
+    QHash<QString, Entry> entries;
+    for(quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++)
+    {
+        QString sha256;
+        Entry entry;
+        stream >> sha256 >> entry.modules >> entry.size >> entry.lastAccess;
+        if(version >= 3)
+            stream >> entry.uuid >> entry.etag >> entry.fetched;
+        entries.insert(sha256, entry);
+    }
+
+    QHash<QString, FileHash> fileHashes;
+    if(version >= 2)
+    {
+        stream >> count;
+        for(quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++)
+        {
+            QString path;
+            FileHash fileHash;
+            stream >> path >> fileHash.size >> fileHash.modified >> fileHash.sha256 >> fileHash.used;
+            fileHashes.insert(path, fileHash);
+        }
+    }
+
+    // Damaged metadata is rebuilt from the directory by the compaction
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    // Merge with what this instance knows
+    for(auto itr = entries.constBegin(); itr != entries.constEnd(); ++itr)
+    {
+        auto existing = mEntries.find(itr.key());
+        if(existing == mEntries.end())
+        {
+            // Reports this instance evicted are still listed by the others until they reload
+            if(!QFile::exists(jsonPath(itr.key())))
+                continue;
+            mEntries.insert(itr.key(), itr.value());
+            mTotalSize += itr->size;
+            continue;
+        }
+        existing->lastAccess = std::max(existing->lastAccess, itr->lastAccess);
+        for(const auto& module : itr->modules)
+            addModule(existing->modules, module);
+        if(itr->fetched > existing->fetched)
+        {
+            existing->uuid = itr->uuid;
+            existing->etag = itr->etag;
+            existing->fetched = itr->fetched;
+        }
+    }
+    // Reports another instance evicted, saving them would list them again
+    for(auto itr = mEntries.begin(); itr != mEntries.end();)
+    {
+        if(entries.contains(itr.key()) || QFile::exists(jsonPath(itr.key())))
+        {
+            ++itr;
+            continue;
+        }
+        mTotalSize -= itr->size;
+        itr = mEntries.erase(itr);
+    }
+    for(auto itr = fileHashes.constBegin(); itr != fileHashes.constEnd(); ++itr)
+    {
+        auto existing = mFileHashes.constFind(itr.key());
+        if(existing == mFileHashes.constEnd() || existing->used < itr->used)
+            mFileHashes.insert(itr.key(), itr.value());
+    }
+    return true;
+}
+
+bool ReportCache::save()
+{
+    // Merge the changes of the other instances, the lock makes the read-modify-write atomic
+    QLockFile indexLock(mLockPath);
+    if(!indexLock.tryLock(IndexLockTimeout))
+        return false;
+
+    QMutexLocker lock(&mLock);
+    readIndexLocked();
+
+    if(mFileHashes.size() > MaxFileHashes)
+    {
+        QVector<QPair<qint64, QString>> order;
+        for(auto itr = mFileHashes.constBegin(); itr != mFileHashes.constEnd(); ++itr)
+            order.append(qMakePair(itr->used, itr.key()));
+        std::sort(order.begin(), order.end());
+        for(int i = 0; i < order.size() - MaxFileHashes; i++)
+            mFileHashes.remove(order[i].second);
+    }
+
+    QSaveFile f(mIndexPath);
+    if(!f.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << IndexMagic << IndexVersion << quint32(mEntries.size());
+    for(auto itr = mEntries.constBegin(); itr != mEntries.constEnd(); ++itr)
+        stream << itr.key() << itr->modules << itr->size << itr->lastAccess << itr->uuid << itr->etag << itr->fetched;
+    stream << quint32(mFileHashes.size());
+    for(auto itr = mFileHashes.constBegin(); itr != mFileHashes.constEnd(); ++itr)
+        stream << itr.key() << itr->size << itr->modified << itr->sha256 << itr->used;
+
+    if(stream.status() != QDataStream::Ok || !f.commit())
+        return false;
+    mDirty = false;
+    return true;
+}
+
+QJsonObject ReportCache::readReport(const QString& jsonPath)
+{
+    QFile f(jsonPath);
+    if(!f.open(QIODevice::ReadOnly))
+        return QJsonObject();
+
+    // Parse straight from the mapped file instead of a copy of it in memory
+    QJsonDocument document;
+    auto size = f.size();
+    auto data = size > 0 && size < INT_MAX ? f.map(0, size) : nullptr;
+    if(data != nullptr)
+    {
+        document = QJsonDocument::fromJson(QByteArray::fromRawData((const char*)data, int(size)));
+        f.unmap(data);
+    }
+    else
+    {
+        document = QJsonDocument::fromJson(f.readAll());
+    }
+    return document.object()["data"].toObject();
+}
+
+QString ReportCache::htmlPath(const QString& jsonPath)
+{
+    auto htmlPath = jsonPath;
+    auto periodIdx = htmlPath.lastIndexOf('.');
+    if(periodIdx != -1)
+        htmlPath.resize(periodIdx);
+    htmlPath += ".html";
+    return htmlPath;
+}
+
+QString ReportCache::nativePath(const QString& path)
+{
+    return QDir::toNativeSeparators(QFileInfo(path).absoluteFilePath());
+}
+
+QString ReportCache::hashFile(const QString& path)
+{
+    PerfTrace::Scope scope("hash");
+
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly))
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if(!hash.addData(&f))
+        return QString();
+
+    return QString::fromUtf8(hash.result().toHex());
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+#include <QLockFile>
+#include <QJsonObject>
+
+#include <atomic>
+#include <memory>
+
+// Content-addressed report store: reports are kept as reports/<sha256>.json (and the rendered
+// .html) keyed by the SHA-256 of the analyzed file, so the same binary loaded under another name
+// shares one report. The module names, sizes and last access times are metadata in
+// reports/reports.idx. When the store grows past its quota a background compaction evicts the
+// least recently used reports. All methods are thread-safe.
+//
+// The directory is shared by every debugger instance (x32dbg and x64dbg). Files are written to a
+// temporary file and renamed into place, the metadata is merged with the version on disk under a
+// lock file, and lock files next to the reports make sure only one instance hashes or uploads a
+// file while the others wait for the result.
+class ReportCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Does not read the metadata, call reload() or compactAsync() (which reloads first)
+    explicit ReportCache(const QString& directory, QObject* parent = nullptr);
+    ~ReportCache();
+
+    // Directory that holds the reports (a subdirectory of the one passed to the constructor)
+    QString directory() const { return mDirectory; }
+    QString jsonPath(const QString& sha256) const;
+    // Write a report or its .html, modulePath is recorded as metadata
+    bool store(const QString& path, const QByteArray& data, const QString& modulePath = QString());
+    // Record a report that was written in place (see MalcoreClient::analyze), with the uuid and
+    // ETag it was downloaded with to refresh it later
+    bool add(const QString& path, const QString& modulePath = QString(), const QString& uuid = QString(), const QByteArray& etag = QByteArray());
+    // Record a refresh of the report (rewritten, confirmed unchanged or failed), an empty etag
+    // keeps the previous one
+    bool setFetched(const QString& jsonPath, const QByteArray& etag);
+    // Record an access for the LRU eviction, returns false if the report is not in the store
+    bool touch(const QString& jsonPath, const QString& modulePath = QString());
+    // Name of the first module the report was stored for, or the shortened hash
+    QString moduleName(const QString& jsonPath) const;
+
+    // Where a report was downloaded from, an empty uuid if it is unknown
+    struct Origin
+    {
+        QString uuid;
+        QByteArray etag;
+        qint64 fetched = 0; // ms since epoch
+    };
+    Origin origin(const QString& jsonPath) const;
+    // Reports with a known uuid that were not downloaded or refreshed for maxAge ms, oldest first
+    QStringList staleReports(qint64 maxAge) const;
+
+    // SHA-256 of a module. Files that any instance hashed before (same path, size and modification
+    // time) are not hashed again, and only one instance hashes a file at a time.
+    QString fileHash(const QString& path);
+    // Without hashing or waiting for another instance (for the GUI thread), empty if not known yet
+    QString knownFileHash(const QString& path);
+    // fileHash() on a background thread, emits fileHashed(). A file that is being hashed already
+    // is not queued again.
+    void fileHashAsync(const QString& path);
+    // Single-flight for an upload, held until the report is stored. Returns nullptr if another
+    // instance (or job) is uploading the file already: wait for its report with touch() and try
+    // again, in case it gave up. Check touch() again after acquiring the lock.
+    std::unique_ptr<QLockFile> lockUpload(const QString& jsonPath) const;
+    // Merge the metadata written by other instances
+    void reload();
+
+    // Size limit in bytes, 0 is unlimited
+    void setQuota(qint64 bytes);
+    qint64 quota() const;
+    qint64 totalSize() const;
+    // Migrate legacy report-<module>-<sha1>.json files, pick up or drop files that do not match
+    // the metadata and evict the least recently used reports until the store fits the quota
+    void compactAsync();
+    bool save();
+
+    static QString htmlPath(const QString& jsonPath);
+    // The SHA-256 a report path is named after, empty if it is not in the store format
+    static QString hashFromPath(const QString& path);
+    // The "data" object of a stored report, empty if it cannot be read
+    static QJsonObject readReport(const QString& jsonPath);
+    // Absolute path with native separators, to compare report paths
+    static QString nativePath(const QString& path);
+    // SHA-256 of the file (without the shared cache), returns an empty string on failure
+    static QString hashFile(const QString& path);
+
+signals:
+    void compactFinished(int evicted, qint64 freedBytes);
+    // sha256 is empty if the file could not be hashed
+    void fileHashed(const QString& path, const QString& sha256);
+
+private:
+    friend class CompactTask;
+    friend class FileHashTask;
+
+    struct Entry
+    {
+        QStringList modules;
+        qint64 size = 0; // .json + .html
+        qint64 lastAccess = 0; // ms since epoch
+        QString uuid;
+        QByteArray etag;
+        qint64 fetched = 0; // ms since epoch
+    };
+
+    struct FileHash
+    {
+        qint64 size = 0;
+        qint64 modified = 0;
+        QString sha256;
+        qint64 used = 0;
+    };
+
+    // NOTE: mLock has to be held
+    QString lookupFileHashLocked(const QString& key, qint64 size, qint64 modified);
+    void compact();
+    void migrateLegacy();
+    bool readIndexLocked();
+    void updateSizeLocked(const QString& sha256, Entry& entry);
+    void removeLocked(const QString& sha256);
+
+    QString mLegacyDirectory;
+    QString mDirectory;
+    QString mIndexPath;
+    QString mLockPath;
+    mutable QMutex mLock;
+    QHash<QString, Entry> mEntries; // sha256 -> metadata
+    QHash<QString, FileHash> mFileHashes; // native module path -> hash
+    QSet<QString> mHashing; // native module paths queued by fileHashAsync()
+    qint64 mTotalSize = 0;
+    qint64 mQuota = 0;
+    bool mDirty = false;
+    QThreadPool mPool;
+    QThreadPool mHashPool; // fileHashAsync(), a compaction does not hold it up
+    std::atomic<bool> mCompactQueued;
+    std::atomic<bool> mStop;
+};
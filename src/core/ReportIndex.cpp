@@ -0,0 +1,172 @@
+#include "ReportIndex.h"
+#include "MalcoreReport.h"
+
+#include <QJsonArray>
+#include <QStringList>
+#include <QMap>
+
+#include <algorithm>
+
+static Snapshot<ReportIndex> currentIndex;
+
+static bool parseAddress(const QString& str, uint64_t& value)
+{
+    // Arguments can look like "0x1211f48->0x0" (pointer -> pointed-to value)
+    auto arrow = str.indexOf("->");
+    bool ok = false;
+    value = (arrow == -1 ? str : str.left(arrow)).toULongLong(&ok, 0);
+    return ok;
+}
+
+static QByteArray truncateUtf8(QByteArray utf8, int maxLength)
+{
+    if(utf8.size() <= maxLength)
+        return utf8;
+
+    // Do not cut a multi-byte sequence in half
+    int length = maxLength;
+    while(length > 0 && (uchar(utf8[length]) & 0xC0) == 0x80)
+        length--;
+    utf8.truncate(length);
+    return utf8;
+}
+
+std::unique_ptr<ReportIndex> ReportIndex::build(const TraceStore& trace, const QJsonObject& data)
+{
+    auto loadedBase = trace.loadedBase();
+    auto headerBase = trace.headerBase();
+    auto imageSize = trace.imageSize();
+
+    struct Site
+    {
+        QString summary;
+        uint32_t calls = 0;
+        uint32_t flags = 0;
+        QString ioc;
+    };
+    QMap<uint64_t, Site> sites;
+
+    QJsonObject summary = data["threat_summary"].toObject()["results"].toObject();
+    QStringList iocs;
+    for(const auto& ioc : summary["iocs"].toObject()["strings"].toArray())
+    {
+        auto str = ioc.toString();
+        if(!str.isEmpty())
+            iocs.append(str);
+    }
+    auto findIoc = [&iocs](const QString& str)
+    {
+        for(const auto& ioc : iocs)
+            if(str.contains(ioc))
+                return ioc;
+        return QString();
+    };
+
+    for(int i = 0; i < trace.size(); i++)
+    {
+        auto location = trace.address(i);
+        if(location == TraceStore::InvalidAddress)
+            continue;
+
+        auto api = QString("%1.%2").arg(trace.dll(i), trace.function(i));
+        auto argumentCount = trace.argumentCount(i);
+
+        auto& site = sites[location];
+        site.flags |= FlagCallSite;
+        if(trace.suspicious(i))
+            site.flags |= FlagSuspicious;
+        if(site.calls++ == 0)
+        {
+            site.summary = api + "(";
+            for(int j = 0; j < argumentCount; j++)
+            {
+                if(j > 0)
+                    site.summary += ", ";
+                site.summary += trace.argument(i, j);
+            }
+            site.summary += ")";
+            auto result = trace.returnValue(i);
+            if(!result.isEmpty())
+                site.summary += " -> " + result;
+        }
+
+        for(int j = 0; j < argumentCount; j++)
+        {
+            auto arg = trace.argument(i, j);
+            if(site.ioc.isEmpty())
+            {
+                site.ioc = findIoc(arg);
+                if(!site.ioc.isEmpty())
+                    site.flags |= FlagIoc;
+            }
+
+            // Pointers into the module show up in the dump view
+            uint64_t pointer = 0;
+            if(imageSize == 0 || !parseAddress(arg, pointer))
+                continue;
+            pointer = MalcoreAnalysis::rebase(pointer, loadedBase, headerBase, imageSize);
+            if(pointer < loadedBase || pointer >= loadedBase + imageSize)
+                continue;
+            auto& target = sites[pointer];
+            if(target.flags == 0)
+                target.summary = QString("argument %1 of %2").arg(j + 1).arg(api);
+            target.flags |= FlagArgument;
+        }
+    }
+
+    std::unique_ptr<ReportIndex> index(new ReportIndex());
+    // The score looks like "11.23/100"
+    auto score = summary["threat_level"].toObject()["score"].toString();
+    index->mScore = score.left(score.indexOf('/')).toDouble();
+    index->mEntries.reserve(sites.size());
+    for(auto itr = sites.constBegin(); itr != sites.constEnd(); ++itr)
+    {
+        const auto& site = itr.value();
+        auto text = "Malcore: " + site.summary;
+        if(site.calls > 1)
+            text += QString(" (x%1)").arg(site.calls);
+        if(site.flags & FlagSuspicious)
+            text += " [suspicious]";
+        if(site.flags & FlagIoc)
+            text += QString(" [IOC: %1]").arg(site.ioc);
+
+        Entry entry;
+        entry.address = itr.key();
+        entry.text = uint32_t(index->mPool.size());
+        entry.calls = site.calls;
+        entry.flags = site.flags;
+        index->mEntries.append(entry);
+
+        index->mPool.append(truncateUtf8(text.toUtf8(), MaxTextLength));
+        index->mPool.append('\0');
+    }
+    return index;
+}
+
+const ReportIndex::Entry* ReportIndex::find(uint64_t address) const
+{
+    auto begin = mEntries.constBegin();
+    auto end = mEntries.constEnd();
+    auto itr = std::lower_bound(begin, end, address, [](const Entry& entry, uint64_t address)
+    {
+        return entry.address < address;
+    });
+    if(itr == end || itr->address != address)
+        return nullptr;
+    return &*itr;
+}
+
+ReportIndex::Reader::Reader()
+    : Snapshot<ReportIndex>::Reader(currentIndex)
+{
+}
+
+void ReportIndex::publish(std::unique_ptr<const ReportIndex> index)
+{
+    currentIndex.publish(std::move(index));
+}
+
+std::unique_ptr<const ReportIndex> ReportIndex::clone() const
+{
+    return std::unique_ptr<const ReportIndex>(new ReportIndex(*this));
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QByteArray>
+#include <QVector>
+
+#include <cstdint>
+#include <memory>
+
+#include "Snapshot.h"
+#include "TraceStore.h"
+
+// Per-address annotations derived from a report, used to decorate the disassembly and dump views
+// and to answer the malcore.* expression functions. The index is immutable once built: a sorted
+// flat array of rebased addresses that points into a single pooled buffer of NUL-terminated UTF-8
+// strings. Lookups never allocate, because x64dbg queries every visible line on every repaint and
+// evaluates expressions on every breakpoint hit and trace step.
+class ReportIndex
+{
+public:
+    enum Flags
+    {
+        FlagCallSite = 1,
+        FlagSuspicious = 2,
+        FlagIoc = 4,
+        FlagArgument = 8,
+    };
+
+    struct Entry
+    {
+        uint64_t address;
+        uint32_t text; // offset into the string pool
+        uint32_t calls;
+        uint32_t flags;
+    };
+
+    // Annotations are capped to fit in BRIDGE_ADDRINFO::comment
+    static const int MaxTextLength = 511;
+
+    // Lock-free access to the index of the report that is currently displayed
+    struct Reader : Snapshot<ReportIndex>::Reader
+    {
+        Reader();
+    };
+
+    // The trace determines the bases, the report data provides the IOCs and the score
+    static std::unique_ptr<ReportIndex> build(const TraceStore& trace, const QJsonObject& data);
+    static void publish(std::unique_ptr<const ReportIndex> index);
+    // Copy to publish again, the entries and strings are shared with this index
+    std::unique_ptr<const ReportIndex> clone() const;
+    // Approximate heap size in bytes
+    qint64 memoryUsage() const { return mEntries.size() * sizeof(Entry) + mPool.size(); }
+
+    const Entry* find(uint64_t address) const;
+    const char* text(const Entry& entry) const { return mPool.constData() + entry.text; }
+    int size() const { return mEntries.size(); }
+    double score() const { return mScore; }
+
+private:
+    ReportIndex() = default;
+
+    QVector<Entry> mEntries;
+    QByteArray mPool;
+    double mScore = 0.0;
+};
@@ -0,0 +1,119 @@
+#include "ReportPrefetcher.h"
+#include "MalcoreReport.h"
+#include "PerfTrace.h"
+
+#include <QFile>
+#include <QThread>
+#include <QRunnable>
+
+class PrefetchTask : public QRunnable
+{
+public:
+    PrefetchTask(ReportPrefetcher* prefetcher, const std::shared_ptr<ReportPrefetcher::Pending>& pending)
+        : mPrefetcher(prefetcher), mPending(pending)
+    {
+    }
+
+    void run() override
+    {
+        // Speculative work, the debugger and the GUI come first
+        QThread::currentThread()->setPriority(QThread::LowestPriority);
+        if(mPending->cancelled)
+            return;
+
+        PerfTrace::Scope scope("prefetch");
+        auto cache = mPrefetcher->mCache;
+        std::unique_ptr<ReportPrefetcher::Report> report(new ReportPrefetcher::Report);
+        report->modulePath = mPending->modulePath;
+        auto sha256 = cache->fileHash(mPending->modulePath);
+        if(!sha256.isEmpty())
+            report->jsonPath = cache->jsonPath(sha256);
+
+        // Same steps as the GUI takes to display a report, see PluginMainWindow::displayReport
+        QJsonObject data;
+        if(!report->jsonPath.isEmpty() && QFile::exists(report->jsonPath) && !mPending->cancelled)
+            data = ReportCache::readReport(report->jsonPath);
+        if(!data.isEmpty() && !mPending->cancelled)
+        {
+            auto query = std::make_shared<TraceQuery>(TraceStore::build(data["dynamic_analysis"].toObject()["parsed_output"].toArray(), mPending->loadedBase, mPending->headerBase, mPending->imageSize));
+            report->index = ReportIndex::build(query->trace(), data);
+            auto matches = mPrefetcher->mSimilarity->similar(data, report->jsonPath);
+            MalcoreAnalysis analysis(std::move(data), mPending->loadedBase, mPending->headerBase, mPending->imageSize, &query->trace());
+            analysis.setLocalMatches(matches);
+            report->html = analysis.getReportHtml();
+            report->query = std::move(query);
+            report->cached = true;
+            cache->store(ReportCache::htmlPath(report->jsonPath), report->html.toUtf8());
+        }
+
+        mPending->report = std::move(report);
+        mPending->ready = true;
+        QMetaObject::invokeMethod(mPrefetcher, "deliver", Qt::QueuedConnection, Q_ARG(qulonglong, mPending->loadedBase));
+    }
+
+private:
+    ReportPrefetcher* mPrefetcher;
+    std::shared_ptr<ReportPrefetcher::Pending> mPending;
+};
+
+ReportPrefetcher::ReportPrefetcher(ReportCache* cache, SimilarityIndex* similarity, QObject* parent)
+    : QObject(parent)
+    , mCache(cache)
+    , mSimilarity(similarity)
+{
+    // One module at a time, in load order
+    mPool.setMaxThreadCount(1);
+}
+
+ReportPrefetcher::~ReportPrefetcher()
+{
+    clear();
+    mPool.waitForDone();
+}
+
+void ReportPrefetcher::prefetch(const QString& modulePath, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize)
+{
+    cancel(loadedBase);
+    auto pending = std::make_shared<Pending>();
+    pending->modulePath = modulePath;
+    pending->loadedBase = loadedBase;
+    pending->headerBase = headerBase;
+    pending->imageSize = imageSize;
+    mPending.insert(loadedBase, pending);
+    mPool.start(new PrefetchTask(this, pending));
+}
+
+std::unique_ptr<ReportPrefetcher::Report> ReportPrefetcher::take(uintptr_t loadedBase, const QString& modulePath)
+{
+    auto pending = mPending.take(loadedBase);
+    if(!pending)
+        return nullptr;
+    pending->cancelled = true;
+    if(!pending->ready || pending->modulePath != modulePath)
+        return nullptr;
+    return std::move(pending->report);
+}
+
+void ReportPrefetcher::cancel(uintptr_t loadedBase)
+{
+    auto pending = mPending.take(loadedBase);
+    if(pending)
+        pending->cancelled = true;
+}
+
+void ReportPrefetcher::clear()
+{
+    for(const auto& pending : mPending)
+        pending->cancelled = true;
+    mPending.clear();
+}
+
+void ReportPrefetcher::deliver(qulonglong loadedBase)
+{
+    // A task of a module that was taken or unloaded since (the base may be reused) has no report here
+    auto pending = mPending.value(loadedBase);
+    if(!pending || pending->delivered || !pending->ready)
+        return;
+    pending->delivered = true;
+    emit prepared(loadedBase, pending->modulePath, pending->report->jsonPath, pending->report->cached);
+}
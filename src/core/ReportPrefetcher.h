@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QThreadPool>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "ReportCache.h"
+#include "ReportIndex.h"
+#include "SimilarityIndex.h"
+#include "TraceQuery.h"
+
+// Speculative preparation of the reports of loaded modules, so selecting a module that was analyzed
+// before does not hash, parse or render anything on the GUI thread. Modules are hashed, looked up in
+// the report cache and a cached report is parsed, indexed and rendered on a low priority thread.
+// Use it from the thread that owns it, the results are delivered there.
+class ReportPrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Report
+    {
+        QString modulePath;
+        QString jsonPath; // empty if the module could not be hashed
+        bool cached = false; // the rest is only set if there is a report
+        std::shared_ptr<const TraceQuery> query; // with its trace
+        std::unique_ptr<const ReportIndex> index;
+        QString html;
+    };
+
+    ReportPrefetcher(ReportCache* cache, SimilarityIndex* similarity, QObject* parent = nullptr);
+    ~ReportPrefetcher();
+
+    // Queue a module, the bases rebase the report like MalcoreAnalysis does
+    void prefetch(const QString& modulePath, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize);
+    // The prepared report of the module, nullptr if it is not ready yet. Either way the module is
+    // not prefetched anymore, prefetch() it again to prepare it for the next selection.
+    std::unique_ptr<Report> take(uintptr_t loadedBase, const QString& modulePath);
+    void cancel(uintptr_t loadedBase);
+    void clear();
+
+signals:
+    // The module was hashed and its report (if cached) can be taken
+    void prepared(qulonglong loadedBase, const QString& modulePath, const QString& jsonPath, bool cached);
+
+private slots:
+    void deliver(qulonglong loadedBase);
+
+private:
+    friend class PrefetchTask;
+
+    struct Pending
+    {
+        QString modulePath;
+        uintptr_t loadedBase = 0;
+        uintptr_t headerBase = 0;
+        uintptr_t imageSize = 0;
+        std::atomic<bool> cancelled;
+        std::atomic<bool> ready; // the task wrote report
+        bool delivered = false;
+        std::unique_ptr<Report> report;
+
+        Pending() : cancelled(false), ready(false) {}
+    };
+
+    ReportCache* mCache = nullptr;
+    SimilarityIndex* mSimilarity = nullptr;
+    QThreadPool mPool;
+    QHash<quint64, std::shared_ptr<Pending>> mPending; // loaded base -> module
+};
@@ -0,0 +1,96 @@
+#include "ReportRefresher.h"
+#include "MalcoreClient.h"
+#include "ReportCache.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+// Look for stale reports once shortly after startup and then every hour
+static const int FirstCheckDelay = 60 * 1000;
+static const int CheckInterval = 60 * 60 * 1000;
+
+ReportRefresher::ReportRefresher(MalcoreClient* client, ReportCache* cache, QObject* parent)
+    : QObject(parent)
+    , mClient(client)
+    , mCache(cache)
+{
+    mTimer = new QTimer(this);
+    connect(mTimer, &QTimer::timeout, this, [this]()
+    {
+        mTimer->setInterval(CheckInterval);
+        queueStale();
+    });
+}
+
+void ReportRefresher::setMaxAge(qint64 ms)
+{
+    mMaxAge = ms;
+    if(ms > 0)
+        mTimer->start(FirstCheckDelay);
+    else
+        mTimer->stop();
+}
+
+bool ReportRefresher::refresh(const QString& jsonPath)
+{
+    if(mCache->origin(jsonPath).uuid.isEmpty())
+        return false;
+
+    mQueue.removeAll(jsonPath);
+    mQueue.prepend(jsonPath);
+    if(!mBusy)
+        next();
+    return true;
+}
+
+void ReportRefresher::queueStale()
+{
+    for(const auto& jsonPath : mCache->staleReports(mMaxAge))
+    {
+        if(!mQueue.contains(jsonPath))
+            mQueue.append(jsonPath);
+    }
+    if(!mBusy)
+        next();
+}
+
+void ReportRefresher::next()
+{
+    mBusy = false;
+    if(mQueue.isEmpty() || mClient->apiKey().isEmpty())
+        return;
+
+    auto jsonPath = mQueue.takeFirst();
+    auto origin = mCache->origin(jsonPath);
+    if(origin.uuid.isEmpty())
+    {
+        next();
+        return;
+    }
+
+    mBusy = true;
+    auto sha256 = QFileInfo(jsonPath).completeBaseName();
+    auto request = mClient->refresh(sha256, jsonPath, origin.uuid, origin.etag);
+    connect(request, &AnalysisRequest::finished, this, [this, request, jsonPath]()
+    {
+        auto changed = !request->notModified();
+        // The rendered report is out of date, it is rendered again when needed
+        if(changed)
+            QFile::remove(ReportCache::htmlPath(jsonPath));
+        mCache->setFetched(jsonPath, request->etag());
+        emit refreshed(jsonPath, changed);
+        next();
+    });
+    connect(request, &AnalysisRequest::failed, this, [this, jsonPath](const QString& error, int httpStatus)
+    {
+        // Try again with the next check, but not the rest of the queue with an invalid key. Other
+        // failures (like an expired uuid) count as a refresh, or the report would be requested
+        // again with every check.
+        if(httpStatus == 401 || httpStatus == 403)
+            mQueue.clear();
+        else
+            mCache->setFetched(jsonPath, QByteArray());
+        emit refreshFailed(jsonPath, error);
+        next();
+    });
+}
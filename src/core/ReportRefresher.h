@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+class MalcoreClient;
+class ReportCache;
+
+// Downloads cached reports again when the server has a newer version. Reports that were not
+// downloaded for maxAge are refreshed in the background, one at a time, and refresh() requests
+// one right away. The ETag of the cached report is sent along, so an unchanged report costs a
+// single empty 304 response.
+class ReportRefresher : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReportRefresher(MalcoreClient* client, ReportCache* cache, QObject* parent = nullptr);
+
+    // 0 disables the background refresh
+    void setMaxAge(qint64 ms);
+    qint64 maxAge() const { return mMaxAge; }
+    // Returns false if the uuid of the report is unknown (cached by an older version)
+    bool refresh(const QString& jsonPath);
+
+signals:
+    // changed is false if the server confirmed the cached report
+    void refreshed(const QString& jsonPath, bool changed);
+    void refreshFailed(const QString& jsonPath, const QString& error);
+
+private:
+    void queueStale();
+    void next();
+
+    MalcoreClient* mClient = nullptr;
+    ReportCache* mCache = nullptr;
+    QTimer* mTimer = nullptr;
+    QStringList mQueue;
+    bool mBusy = false;
+    qint64 mMaxAge = 0;
+};
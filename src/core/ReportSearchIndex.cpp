@@ -0,0 +1,562 @@
+#include "ReportSearchIndex.h"
+#include "ReportCache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QRunnable>
+#include <QSet>
+#include <QRegExp>
+
+#include <algorithm>
+#include <iterator>
+
+static const quint32 IndexMagic = 0x5849534D; // "MSIX"
+static const quint32 IndexVersion = 2;
+// Longer values (embedded scripts, blobs) are not useful search terms
+static const int MaxTermLength = 512;
+static const int GramLength = 3;
+
+static quint64 gramAt(const QString& text, int i)
+{
+    return (quint64(text[i].unicode()) << 32) | (quint64(text[i + 1].unicode()) << 16) | text[i + 2].unicode();
+}
+
+class RescanTask : public QRunnable
+{
+public:
+    explicit RescanTask(ReportSearchIndex* index)
+        : mIndex(index)
+    {
+    }
+
+    void run() override
+    {
+        mIndex->rescan();
+    }
+
+private:
+    ReportSearchIndex* mIndex;
+};
+
+class SearchUpdateTask : public QRunnable
+{
+public:
+    SearchUpdateTask(ReportSearchIndex* index, const QString& jsonPath)
+        : mIndex(index), mJsonPath(jsonPath)
+    {
+    }
+
+    void run() override
+    {
+        mIndex->updateFile(mJsonPath);
+    }
+
+private:
+    ReportSearchIndex* mIndex;
+    QString mJsonPath;
+};
+
+ReportSearchIndex::ReportSearchIndex(const ReportCache* cache, QObject* parent)
+    : QObject(parent)
+    , mCache(cache)
+    , mDirectory(cache->directory())
+    , mIndexPath(QDir(mDirectory).filePath("search.idx"))
+    , mStop(false)
+    , mRescanQueued(false)
+{
+    mPool.setMaxThreadCount(1);
+}
+
+ReportSearchIndex::~ReportSearchIndex()
+{
+    mStop = true;
+    mPool.waitForDone();
+    bool dirty = false;
+    {
+        QMutexLocker lock(&mLock);
+        dirty = mDirty;
+    }
+    if(dirty)
+        save();
+}
+
+void ReportSearchIndex::rescanAsync()
+{
+    // Every job that finishes asks for one, a single listing picks up all of them
+    if(mRescanQueued.exchange(true))
+        return;
+    mPool.start(new RescanTask(this));
+}
+
+void ReportSearchIndex::updateAsync(const QString& jsonPath)
+{
+    mPool.start(new SearchUpdateTask(this, jsonPath));
+}
+
+ReportSearchIndex::Terms ReportSearchIndex::extractTerms(const QJsonObject& data)
+{
+    QHash<QString, quint32> unique;
+    auto add = [&unique](const QString& value, quint32 field)
+    {
+        auto term = value.trimmed().toLower();
+        if(!term.isEmpty() && term.size() <= MaxTermLength)
+            unique[term] |= field;
+    };
+
+    auto summary = data["threat_summary"].toObject()["results"].toObject();
+    auto iocs = summary["iocs"].toObject();
+    for(auto itr = iocs.constBegin(); itr != iocs.constEnd(); ++itr)
+    {
+        for(const auto& ioc : itr.value().toArray())
+            add(ioc.toString(), FieldIoc);
+    }
+    for(const auto& signature : summary["threat_level"].toObject()["signatures"].toArray())
+        add(signature.toString(), FieldSignature);
+
+    auto hashes = data["hashes"].toObject();
+    for(auto itr = hashes.constBegin(); itr != hashes.constEnd(); ++itr)
+        add(itr.value().toString(), FieldHash);
+
+    // Entries look like ["GetCurrentProcessId", "0x62c64749"]
+    for(const auto& entry : data["imports"].toObject()["results"].toObject()["import_hashes"].toArray())
+        add(entry.toArray().at(1).toString(), FieldImportHash);
+
+    // Entries look like ["Embedded_PE", "description"] or ["custom YARA rule", "rule NAME { ... }"]
+    for(const auto& entry : data["yara_rules"].toObject()["results"].toArray())
+    {
+        auto rule = entry.toArray();
+        auto value = rule.at(1).toString();
+        if(value.startsWith("rule "))
+        {
+            auto name = value.mid(5).section(QRegExp("[\\s{:]"), 0, 0, QString::SectionSkipEmpty);
+            add(name, FieldYara);
+        }
+        else
+        {
+            add(rule.at(0).toString(), FieldYara);
+        }
+    }
+
+    Terms terms;
+    terms.reserve(unique.size());
+    for(auto itr = unique.constBegin(); itr != unique.constEnd(); ++itr)
+        terms.append(qMakePair(itr.key(), itr.value()));
+    return terms;
+}
+
+void ReportSearchIndex::update(const QString& jsonPath, const QJsonObject& data)
+{
+    auto terms = extractTerms(data);
+    QFileInfo info(jsonPath);
+
+    QMutexLocker lock(&mLock);
+    addLocked(ReportCache::nativePath(jsonPath), info.lastModified().toMSecsSinceEpoch(), info.size(), terms);
+}
+
+void ReportSearchIndex::updateFile(const QString& jsonPath)
+{
+    auto path = ReportCache::nativePath(jsonPath);
+    QFileInfo info(path);
+    {
+        QMutexLocker lock(&mLock);
+        loadOnceLocked();
+        // Jobs that found their report in the cache finish with an indexed report
+        auto itr = mDocumentIds.constFind(path);
+        if(itr != mDocumentIds.constEnd() && mDocuments[itr.value()].modified == info.lastModified().toMSecsSinceEpoch() && mDocuments[itr.value()].size == info.size())
+            return;
+    }
+    if(mStop)
+        return;
+    auto data = ReportCache::readReport(path);
+    if(!data.isEmpty())
+        update(path, data);
+}
+
+void ReportSearchIndex::loadOnceLocked()
+{
+    if(mLoaded)
+        return;
+    load();
+    mLoaded = true;
+}
+
+void ReportSearchIndex::rescan()
+{
+    mRescanQueued = false;
+    {
+        QMutexLocker lock(&mLock);
+        loadOnceLocked();
+    }
+
+    QSet<QString> present;
+    bool changed = false;
+    // Reports written after the listing (update()) are not in it
+    auto listed = QDateTime::currentMSecsSinceEpoch();
+    auto files = QDir(mDirectory).entryInfoList(QStringList() << "*.json", QDir::Files);
+    for(const auto& file : files)
+    {
+        if(mStop)
+            return;
+
+        auto path = ReportCache::nativePath(file.filePath());
+        auto modified = file.lastModified().toMSecsSinceEpoch();
+        present.insert(path);
+        {
+            QMutexLocker lock(&mLock);
+            auto itr = mDocumentIds.constFind(path);
+            if(itr != mDocumentIds.constEnd())
+            {
+                const auto& document = mDocuments[itr.value()];
+                if(document.modified == modified && document.size == file.size())
+                    continue;
+            }
+        }
+
+        // Parse outside of the lock, searches keep working
+        QFile f(path);
+        if(!f.open(QIODevice::ReadOnly))
+            continue;
+        auto terms = extractTerms(QJsonDocument::fromJson(f.readAll()).object()["data"].toObject());
+
+        QMutexLocker lock(&mLock);
+        addLocked(path, modified, file.size(), terms);
+        changed = true;
+    }
+
+    int documents = 0;
+    {
+        QMutexLocker lock(&mLock);
+        for(auto itr = mDocumentIds.begin(); itr != mDocumentIds.end();)
+        {
+            auto id = itr.value();
+            if(present.contains(itr.key()) || mDocuments[id].modified >= listed)
+            {
+                ++itr;
+                continue;
+            }
+            itr = mDocumentIds.erase(itr);
+            mDocuments[id].removed = true;
+            mRemoved++;
+            changed = true;
+        }
+        documents = mDocumentIds.size();
+    }
+
+    if(changed)
+        save();
+    emit rescanFinished(documents);
+}
+
+void ReportSearchIndex::addLocked(const QString& jsonPath, qint64 modified, qint64 size, const Terms& terms)
+{
+    auto existing = mDocumentIds.constFind(jsonPath);
+    if(existing != mDocumentIds.constEnd())
+        removeLocked(existing.value());
+
+    Document document;
+    document.path = jsonPath;
+    document.module = mCache->moduleName(jsonPath);
+    document.modified = modified;
+    document.size = size;
+    auto id = quint32(mDocuments.size());
+    mDocuments.append(document);
+    mDocumentIds.insert(jsonPath, id);
+
+    for(const auto& term : terms)
+    {
+        auto itr = mTermIds.constFind(term.first);
+        quint32 termId = 0;
+        if(itr != mTermIds.constEnd())
+        {
+            termId = itr.value();
+        }
+        else
+        {
+            termId = quint32(mTerms.size());
+            Term entry;
+            entry.text = term.first;
+            mTerms.append(entry);
+            mTermIds.insert(term.first, termId);
+            indexTermLocked(termId);
+            mSortedDirty = true;
+        }
+        auto& entry = mTerms[termId];
+        entry.documents.append(id);
+        entry.fields.append(term.second);
+    }
+    mDirty = true;
+}
+
+void ReportSearchIndex::setTermsLocked(const QVector<Term>& terms)
+{
+    mTerms = terms;
+    mTermIds.clear();
+    mGrams.clear();
+    for(int id = 0; id < mTerms.size(); id++)
+    {
+        mTermIds.insert(mTerms[id].text, quint32(id));
+        indexTermLocked(quint32(id));
+    }
+    mSortedDirty = true;
+}
+
+void ReportSearchIndex::indexTermLocked(quint32 id)
+{
+    // Term ids are indexed in ascending order, a gram that occurs twice in a term is listed once
+    const auto& text = mTerms[id].text;
+    for(int i = 0; i + GramLength <= text.size(); i++)
+    {
+        auto& postings = mGrams[gramAt(text, i)];
+        if(postings.isEmpty() || postings.last() != id)
+            postings.append(id);
+    }
+}
+
+void ReportSearchIndex::removeLocked(quint32 id)
+{
+    // The postings are cleaned up by compactLocked(), searches skip removed documents
+    auto& document = mDocuments[id];
+    document.removed = true;
+    mDocumentIds.remove(document.path);
+    mRemoved++;
+    mDirty = true;
+}
+
+void ReportSearchIndex::compactLocked()
+{
+    if(mRemoved == 0)
+        return;
+
+    QVector<quint32> remap(mDocuments.size(), quint32(-1));
+    QVector<Document> documents;
+    for(int id = 0; id < mDocuments.size(); id++)
+    {
+        if(mDocuments[id].removed)
+            continue;
+        remap[id] = quint32(documents.size());
+        documents.append(mDocuments[id]);
+    }
+
+    // Terms that only occurred in removed documents are dropped, their fields with them
+    QVector<Term> terms;
+    for(const auto& term : mTerms)
+    {
+        Term entry;
+        entry.text = term.text;
+        for(int i = 0; i < term.documents.size(); i++)
+        {
+            auto id = remap[term.documents[i]];
+            if(id == quint32(-1))
+                continue;
+            entry.documents.append(id);
+            entry.fields.append(term.fields[i]);
+        }
+        if(!entry.documents.isEmpty())
+            terms.append(entry);
+    }
+
+    mDocuments = documents;
+    mDocumentIds.clear();
+    for(int id = 0; id < mDocuments.size(); id++)
+        mDocumentIds.insert(mDocuments[id].path, quint32(id));
+    setTermsLocked(terms);
+    mRemoved = 0;
+}
+
+QVector<quint32> ReportSearchIndex::candidatesLocked(const QString& needle) const
+{
+    QVector<quint32> result;
+    if(needle.size() < GramLength)
+    {
+        if(mSortedDirty)
+        {
+            mSortedTerms.resize(mTerms.size());
+            for(int id = 0; id < mTerms.size(); id++)
+                mSortedTerms[id] = quint32(id);
+            std::sort(mSortedTerms.begin(), mSortedTerms.end(), [this](quint32 a, quint32 b)
+            {
+                return mTerms[a].text < mTerms[b].text;
+            });
+            mSortedDirty = false;
+        }
+        auto itr = std::lower_bound(mSortedTerms.constBegin(), mSortedTerms.constEnd(), needle, [this](quint32 id, const QString& text)
+        {
+            return mTerms[id].text < text;
+        });
+        for(; itr != mSortedTerms.constEnd() && mTerms[*itr].text.startsWith(needle); ++itr)
+            result.append(*itr);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // Intersect the postings of every trigram of the needle, shortest first
+    QVector<const QVector<quint32>*> lists;
+    for(int i = 0; i + GramLength <= needle.size(); i++)
+    {
+        auto itr = mGrams.constFind(gramAt(needle, i));
+        if(itr == mGrams.constEnd())
+            return result;
+        lists.append(&itr.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const QVector<quint32>* a, const QVector<quint32>* b)
+    {
+        return a->size() < b->size();
+    });
+    result = *lists.first();
+    for(int i = 1; i < lists.size() && !result.isEmpty(); i++)
+    {
+        QVector<quint32> intersection;
+        std::set_intersection(result.constBegin(), result.constEnd(), lists[i]->constBegin(), lists[i]->constEnd(), std::back_inserter(intersection));
+        result = intersection;
+    }
+
+    // The grams can occur in a different order, check the candidates
+    QVector<quint32> matches;
+    for(auto id : result)
+    {
+        if(mTerms[id].text.contains(needle))
+            matches.append(id);
+    }
+    return matches;
+}
+
+QList<ReportSearchIndex::Hit> ReportSearchIndex::search(const QString& query, int limit) const
+{
+    QList<Hit> hits;
+    auto needle = query.trimmed().toLower();
+    if(needle.isEmpty())
+        return hits;
+
+    QMutexLocker lock(&mLock);
+    auto addHits = [&](const Term& entry, bool exact)
+    {
+        // Most recently indexed reports first
+        for(int i = entry.documents.size() - 1; i >= 0; i--)
+        {
+            const auto& document = mDocuments[entry.documents[i]];
+            if(document.removed)
+                continue;
+            if(hits.size() >= limit)
+                return false;
+            Hit hit;
+            hit.jsonPath = document.path;
+            hit.module = document.module;
+            hit.term = entry.text;
+            hit.fields = entry.fields[i];
+            hit.exact = exact;
+            hits.append(hit);
+        }
+        return true;
+    };
+
+    auto exact = mTermIds.value(needle, quint32(-1));
+    if(exact != quint32(-1) && !addHits(mTerms[exact], true))
+        return hits;
+    for(auto id : candidatesLocked(needle))
+    {
+        if(id != exact && !addHits(mTerms[id], false))
+            break;
+    }
+    return hits;
+}
+
+int ReportSearchIndex::documentCount() const
+{
+    QMutexLocker lock(&mLock);
+    return mDocumentIds.size();
+}
+
+bool ReportSearchIndex::load()
+{
+    QFile f(mIndexPath);
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0, documentCount = 0, termCount = 0;
+    stream >> magic >> version;
+    if(magic != IndexMagic || version != IndexVersion)
+        return false;
+
+    QVector<Document> documents;
+    stream >> documentCount;
+    for(quint32 i = 0; i < documentCount && stream.status() == QDataStream::Ok; i++)
+    {
+        Document document;
+        stream >> document.path >> document.modified >> document.size;
+        document.module = mCache->moduleName(document.path);
+        documents.append(document);
+    }
+
+    QVector<Term> terms;
+    stream >> termCount;
+    for(quint32 i = 0; i < termCount && stream.status() == QDataStream::Ok; i++)
+    {
+        Term entry;
+        stream >> entry.text >> entry.documents >> entry.fields;
+        if(entry.fields.size() != entry.documents.size())
+            return false;
+        terms.append(entry);
+    }
+
+    // A damaged index is rebuilt by the rescan
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    mDocuments = documents;
+    mDocumentIds.clear();
+    for(int id = 0; id < mDocuments.size(); id++)
+        mDocumentIds.insert(mDocuments[id].path, quint32(id));
+    // The trigrams are not persisted, they are rebuilt from the terms
+    setTermsLocked(terms);
+    mRemoved = 0;
+    return true;
+}
+
+bool ReportSearchIndex::save()
+{
+    QMutexLocker lock(&mLock);
+    compactLocked();
+
+    QSaveFile f(mIndexPath);
+    if(!f.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << IndexMagic << IndexVersion;
+    stream << quint32(mDocuments.size());
+    for(const auto& document : mDocuments)
+        stream << document.path << document.modified << document.size;
+    stream << quint32(mTerms.size());
+    for(const auto& term : mTerms)
+        stream << term.text << term.documents << term.fields;
+
+    if(stream.status() != QDataStream::Ok || !f.commit())
+        return false;
+    mDirty = false;
+    return true;
+}
+
+QString ReportSearchIndex::fieldNames(quint32 fields)
+{
+    QStringList names;
+    if(fields & FieldIoc)
+        names << "IOC";
+    if(fields & FieldSignature)
+        names << "Signature";
+    if(fields & FieldHash)
+        names << "Hash";
+    if(fields & FieldImportHash)
+        names << "Import hash";
+    if(fields & FieldYara)
+        names << "YARA";
+    return names.join(", ");
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QJsonObject>
+
+#include <atomic>
+
+class ReportCache;
+
+// Inverted index over the reports in a ReportCache. The terms are the IOC strings, signatures,
+// file hashes, import hashes and YARA rule names of every report, lowercased.
+// The index is persisted next to the reports (search.idx) and brought up to date incrementally:
+// only reports that are new or changed since the last scan are parsed. Substring queries go
+// through a trigram index over the terms (kept in memory only), queries shorter than a trigram
+// match term prefixes. All methods are thread-safe, rescans run on a background thread.
+class ReportSearchIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Field
+    {
+        FieldIoc = 1,
+        FieldSignature = 2,
+        FieldHash = 4,
+        FieldImportHash = 8,
+        FieldYara = 16,
+    };
+
+    struct Hit
+    {
+        QString jsonPath;
+        QString module;
+        QString term;
+        quint32 fields = 0;
+        bool exact = false;
+    };
+
+    explicit ReportSearchIndex(const ReportCache* cache, QObject* parent = nullptr);
+    ~ReportSearchIndex();
+
+    // Load the persisted index and index new/changed reports in the background. Calls while a
+    // rescan is queued are merged into it.
+    void rescanAsync();
+    // Index a report that was just written (replaces an older version of the same file)
+    void update(const QString& jsonPath, const QJsonObject& data);
+    // update() on the background thread, the report is only parsed if it changed since it was indexed
+    void updateAsync(const QString& jsonPath);
+    // Exact (case-insensitive) term matches first, then terms that contain (or start with) the query
+    QList<Hit> search(const QString& query, int limit = 200) const;
+    int documentCount() const;
+    bool save();
+
+    static QString fieldNames(quint32 fields);
+
+signals:
+    void rescanFinished(int documents);
+
+private:
+    friend class RescanTask;
+    friend class SearchUpdateTask;
+
+    struct Document
+    {
+        QString path;
+        QString module;
+        qint64 modified = 0;
+        qint64 size = 0;
+        bool removed = false;
+    };
+
+    struct Term
+    {
+        QString text;
+        QVector<quint32> documents; // ascending
+        QVector<quint32> fields; // per document, removed documents do not count
+    };
+
+    typedef QList<QPair<QString, quint32>> Terms;
+
+    static Terms extractTerms(const QJsonObject& data);
+    void rescan();
+    void updateFile(const QString& jsonPath);
+    void loadOnceLocked();
+    bool load();
+    void addLocked(const QString& jsonPath, qint64 modified, qint64 size, const Terms& terms);
+    void removeLocked(quint32 id);
+    void compactLocked();
+    void setTermsLocked(const QVector<Term>& terms);
+    void indexTermLocked(quint32 id);
+    // Terms that contain needle (or start with it if it is shorter than a trigram), ascending
+    QVector<quint32> candidatesLocked(const QString& needle) const;
+
+    const ReportCache* mCache = nullptr;
+    QString mDirectory;
+    QString mIndexPath;
+    mutable QMutex mLock;
+    QVector<Document> mDocuments;
+    QHash<QString, quint32> mDocumentIds; // path -> id of the live document
+    QVector<Term> mTerms; // id -> term
+    QHash<QString, quint32> mTermIds;
+    QHash<quint64, QVector<quint32>> mGrams; // trigram -> ascending term ids
+    mutable QVector<quint32> mSortedTerms; // term ids by text, rebuilt by searches after changes
+    mutable bool mSortedDirty = true;
+    int mRemoved = 0;
+    bool mLoaded = false;
+    bool mDirty = false;
+    QThreadPool mPool;
+    std::atomic<bool> mStop;
+    std::atomic<bool> mRescanQueued;
+};
@@ -0,0 +1,128 @@
+#include "SessionCache.h"
+
+#include <QFileInfo>
+
+SessionCache::SessionCache(qint64 budget)
+    : mBudget(budget)
+{
+}
+
+void SessionCache::setBudget(qint64 bytes)
+{
+    mBudget = qMax<qint64>(0, bytes);
+    evict();
+}
+
+void SessionCache::setReportPath(const QString& modulePath, const QString& jsonPath)
+{
+    QFileInfo info(modulePath);
+    if(modulePath.isEmpty() || jsonPath.isEmpty() || !info.exists())
+        return;
+
+    Module module;
+    module.jsonPath = jsonPath;
+    module.size = info.size();
+    module.modified = info.lastModified();
+    mModules.insert(modulePath, module);
+}
+
+QString SessionCache::reportPath(const QString& modulePath) const
+{
+    auto itr = mModules.constFind(modulePath);
+    if(itr == mModules.constEnd())
+        return QString();
+
+    // The target was rebuilt since
+    QFileInfo info(modulePath);
+    if(info.size() != itr->size || info.lastModified() != itr->modified)
+        return QString();
+    return itr->jsonPath;
+}
+
+QString SessionCache::key(const QString& jsonPath, uintptr_t loadedBase)
+{
+    return QString("%1@%2").arg(jsonPath).arg(quint64(loadedBase), 0, 16);
+}
+
+void SessionCache::insert(const QString& jsonPath, uintptr_t loadedBase, const Report& report)
+{
+    if(mBudget == 0 || jsonPath.isEmpty())
+        return;
+
+    Entry entry;
+    entry.jsonPath = jsonPath;
+    entry.report = report;
+    entry.size = report.html.size() * sizeof(QChar);
+    if(report.query)
+        entry.size += report.query->trace().memoryUsage() + report.query->memoryUsage();
+    if(report.index)
+        entry.size += report.index->memoryUsage();
+    entry.used = ++mClock;
+    // A report that does not fit would evict everything else
+    if(entry.size > mBudget)
+        return;
+
+    auto k = key(jsonPath, loadedBase);
+    auto itr = mEntries.find(k);
+    if(itr != mEntries.end())
+    {
+        mSize -= itr->size;
+        mEntries.erase(itr);
+    }
+    mEntries.insert(k, entry);
+    mSize += entry.size;
+    evict();
+}
+
+const SessionCache::Report* SessionCache::find(const QString& jsonPath, uintptr_t loadedBase)
+{
+    auto itr = mEntries.find(key(jsonPath, loadedBase));
+    if(itr == mEntries.end())
+        return nullptr;
+    itr->used = ++mClock;
+    return &itr->report;
+}
+
+bool SessionCache::contains(const QString& jsonPath, uintptr_t loadedBase) const
+{
+    return mEntries.contains(key(jsonPath, loadedBase));
+}
+
+void SessionCache::remove(const QString& jsonPath)
+{
+    for(auto itr = mEntries.begin(); itr != mEntries.end();)
+    {
+        if(itr->jsonPath == jsonPath)
+        {
+            mSize -= itr->size;
+            itr = mEntries.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+}
+
+void SessionCache::clear()
+{
+    mEntries.clear();
+    mModules.clear();
+    mSize = 0;
+}
+
+void SessionCache::evict()
+{
+    // Only a handful of reports fit, a scan for the oldest is cheap enough
+    while(mSize > mBudget && !mEntries.isEmpty())
+    {
+        auto oldest = mEntries.begin();
+        for(auto itr = mEntries.begin(); itr != mEntries.end(); ++itr)
+        {
+            if(itr->used < oldest->used)
+                oldest = itr;
+        }
+        mSize -= oldest->size;
+        mEntries.erase(oldest);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QDateTime>
+
+#include <cstdint>
+#include <memory>
+
+#include "ReportIndex.h"
+#include "TraceQuery.h"
+
+// Reports displayed in this x64dbg session, kept across debug sessions so restarting the same
+// target does not hash, parse or render anything again. Rendered reports are keyed by report and
+// load base (addresses in the report are rebased), the least recently displayed ones are dropped
+// once the budget is exceeded. Module paths map to their report for as long as the file size and
+// modification time stay the same. Not thread-safe, use it from the GUI thread.
+class SessionCache
+{
+public:
+    struct Report
+    {
+        std::shared_ptr<const TraceQuery> query; // with its trace
+        std::shared_ptr<const ReportIndex> index; // clone() it to publish
+        QString html;
+    };
+
+    explicit SessionCache(qint64 budget = 256 * 1024 * 1024);
+
+    // Bytes, 0 disables the cache
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return mBudget; }
+    qint64 size() const { return mSize; }
+
+    // Remember the report of a module file, empty if it changed or was not seen
+    void setReportPath(const QString& modulePath, const QString& jsonPath);
+    QString reportPath(const QString& modulePath) const;
+
+    void insert(const QString& jsonPath, uintptr_t loadedBase, const Report& report);
+    // Marks the report as used, nullptr if it is not cached
+    const Report* find(const QString& jsonPath, uintptr_t loadedBase);
+    bool contains(const QString& jsonPath, uintptr_t loadedBase) const;
+    // The report changed, drop it for every base
+    void remove(const QString& jsonPath);
+    void clear();
+
+private:
+    struct Entry
+    {
+        QString jsonPath;
+        Report report;
+        qint64 size = 0;
+        quint64 used = 0;
+    };
+
+    struct Module
+    {
+        QString jsonPath;
+        qint64 size = 0;
+        QDateTime modified;
+    };
+
+    static QString key(const QString& jsonPath, uintptr_t loadedBase);
+    void evict();
+
+    qint64 mBudget = 0;
+    qint64 mSize = 0;
+    quint64 mClock = 0;
+    QHash<QString, Entry> mEntries; // key() -> rendered report
+    QHash<QString, Module> mModules; // module path -> report
+};
@@ -0,0 +1,584 @@
+#include "SimilarityIndex.h"
+#include "ReportCache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QRunnable>
+#include <QSet>
+
+#include <algorithm>
+
+static const quint32 IndexMagic = 0x4D49534D; // "MSIM"
+static const quint32 IndexVersion = 1;
+// ssdeep constants
+static const int SpamsumLength = 64;
+static const int MinBlocksize = 3;
+static const int RollingWindow = 7;
+// Bound the work per query when a bucket is huge (common compiler stubs share an imphash)
+static const int MaxCandidates = 5000;
+
+class SimilarityRescanTask : public QRunnable
+{
+public:
+    explicit SimilarityRescanTask(SimilarityIndex* index)
+        : mIndex(index)
+    {
+    }
+
+    void run() override
+    {
+        mIndex->rescan();
+    }
+
+private:
+    SimilarityIndex* mIndex;
+};
+
+class SimilarityUpdateTask : public QRunnable
+{
+public:
+    SimilarityUpdateTask(SimilarityIndex* index, const QString& jsonPath)
+        : mIndex(index), mJsonPath(jsonPath)
+    {
+    }
+
+    void run() override
+    {
+        mIndex->updateFile(mJsonPath);
+    }
+
+private:
+    SimilarityIndex* mIndex;
+    QString mJsonPath;
+};
+
+// Stable across processes (qHash is seeded), the signatures are persisted
+static quint32 fnv1a(const QByteArray& data, quint32 hash = 2166136261u)
+{
+    for(auto ch : data)
+    {
+        hash ^= uchar(ch);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static quint32 mix(quint32 h)
+{
+    // MurmurHash3 finalizer
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static bool splitSsdeep(const QString& ssdeep, quint32& blocksize, QString& chunk1, QString& chunk2)
+{
+    auto parts = ssdeep.split(':');
+    if(parts.size() != 3)
+        return false;
+    bool ok = false;
+    blocksize = parts[0].toUInt(&ok);
+    if(!ok || blocksize == 0)
+        return false;
+
+    // ssdeep ignores runs of more than three identical characters
+    auto eliminateSequences = [](const QString& str)
+    {
+        QString result;
+        for(int i = 0; i < str.size(); i++)
+        {
+            if(i < 3 || str[i] != str[i - 1] || str[i] != str[i - 2] || str[i] != str[i - 3])
+                result += str[i];
+        }
+        return result;
+    };
+    chunk1 = eliminateSequences(parts[1]);
+    chunk2 = eliminateSequences(parts[2]);
+    return true;
+}
+
+static QVector<quint32> chunkGrams(const QString& chunk)
+{
+    QVector<quint32> grams;
+    for(int i = 0; i + RollingWindow <= chunk.size(); i++)
+        grams.append(fnv1a(chunk.mid(i, RollingWindow).toUtf8()));
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+static bool hasCommonGram(const QVector<quint32>& a, const QVector<quint32>& b)
+{
+    // The hashes stand in for the 7-grams, both lists are sorted
+    auto i = a.constBegin();
+    auto j = b.constBegin();
+    while(i != a.constEnd() && j != b.constEnd())
+    {
+        if(*i < *j)
+            ++i;
+        else if(*j < *i)
+            ++j;
+        else
+            return true;
+    }
+    return false;
+}
+
+static int editDistance(const QString& a, const QString& b)
+{
+    // Insertion and deletion cost 1, substitution 2 (like ssdeep)
+    QVector<int> previous(b.size() + 1), current(b.size() + 1);
+    for(int j = 0; j <= b.size(); j++)
+        previous[j] = j;
+    for(int i = 1; i <= a.size(); i++)
+    {
+        current[0] = i;
+        for(int j = 1; j <= b.size(); j++)
+        {
+            auto substitution = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 2);
+            current[j] = std::min(std::min(previous[j] + 1, current[j - 1] + 1), substitution);
+        }
+        std::swap(previous, current);
+    }
+    return previous[b.size()];
+}
+
+static int scoreStrings(const QString& a, const QVector<quint32>& aGrams, const QString& b, const QVector<quint32>& bGrams, quint32 blocksize)
+{
+    if(!hasCommonGram(aGrams, bGrams))
+        return 0;
+
+    auto score = editDistance(a, b) * SpamsumLength / (a.size() + b.size());
+    score = 100 * score / SpamsumLength;
+    if(score >= 100)
+        return 0;
+    score = 100 - score;
+
+    // Small block sizes can't produce confident matches
+    if(blocksize >= quint32((99 + RollingWindow) / RollingWindow * MinBlocksize))
+        return score;
+    auto cap = int(blocksize / MinBlocksize) * std::min(a.size(), b.size());
+    return std::min(score, cap);
+}
+
+void SimilarityIndex::parseSsdeep(Signature& signature)
+{
+    if(!splitSsdeep(signature.ssdeep, signature.blocksize, signature.chunk1, signature.chunk2))
+    {
+        signature.blocksize = 0;
+        return;
+    }
+    signature.grams1 = chunkGrams(signature.chunk1);
+    signature.grams2 = chunkGrams(signature.chunk2);
+}
+
+int SimilarityIndex::compareSsdeep(const Signature& a, const Signature& b)
+{
+    if(a.blocksize == 0 || b.blocksize == 0)
+        return -1;
+    if(a.blocksize == b.blocksize && a.chunk1 == b.chunk1 && a.chunk2 == b.chunk2)
+        return 100;
+
+    if(a.blocksize == b.blocksize)
+        return std::max(scoreStrings(a.chunk1, a.grams1, b.chunk1, b.grams1, a.blocksize), scoreStrings(a.chunk2, a.grams2, b.chunk2, b.grams2, a.blocksize * 2));
+    if(a.blocksize == b.blocksize * 2)
+        return scoreStrings(a.chunk1, a.grams1, b.chunk2, b.grams2, a.blocksize);
+    if(a.blocksize * 2 == b.blocksize)
+        return scoreStrings(a.chunk2, a.grams2, b.chunk1, b.grams1, b.blocksize);
+    return 0;
+}
+
+int SimilarityIndex::compareSsdeep(const QString& a, const QString& b)
+{
+    Signature signatureA, signatureB;
+    signatureA.ssdeep = a;
+    signatureB.ssdeep = b;
+    parseSsdeep(signatureA);
+    parseSsdeep(signatureB);
+    return compareSsdeep(signatureA, signatureB);
+}
+
+SimilarityIndex::SimilarityIndex(const ReportCache* cache, QObject* parent)
+    : QObject(parent)
+    , mCache(cache)
+    , mDirectory(cache->directory())
+    , mIndexPath(QDir(mDirectory).filePath("similarity.idx"))
+    , mStop(false)
+    , mRescanQueued(false)
+{
+    mPool.setMaxThreadCount(1);
+}
+
+SimilarityIndex::~SimilarityIndex()
+{
+    mStop = true;
+    mPool.waitForDone();
+    bool dirty = false;
+    {
+        QMutexLocker lock(&mLock);
+        dirty = mDirty;
+    }
+    if(dirty)
+        save();
+}
+
+void SimilarityIndex::rescanAsync()
+{
+    if(mRescanQueued.exchange(true))
+        return;
+    mPool.start(new SimilarityRescanTask(this));
+}
+
+void SimilarityIndex::updateAsync(const QString& jsonPath)
+{
+    mPool.start(new SimilarityUpdateTask(this, jsonPath));
+}
+
+SimilarityIndex::Signature SimilarityIndex::signature(const QJsonObject& data)
+{
+    Signature signature;
+    auto hashes = data["hashes"].toObject();
+    signature.imphash = hashes["imphash"].toString().toLower();
+    signature.ssdeep = hashes["ssdeep"].toString();
+    parseSsdeep(signature);
+
+    std::fill(signature.minHash, signature.minHash + MinHashCount, quint32(0xFFFFFFFF));
+    // Entries look like ["GetCurrentProcessId", "0x62c64749"]
+    for(const auto& entry : data["imports"].toObject()["results"].toObject()["import_hashes"].toArray())
+    {
+        auto value = entry.toArray().at(1).toString().toLower();
+        if(value.isEmpty())
+            continue;
+        signature.hasImports = true;
+        auto hash = fnv1a(value.toUtf8());
+        for(int i = 0; i < MinHashCount; i++)
+        {
+            auto h = mix(hash ^ mix(quint32(i) * 0x9E3779B9u + 1));
+            signature.minHash[i] = std::min(signature.minHash[i], h);
+        }
+    }
+    return signature;
+}
+
+QList<quint64> SimilarityIndex::ssdeepKeys(const Signature& signature)
+{
+    // 7-grams of the first chunk at the block size and of the second chunk at twice the block
+    // size, reports can only be compared when they share one at the same (effective) block size
+    QList<quint64> keys;
+    if(signature.blocksize == 0)
+        return keys;
+    for(auto gram : signature.grams1)
+        keys.append((quint64(signature.blocksize) << 32) | gram);
+    for(auto gram : signature.grams2)
+        keys.append((quint64(signature.blocksize * 2) << 32) | gram);
+    return keys;
+}
+
+QList<quint64> SimilarityIndex::bandKeys(const Signature& signature)
+{
+    QList<quint64> keys;
+    if(!signature.hasImports)
+        return keys;
+    for(int band = 0; band < MinHashCount / BandRows; band++)
+    {
+        auto hash = fnv1a(QByteArray::fromRawData((const char*)(signature.minHash + band * BandRows), BandRows * sizeof(quint32)));
+        keys.append((quint64(band) << 32) | hash);
+    }
+    return keys;
+}
+
+void SimilarityIndex::addLocked(const Document& document)
+{
+    auto existing = mDocumentIds.constFind(document.path);
+    if(existing != mDocumentIds.constEnd())
+        removeLocked(existing.value());
+
+    auto id = quint32(mDocuments.size());
+    mDocuments.append(document);
+    mDocumentIds.insert(document.path, id);
+
+    const auto& signature = document.signature;
+    if(!signature.imphash.isEmpty())
+        mImphashBuckets[signature.imphash].append(id);
+    for(auto key : ssdeepKeys(signature))
+        mSsdeepBuckets[key].append(id);
+    for(auto key : bandKeys(signature))
+        mBandBuckets[key].append(id);
+    mDirty = true;
+
+    // Tombstones take bucket space and query time, drop them once they outnumber the live reports
+    if(mRemoved > 64 && mRemoved > mDocumentIds.size())
+        compactLocked();
+}
+
+void SimilarityIndex::removeLocked(quint32 id)
+{
+    auto& document = mDocuments[id];
+    document.removed = true;
+    mDocumentIds.remove(document.path);
+    mRemoved++;
+    mDirty = true;
+}
+
+void SimilarityIndex::compactLocked()
+{
+    if(mRemoved == 0)
+        return;
+    QVector<Document> documents;
+    for(const auto& document : mDocuments)
+    {
+        if(!document.removed)
+            documents.append(document);
+    }
+    mDocuments.clear();
+    mDocumentIds.clear();
+    mImphashBuckets.clear();
+    mSsdeepBuckets.clear();
+    mBandBuckets.clear();
+    mRemoved = 0;
+    for(const auto& document : documents)
+        addLocked(document);
+}
+
+void SimilarityIndex::update(const QString& jsonPath, const QJsonObject& data)
+{
+    QFileInfo info(jsonPath);
+    Document document;
+    document.path = ReportCache::nativePath(jsonPath);
+    document.modified = info.lastModified().toMSecsSinceEpoch();
+    document.size = info.size();
+    document.signature = signature(data);
+
+    QMutexLocker lock(&mLock);
+    addLocked(document);
+}
+
+void SimilarityIndex::updateFile(const QString& jsonPath)
+{
+    auto path = ReportCache::nativePath(jsonPath);
+    QFileInfo info(path);
+    {
+        QMutexLocker lock(&mLock);
+        loadOnceLocked();
+        // Jobs that found their report in the cache finish with an indexed report
+        auto itr = mDocumentIds.constFind(path);
+        if(itr != mDocumentIds.constEnd() && mDocuments[itr.value()].modified == info.lastModified().toMSecsSinceEpoch() && mDocuments[itr.value()].size == info.size())
+            return;
+    }
+    if(mStop)
+        return;
+    auto data = ReportCache::readReport(path);
+    if(!data.isEmpty())
+        update(path, data);
+}
+
+void SimilarityIndex::loadOnceLocked()
+{
+    if(mLoaded)
+        return;
+    load();
+    mLoaded = true;
+}
+
+void SimilarityIndex::rescan()
+{
+    mRescanQueued = false;
+    {
+        QMutexLocker lock(&mLock);
+        loadOnceLocked();
+    }
+
+    QSet<QString> present;
+    bool changed = false;
+    // Reports written after the listing (update()) are not in it
+    auto listed = QDateTime::currentMSecsSinceEpoch();
+    auto files = QDir(mDirectory).entryInfoList(QStringList() << "*.json", QDir::Files);
+    for(const auto& file : files)
+    {
+        if(mStop)
+            return;
+
+        Document document;
+        document.path = ReportCache::nativePath(file.filePath());
+        document.modified = file.lastModified().toMSecsSinceEpoch();
+        document.size = file.size();
+        present.insert(document.path);
+        {
+            QMutexLocker lock(&mLock);
+            auto itr = mDocumentIds.constFind(document.path);
+            if(itr != mDocumentIds.constEnd())
+            {
+                const auto& existing = mDocuments[itr.value()];
+                if(existing.modified == document.modified && existing.size == document.size)
+                    continue;
+            }
+        }
+
+        QFile f(document.path);
+        if(!f.open(QIODevice::ReadOnly))
+            continue;
+        document.signature = signature(QJsonDocument::fromJson(f.readAll()).object()["data"].toObject());
+
+        QMutexLocker lock(&mLock);
+        addLocked(document);
+        changed = true;
+    }
+
+    int documents = 0;
+    {
+        QMutexLocker lock(&mLock);
+        QList<quint32> missing;
+        for(auto itr = mDocumentIds.constBegin(); itr != mDocumentIds.constEnd(); ++itr)
+        {
+            if(!present.contains(itr.key()) && mDocuments[itr.value()].modified < listed)
+                missing.append(itr.value());
+        }
+        for(auto id : missing)
+            removeLocked(id);
+        if(!missing.isEmpty())
+            changed = true;
+        documents = mDocumentIds.size();
+    }
+
+    if(changed)
+        save();
+    emit rescanFinished(documents);
+}
+
+QList<SimilarityIndex::Match> SimilarityIndex::similar(const QJsonObject& data, const QString& excludePath, int limit) const
+{
+    auto query = signature(data);
+    auto queryKeys = ssdeepKeys(query);
+    auto queryBands = bandKeys(query);
+    auto exclude = excludePath.isEmpty() ? QString() : ReportCache::nativePath(excludePath);
+
+    QList<Match> matches;
+    QMutexLocker lock(&mLock);
+
+    QSet<quint32> candidates;
+    auto addBucket = [&](const QVector<quint32>& bucket)
+    {
+        // Replaced and deleted reports do not take the place of live ones
+        for(auto id : bucket)
+        {
+            if(candidates.size() >= MaxCandidates)
+                return;
+            const auto& document = mDocuments[id];
+            if(!document.removed && document.path != exclude)
+                candidates.insert(id);
+        }
+    };
+    if(!query.imphash.isEmpty())
+        addBucket(mImphashBuckets.value(query.imphash));
+    for(auto key : queryKeys)
+        addBucket(mSsdeepBuckets.value(key));
+    for(auto key : queryBands)
+        addBucket(mBandBuckets.value(key));
+
+    for(auto id : candidates)
+    {
+        const auto& document = mDocuments[id];
+        const auto& signature = document.signature;
+        Match match;
+        match.jsonPath = document.path;
+        match.module = mCache->moduleName(document.path);
+        match.imphash = !query.imphash.isEmpty() && query.imphash == signature.imphash;
+        if(!query.ssdeep.isEmpty() && !signature.ssdeep.isEmpty())
+            match.ssdeep = compareSsdeep(query, signature);
+        if(query.hasImports && signature.hasImports)
+        {
+            int equal = 0;
+            for(int i = 0; i < MinHashCount; i++)
+                if(query.minHash[i] == signature.minHash[i])
+                    equal++;
+            match.imports = double(equal) / MinHashCount;
+        }
+        match.score = std::max(std::max(match.imphash ? 100 : 0, match.ssdeep), int(match.imports * 100 + 0.5));
+        if(match.score > 0)
+            matches.append(match);
+    }
+
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b)
+    {
+        return a.score > b.score;
+    });
+    if(matches.size() > limit)
+        matches.erase(matches.begin() + limit, matches.end());
+    return matches;
+}
+
+int SimilarityIndex::documentCount() const
+{
+    QMutexLocker lock(&mLock);
+    return mDocumentIds.size();
+}
+
+bool SimilarityIndex::load()
+{
+    QFile f(mIndexPath);
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0, count = 0;
+    stream >> magic >> version >> count;
+    if(magic != IndexMagic || version != IndexVersion)
+        return false;
+
+    QVector<Document> documents;
+    for(quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++)
+    {
+        Document document;
+        auto& signature = document.signature;
+        stream >> document.path >> document.modified >> document.size >> signature.imphash >> signature.ssdeep >> signature.hasImports;
+        for(int j = 0; j < MinHashCount; j++)
+            stream >> signature.minHash[j];
+        parseSsdeep(signature);
+        documents.append(document);
+    }
+
+    // A damaged index is rebuilt by the rescan
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    for(const auto& document : documents)
+        addLocked(document);
+    mDirty = false;
+    return true;
+}
+
+bool SimilarityIndex::save()
+{
+    QMutexLocker lock(&mLock);
+    compactLocked();
+    QSaveFile f(mIndexPath);
+    if(!f.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << IndexMagic << IndexVersion << quint32(mDocumentIds.size());
+    for(auto id : mDocumentIds)
+    {
+        const auto& document = mDocuments[id];
+        const auto& signature = document.signature;
+        stream << document.path << document.modified << document.size << signature.imphash << signature.ssdeep << signature.hasImports;
+        for(int j = 0; j < MinHashCount; j++)
+            stream << signature.minHash[j];
+    }
+
+    if(stream.status() != QDataStream::Ok || !f.commit())
+        return false;
+    mDirty = false;
+    return true;
+}
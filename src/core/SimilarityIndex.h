@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QJsonObject>
+
+#include <atomic>
+
+class ReportCache;
+
+// Nearest-neighbour index over the reports in a ReportCache. Candidates come from buckets
+// instead of a scan over every report:
+// - exact buckets on hashes.imphash
+// - ssdeep 7-gram buckets per (block size, chunk), scored with the ssdeep edit distance
+// - MinHash signatures over imports.import_hashes with LSH banding, scored by estimated Jaccard
+// Only the per-report signatures are persisted (similarity.idx), the buckets are rebuilt on load.
+// All methods are thread-safe, rescans run on a background thread.
+class SimilarityIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MinHashCount = 64;
+    static const int BandRows = 4; // MinHashCount / BandRows bands
+
+    struct Match
+    {
+        QString jsonPath;
+        QString module;
+        bool imphash = false;
+        int ssdeep = -1;     // 0-100, -1 if not comparable
+        double imports = -1; // estimated Jaccard similarity, -1 if not comparable
+        int score = 0;       // best of the above, 0-100
+    };
+
+    explicit SimilarityIndex(const ReportCache* cache, QObject* parent = nullptr);
+    ~SimilarityIndex();
+
+    // Calls while a rescan is queued are merged into it
+    void rescanAsync();
+    void update(const QString& jsonPath, const QJsonObject& data);
+    // update() on the background thread, the report is only parsed if it changed since it was indexed
+    void updateAsync(const QString& jsonPath);
+    // Most similar reports first, the report at excludePath is skipped
+    QList<Match> similar(const QJsonObject& data, const QString& excludePath = QString(), int limit = 10) const;
+    int documentCount() const;
+    bool save();
+
+    static int compareSsdeep(const QString& a, const QString& b);
+
+signals:
+    void rescanFinished(int documents);
+
+private:
+    friend class SimilarityRescanTask;
+    friend class SimilarityUpdateTask;
+
+    struct Signature
+    {
+        QString imphash;
+        QString ssdeep;
+        bool hasImports = false;
+        quint32 minHash[MinHashCount];
+
+        // Parsed ssdeep (not persisted, see parseSsdeep), blocksize is 0 if there is none
+        quint32 blocksize = 0;
+        QString chunk1;
+        QString chunk2;
+        QVector<quint32> grams1; // hashes of the 7-grams of the chunk, sorted
+        QVector<quint32> grams2;
+    };
+
+    struct Document
+    {
+        QString path;
+        qint64 modified = 0;
+        qint64 size = 0;
+        bool removed = false;
+        Signature signature;
+    };
+
+    static Signature signature(const QJsonObject& data);
+    static void parseSsdeep(Signature& signature);
+    static int compareSsdeep(const Signature& a, const Signature& b);
+    static QList<quint64> ssdeepKeys(const Signature& signature);
+    static QList<quint64> bandKeys(const Signature& signature);
+    void rescan();
+    void updateFile(const QString& jsonPath);
+    void loadOnceLocked();
+    bool load();
+    void addLocked(const Document& document);
+    void removeLocked(quint32 id);
+    void compactLocked();
+
+    const ReportCache* mCache = nullptr;
+    QString mDirectory;
+    QString mIndexPath;
+    mutable QMutex mLock;
+    QVector<Document> mDocuments;
+    QHash<QString, quint32> mDocumentIds; // path -> id of the live document
+    QHash<QString, QVector<quint32>> mImphashBuckets;
+    QHash<quint64, QVector<quint32>> mSsdeepBuckets;
+    QHash<quint64, QVector<quint32>> mBandBuckets;
+    int mRemoved = 0; // tombstones in mDocuments and the buckets
+    bool mLoaded = false;
+    bool mDirty = false;
+    QThreadPool mPool;
+    std::atomic<bool> mStop;
+    std::atomic<bool> mRescanQueued;
+};
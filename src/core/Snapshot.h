@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Immutable value that is read lock-free from debugger callbacks and replaced atomically.
+// Readers only touch atomics (no locks, no allocation). The writer swaps the pointer and then
+// waits for readers of the previous value to drain before deleting it (two-counter grace period).
+template<typename T>
+class Snapshot
+{
+public:
+    class Reader
+    {
+    public:
+        explicit Reader(Snapshot& snapshot)
+            : mSnapshot(snapshot)
+        {
+            mParity = mSnapshot.mEpoch.load() & 1;
+            mSnapshot.mReaders[mParity].fetch_add(1);
+            mValue = mSnapshot.mCurrent.load();
+        }
+
+        ~Reader()
+        {
+            mSnapshot.mReaders[mParity].fetch_sub(1);
+        }
+
+        const T* get() const { return mValue; }
+        const T* operator->() const { return mValue; }
+        explicit operator bool() const { return mValue != nullptr; }
+
+    private:
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        Snapshot& mSnapshot;
+        unsigned mParity;
+        const T* mValue;
+    };
+
+    Snapshot()
+    {
+        mCurrent.store(nullptr);
+        mEpoch.store(0);
+        mReaders[0].store(0);
+        mReaders[1].store(0);
+    }
+
+    ~Snapshot()
+    {
+        delete mCurrent.load();
+    }
+
+    void publish(std::unique_ptr<const T> value)
+    {
+        std::lock_guard<std::mutex> lock(mWriteLock);
+        std::unique_ptr<const T> previous(mCurrent.exchange(value.release()));
+        if(!previous)
+            return;
+
+        // Flip twice so readers from either parity that could still see the previous value are gone
+        for(int i = 0; i < 2; i++)
+        {
+            auto parity = mEpoch.fetch_add(1) & 1;
+            while(mReaders[parity].load() != 0)
+                std::this_thread::yield();
+        }
+    }
+
+    bool empty() const
+    {
+        return mCurrent.load() == nullptr;
+    }
+
+private:
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    std::atomic<const T*> mCurrent;
+    std::atomic<unsigned> mEpoch;
+    std::atomic<int> mReaders[2];
+    std::mutex mWriteLock;
+};
@@ -0,0 +1,129 @@
+#include "StallWatchdog.h"
+#include "PerfTrace.h"
+
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
+
+#include <cstring>
+
+static const char LogMagic[4] = { 'M', 'S', 'T', 'L' };
+static const quint32 LogVersion = 1;
+
+StallWatchdog::StallWatchdog(const QString& logPath, int thresholdMs, QObject* parent)
+    : QThread(parent)
+    , mLogPath(logPath)
+    , mThreshold(qMax(10, thresholdMs))
+    , mLastBeat(0)
+{
+    mClock.start();
+    PerfTrace::watchThread(QThread::currentThreadId());
+
+    // The timer lives in the owning thread, if its event loop blocks the beats stop
+    mHeartbeatTimer = new QTimer(this);
+    mHeartbeatTimer->setInterval(qMax(10, mThreshold / 4));
+    connect(mHeartbeatTimer, &QTimer::timeout, this, &StallWatchdog::heartbeat);
+    mHeartbeatTimer->start();
+    heartbeat();
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    requestInterruption();
+    wait();
+}
+
+void StallWatchdog::heartbeat()
+{
+    mLastBeat = mClock.elapsed();
+}
+
+void StallWatchdog::run()
+{
+    auto interval = qMax(5, mThreshold / 4);
+    bool stalled = false;
+    Stall stall;
+    while(!isInterruptionRequested())
+    {
+        msleep(interval);
+
+        auto lastBeat = mLastBeat.load();
+        auto silence = mClock.elapsed() - lastBeat;
+        if(silence > mThreshold)
+        {
+            if(!stalled)
+            {
+                stalled = true;
+                stall = Stall();
+                stall.start = QDateTime::currentMSecsSinceEpoch() - silence;
+            }
+            // Keep the first plugin operation seen during the stall
+            if(stall.phase.isEmpty())
+            {
+                if(auto phase = PerfTrace::activePhase())
+                    stall.phase = QString::fromUtf8(phase);
+            }
+            stall.duration = quint32(silence);
+        }
+        else if(stalled)
+        {
+            stalled = false;
+            writeStall(stall);
+        }
+    }
+
+    // Still stalled while shutting down
+    if(stalled)
+        writeStall(stall);
+}
+
+void StallWatchdog::writeStall(const Stall& stall)
+{
+    QFile f(mLogPath);
+    if(!f.open(QIODevice::ReadWrite))
+        return;
+
+    QDataStream stream(&f);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    if(f.size() == 0)
+    {
+        stream.writeRawData(LogMagic, sizeof(LogMagic));
+        stream << LogVersion;
+    }
+    f.seek(f.size());
+
+    auto phase = stall.phase.toUtf8();
+    stream << stall.start << stall.duration << quint16(phase.size());
+    stream.writeRawData(phase.constData(), phase.size());
+}
+
+QList<StallWatchdog::Stall> StallWatchdog::readLog(const QString& path)
+{
+    QList<Stall> stalls;
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly))
+        return stalls;
+
+    QDataStream stream(&f);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    char magic[sizeof(LogMagic)];
+    quint32 version = 0;
+    if(stream.readRawData(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, LogMagic, sizeof(magic)) != 0)
+        return stalls;
+    stream >> version;
+    if(version != LogVersion)
+        return stalls;
+
+    while(!stream.atEnd())
+    {
+        Stall stall;
+        quint16 length = 0;
+        stream >> stall.start >> stall.duration >> length;
+        QByteArray phase(length, Qt::Uninitialized);
+        if(stream.readRawData(phase.data(), length) != length || stream.status() != QDataStream::Ok)
+            break; // truncated record
+        stall.phase = QString::fromUtf8(phase);
+        stalls.append(stall);
+    }
+    return stalls;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+
+#include <atomic>
+
+// Detects stalls of the thread that owns the watchdog (the GUI thread) by heartbeating its event
+// loop from a QTimer and checking the last beat from a separate thread. Every stall longer than
+// the threshold is appended to a binary log together with the PerfTrace phase that was active.
+//
+// Log format (little endian): "MSTL" magic, uint32 version, then one record per stall:
+// int64 start (ms since epoch), uint32 duration (ms), uint16 phase length, phase (UTF-8).
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+
+public:
+    StallWatchdog(const QString& logPath, int thresholdMs, QObject* parent = nullptr);
+    ~StallWatchdog();
+
+    QString logPath() const { return mLogPath; }
+    int threshold() const { return mThreshold; }
+
+    struct Stall
+    {
+        qint64 start = 0;
+        quint32 duration = 0;
+        QString phase; // empty if no plugin scope was active
+    };
+
+    static QList<Stall> readLog(const QString& path);
+
+protected:
+    void run() override;
+
+private:
+    void heartbeat();
+    void writeStall(const Stall& stall);
+
+    QString mLogPath;
+    int mThreshold;
+    QTimer* mHeartbeatTimer = nullptr;
+    QElapsedTimer mClock;
+    std::atomic<qint64> mLastBeat;
+};
@@ -0,0 +1,384 @@
+#include "TraceQuery.h"
+
+#include <QHash>
+#include <QStringList>
+
+#include <algorithm>
+#include <numeric>
+
+static bool parseAddress(const QString& text, uint64_t& address)
+{
+    // Hexadecimal as x64dbg shows addresses, the 0x is optional. Without it a decimal digit is
+    // required, so words like "add" or "dead" stay text.
+    auto prefixed = text.startsWith("0x", Qt::CaseInsensitive);
+    auto digits = prefixed ? text.mid(2) : text;
+    if(digits.isEmpty())
+        return false;
+    if(!prefixed && !std::any_of(digits.begin(), digits.end(), [](QChar ch) { return ch.isDigit(); }))
+        return false;
+    bool ok = false;
+    address = digits.toULongLong(&ok, 16);
+    return ok;
+}
+
+static bool parseAddressRange(const QString& token, uint64_t& minAddress, uint64_t& maxAddress)
+{
+    // "1000" is a single address, "1000-2000", "1000-" and "-2000" are ranges
+    auto dash = token.indexOf('-');
+    if(dash == -1)
+    {
+        uint64_t address = 0;
+        if(!parseAddress(token, address))
+            return false;
+        minAddress = maxAddress = address;
+        return true;
+    }
+
+    auto left = token.left(dash);
+    auto right = token.mid(dash + 1);
+    if(left.isEmpty() && right.isEmpty())
+        return false;
+    uint64_t low = 0, high = ~uint64_t(0);
+    if(!left.isEmpty() && !parseAddress(left, low))
+        return false;
+    if(!right.isEmpty() && !parseAddress(right, high))
+        return false;
+    minAddress = low;
+    maxAddress = high;
+    return true;
+}
+
+TraceQuery::Filter TraceQuery::Filter::parse(const QString& query)
+{
+    Filter filter;
+    QStringList text;
+    for(const auto& token : query.split(' ', QString::SkipEmptyParts))
+    {
+        auto lower = token.toLower();
+        if(lower.startsWith("dll:"))
+            filter.dll = token.mid(4);
+        else if(lower.startsWith("fn:"))
+            filter.function = token.mid(3);
+        else if(lower == "sus" || lower == "suspicious")
+            filter.suspiciousOnly = true;
+        else if(parseAddressRange(token, filter.minAddress, filter.maxAddress))
+            filter.hasRange = true;
+        else
+            text.append(token);
+    }
+    filter.text = text.join(' ');
+    return filter;
+}
+
+TraceQuery::TraceQuery(std::shared_ptr<const TraceStore> trace)
+    : mTrace(std::move(trace))
+{
+    buildPostings(&TraceStore::dllId, mDllPostings);
+    buildPostings(&TraceStore::functionId, mFunctionPostings);
+
+    // Intern the DLL.function pairs for group-by
+    const auto& store = *mTrace;
+    QHash<quint64, quint32> apis;
+    mApiIds.resize(store.size());
+    for(int row = 0; row < store.size(); row++)
+    {
+        auto key = (quint64(store.dllId(row)) << 32) | store.functionId(row);
+        auto itr = apis.constFind(key);
+        if(itr == apis.constEnd())
+            itr = apis.insert(key, quint32(apis.size()));
+        mApiIds[row] = itr.value();
+    }
+    mApiCount = apis.size();
+
+    // Sorting a million rows takes far longer than a keystroke may, every column is sorted here
+    for(int column = ColumnAddress; column < ColumnCount; column++)
+    {
+        buildPermutation(Column(column));
+        const auto& order = mPermutations[column];
+        auto& rank = mRanks[column];
+        rank.resize(order.size());
+        for(int i = 0; i < order.size(); i++)
+            rank[order[i]] = i;
+    }
+}
+
+qint64 TraceQuery::memoryUsage() const
+{
+    qint64 size = mDllPostings.offsets.size() + mDllPostings.rows.size() + mFunctionPostings.offsets.size() + mFunctionPostings.rows.size();
+    size += mApiIds.size();
+    for(int column = 0; column < ColumnCount; column++)
+        size += mPermutations[column].size() + mRanks[column].size();
+    return size * sizeof(int);
+}
+
+void TraceQuery::buildPostings(quint32 (TraceStore::*id)(int) const, Postings& postings)
+{
+    // Counting sort of the rows by id, rows stay in ascending order within an id
+    const auto& store = *mTrace;
+    postings.offsets.fill(0, store.nameCount() + 1);
+    for(int row = 0; row < store.size(); row++)
+        postings.offsets[(store.*id)(row) + 1]++;
+    for(int i = 1; i < postings.offsets.size(); i++)
+        postings.offsets[i] += postings.offsets[i - 1];
+
+    auto next = postings.offsets;
+    postings.rows.resize(store.size());
+    for(int row = 0; row < store.size(); row++)
+        postings.rows[next[(store.*id)(row)]++] = row;
+}
+
+template<typename Less>
+static void sortRows(QVector<int>& order, int rows, Less less)
+{
+    order.resize(rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), less);
+}
+
+void TraceQuery::buildPermutation(Column column)
+{
+    auto& order = mPermutations[column];
+    const auto& store = *mTrace;
+
+    auto byName = [&](const Postings& postings)
+    {
+        QVector<quint32> names(store.nameCount());
+        std::iota(names.begin(), names.end(), 0);
+        std::stable_sort(names.begin(), names.end(), [&store](quint32 a, quint32 b)
+        {
+            return store.name(a).compare(store.name(b), Qt::CaseInsensitive) < 0;
+        });
+        order.reserve(store.size());
+        for(auto id : names)
+        {
+            for(int i = postings.offsets[id]; i < postings.offsets[id + 1]; i++)
+                order.append(postings.rows[i]);
+        }
+    };
+
+    switch(column)
+    {
+    case ColumnDll:
+        byName(mDllPostings);
+        break;
+
+    case ColumnFunction:
+        byName(mFunctionPostings);
+        break;
+
+    case ColumnAddress:
+        sortRows(order, store.size(), [&store](int a, int b)
+        {
+            return store.address(a) < store.address(b);
+        });
+        break;
+
+    case ColumnArguments:
+        // Argument by argument, a list that is a prefix of another comes first
+        sortRows(order, store.size(), [&store](int a, int b)
+        {
+            auto count = qMin(store.argumentCount(a), store.argumentCount(b));
+            for(int i = 0; i < count; i++)
+            {
+                auto result = store.compareStrings(store.argumentId(a, i), store.argumentId(b, i));
+                if(result != 0)
+                    return result < 0;
+            }
+            return store.argumentCount(a) < store.argumentCount(b);
+        });
+        break;
+
+    case ColumnReturn:
+        sortRows(order, store.size(), [&store](int a, int b)
+        {
+            return store.compareStrings(store.returnValueId(a), store.returnValueId(b)) < 0;
+        });
+        break;
+
+    default:
+        break;
+    }
+}
+
+QVector<char> TraceQuery::matchNames(const QString& needle) const
+{
+    const auto& store = *mTrace;
+    QVector<char> match(store.nameCount(), 1);
+    if(needle.startsWith('='))
+    {
+        auto name = needle.mid(1);
+        for(int id = 0; id < store.nameCount(); id++)
+            match[id] = store.name(id).compare(name, Qt::CaseInsensitive) == 0;
+    }
+    else if(!needle.isEmpty())
+    {
+        for(int id = 0; id < store.nameCount(); id++)
+            match[id] = store.name(id).contains(needle, Qt::CaseInsensitive);
+    }
+    return match;
+}
+
+QVector<int> TraceQuery::rows(const Filter& filter, Column sortColumn, bool descending) const
+{
+    const auto& store = *mTrace;
+    auto dllMatch = matchNames(filter.dll);
+    auto functionMatch = matchNames(filter.function);
+    auto textMatch = matchNames(filter.text);
+    auto ranged = filter.hasRange;
+
+    auto accept = [&](int row)
+    {
+        if(filter.suspiciousOnly && !store.suspicious(row))
+            return false;
+        auto dll = store.dllId(row);
+        auto function = store.functionId(row);
+        if(!dllMatch[dll] || !functionMatch[function] || (!textMatch[dll] && !textMatch[function]))
+            return false;
+        if(ranged)
+        {
+            auto address = store.address(row);
+            if(address == TraceStore::InvalidAddress || address < filter.minAddress || address > filter.maxAddress)
+                return false;
+        }
+        return true;
+    };
+
+    // Find the most selective index to get the candidate rows from
+    enum Source { SourceAll, SourceDll, SourceFunction, SourceAddress } source = SourceAll;
+    int candidates = store.size();
+    auto postingsSize = [](const Postings& postings, const QVector<char>& match)
+    {
+        int size = 0;
+        for(int id = 0; id < match.size(); id++)
+            if(match[id])
+                size += postings.offsets[id + 1] - postings.offsets[id];
+        return size;
+    };
+    if(!filter.dll.isEmpty())
+    {
+        auto size = postingsSize(mDllPostings, dllMatch);
+        if(size < candidates)
+        {
+            source = SourceDll;
+            candidates = size;
+        }
+    }
+    if(!filter.function.isEmpty())
+    {
+        auto size = postingsSize(mFunctionPostings, functionMatch);
+        if(size < candidates)
+        {
+            source = SourceFunction;
+            candidates = size;
+        }
+    }
+    const int* rangeBegin = nullptr;
+    const int* rangeEnd = nullptr;
+    if(ranged)
+    {
+        const auto& byAddress = mPermutations[ColumnAddress];
+        rangeBegin = std::lower_bound(byAddress.constBegin(), byAddress.constEnd(), filter.minAddress, [&store](int row, uint64_t address)
+        {
+            return store.address(row) < address;
+        });
+        rangeEnd = std::upper_bound(rangeBegin, byAddress.constEnd(), filter.maxAddress, [&store](uint64_t address, int row)
+        {
+            return address < store.address(row);
+        });
+        if(rangeEnd - rangeBegin < candidates)
+        {
+            source = SourceAddress;
+            candidates = int(rangeEnd - rangeBegin);
+        }
+    }
+
+    QVector<int> result;
+    if(source != SourceAll && candidates < store.size() / 4)
+    {
+        // Few candidates: filter them and sort by the column ranks
+        result.reserve(candidates);
+        auto gather = [&](const Postings& postings, const QVector<char>& match)
+        {
+            for(int id = 0; id < match.size(); id++)
+            {
+                if(!match[id])
+                    continue;
+                for(int i = postings.offsets[id]; i < postings.offsets[id + 1]; i++)
+                    if(accept(postings.rows[i]))
+                        result.append(postings.rows[i]);
+            }
+        };
+        switch(source)
+        {
+        case SourceDll:
+            gather(mDllPostings, dllMatch);
+            break;
+        case SourceFunction:
+            gather(mFunctionPostings, functionMatch);
+            break;
+        default:
+            for(auto itr = rangeBegin; itr != rangeEnd; ++itr)
+                if(accept(*itr))
+                    result.append(*itr);
+            break;
+        }
+
+        if(sortColumn == ColumnRow)
+        {
+            std::sort(result.begin(), result.end());
+        }
+        else
+        {
+            const auto& rank = mRanks[sortColumn];
+            std::sort(result.begin(), result.end(), [&rank](int a, int b)
+            {
+                return rank[a] < rank[b];
+            });
+        }
+    }
+    else
+    {
+        // Scan the rows in the order of the sort column
+        if(sortColumn == ColumnRow)
+        {
+            for(int row = 0; row < store.size(); row++)
+                if(accept(row))
+                    result.append(row);
+        }
+        else
+        {
+            for(auto row : mPermutations[sortColumn])
+                if(accept(row))
+                    result.append(row);
+        }
+    }
+
+    if(descending)
+        std::reverse(result.begin(), result.end());
+    return result;
+}
+
+QVector<TraceQuery::Group> TraceQuery::groups(const QVector<int>& rows) const
+{
+    const auto& store = *mTrace;
+    QVector<Group> groups(mApiCount);
+    for(auto row : rows)
+    {
+        auto& group = groups[mApiIds[row]];
+        group.dllId = store.dllId(row);
+        group.functionId = store.functionId(row);
+        group.calls++;
+        if(store.suspicious(row))
+            group.suspicious++;
+    }
+
+    QVector<Group> result;
+    for(const auto& group : groups)
+        if(group.calls > 0)
+            result.append(group);
+    std::stable_sort(result.begin(), result.end(), [](const Group& a, const Group& b)
+    {
+        return a.calls > b.calls;
+    });
+    return result;
+}
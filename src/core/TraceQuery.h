@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QVector>
+#include <QString>
+
+#include <memory>
+
+#include "TraceStore.h"
+
+// Filter, sort and group-by over a TraceStore. Per-column indexes (posting lists per DLL and
+// function, sort permutations and ranks) are built by the constructor, so a query is a single pass
+// over a posting list or a permutation and stays well within a frame for a million rows. Construct
+// it where the trace is built (off the GUI thread), it is immutable and thread-safe afterwards.
+class TraceQuery
+{
+public:
+    enum Column
+    {
+        ColumnRow,
+        ColumnAddress,
+        ColumnDll,
+        ColumnFunction,
+        ColumnArguments,
+        ColumnReturn,
+        ColumnCount
+    };
+
+    struct Filter
+    {
+        QString dll;      // case-insensitive substrings ("=name" for an exact match), empty matches everything
+        QString function;
+        QString text;     // matches either the DLL or the function
+        bool suspiciousOnly = false;
+        bool hasRange = false;
+        uint64_t minAddress = 0;
+        uint64_t maxAddress = ~uint64_t(0); // inclusive
+
+        // Query bar syntax: "dll:kernel32 fn:=VirtualAlloc sus 140001000-0x140002000 other text"
+        static Filter parse(const QString& query);
+    };
+
+    struct Group
+    {
+        quint32 dllId = 0;
+        quint32 functionId = 0;
+        int calls = 0;
+        int suspicious = 0;
+    };
+
+    explicit TraceQuery(std::shared_ptr<const TraceStore> trace);
+
+    const TraceStore& trace() const { return *mTrace; }
+    QVector<int> rows(const Filter& filter, Column sortColumn, bool descending) const;
+    // Calls per DLL.function over the rows, most called first
+    QVector<Group> groups(const QVector<int>& rows) const;
+    // Approximate heap size of the indexes in bytes (without the trace)
+    qint64 memoryUsage() const;
+
+private:
+    struct Postings
+    {
+        QVector<int> offsets; // per id, plus an end marker
+        QVector<int> rows;
+    };
+
+    void buildPostings(quint32 (TraceStore::*id)(int) const, Postings& postings);
+    void buildPermutation(Column column);
+    QVector<char> matchNames(const QString& needle) const;
+
+    std::shared_ptr<const TraceStore> mTrace;
+    Postings mDllPostings;
+    Postings mFunctionPostings;
+    QVector<quint32> mApiIds; // per row, DLL.function pair
+    int mApiCount = 0;
+    QVector<int> mPermutations[ColumnCount]; // empty for ColumnRow
+    QVector<int> mRanks[ColumnCount];
+};
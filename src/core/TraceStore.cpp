@@ -0,0 +1,104 @@
+#include "TraceStore.h"
+#include "MalcoreReport.h"
+
+#include <QJsonObject>
+
+std::unique_ptr<TraceStore> TraceStore::build(const QJsonArray& parsedOutput, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize)
+{
+    std::unique_ptr<TraceStore> store(new TraceStore());
+    store->mLoadedBase = loadedBase;
+    store->mHeaderBase = headerBase;
+    store->mImageSize = imageSize;
+
+    auto rows = parsedOutput.count();
+    store->mAddresses.reserve(rows);
+    store->mDllIds.reserve(rows);
+    store->mFunctionIds.reserve(rows);
+    store->mRowStrings.reserve(rows + 1);
+    store->mSuspicious.resize(rows);
+    store->mStringOffsets.append(0);
+
+    for(int i = 0; i < rows; i++)
+    {
+        QJsonObject entry = parsedOutput[i].toObject();
+
+        bool ok = false;
+        auto location = entry["location"].toString();
+        uint64_t address = location.toULongLong(&ok, 0);
+        store->mAddresses.append(ok ? MalcoreAnalysis::rebase(address, loadedBase, headerBase, imageSize) : InvalidAddress);
+        store->mDllIds.append(store->intern(entry["dll_name"].toString()));
+        store->mFunctionIds.append(store->intern(entry["function_called"].toString()));
+        store->mSuspicious.setBit(i, entry["known_suspicious_function"].toBool());
+
+        store->mRowStrings.append(quint32(store->mStringOffsets.size() - 1));
+        store->addString(location);
+        auto result = entry["function_return_value"].toString();
+        store->addString(result.compare("none", Qt::CaseInsensitive) == 0 ? QString() : result);
+        for(const auto& argument : entry["arguments_passed"].toArray())
+            store->addString(argument.toString());
+    }
+    store->mRowStrings.append(quint32(store->mStringOffsets.size() - 1));
+
+    store->mAddresses.squeeze();
+    store->mDllIds.squeeze();
+    store->mFunctionIds.squeeze();
+    store->mStringOffsets.squeeze();
+    store->mPool.squeeze();
+    return store;
+}
+
+qint64 TraceStore::memoryUsage() const
+{
+    qint64 size = mAddresses.size() * sizeof(uint64_t);
+    size += (mDllIds.size() + mFunctionIds.size() + mRowStrings.size() + mStringOffsets.size()) * sizeof(quint32);
+    size += mSuspicious.size() / 8 + mPool.size();
+    // Every name is in the list and the hash
+    for(const auto& name : mNames)
+        size += 2 * name.size() * sizeof(QChar) + 32;
+    return size;
+}
+
+quint32 TraceStore::intern(const QString& name)
+{
+    auto itr = mNameIds.constFind(name);
+    if(itr != mNameIds.constEnd())
+        return itr.value();
+    auto id = quint32(mNames.size());
+    mNames.append(name);
+    mNameIds.insert(name, id);
+    return id;
+}
+
+void TraceStore::addString(const QString& str)
+{
+    mPool.append(str.toUtf8());
+    mStringOffsets.append(quint32(mPool.size()));
+}
+
+int TraceStore::compareStrings(quint32 a, quint32 b) const
+{
+    auto data = (const uchar*)mPool.constData();
+    auto aBegin = mStringOffsets[a];
+    auto aSize = mStringOffsets[a + 1] - aBegin;
+    auto bBegin = mStringOffsets[b];
+    auto bSize = mStringOffsets[b + 1] - bBegin;
+    auto size = qMin(aSize, bSize);
+    for(quint32 i = 0; i < size; i++)
+    {
+        auto ca = data[aBegin + i];
+        auto cb = data[bBegin + i];
+        if(ca >= 'A' && ca <= 'Z')
+            ca += 'a' - 'A';
+        if(cb >= 'A' && cb <= 'Z')
+            cb += 'a' - 'A';
+        if(ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    return aSize < bSize ? -1 : aSize > bSize ? 1 : 0;
+}
+
+QString TraceStore::string(quint32 index) const
+{
+    auto begin = mStringOffsets[index];
+    return QString::fromUtf8(mPool.constData() + begin, int(mStringOffsets[index + 1] - begin));
+}
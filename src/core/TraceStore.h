@@ -0,0 +1,84 @@
+#pragma once
+
+#include <QJsonArray>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QBitArray>
+#include <QVector>
+#include <QHash>
+
+#include <cstdint>
+#include <memory>
+
+// Struct-of-arrays copy of dynamic_analysis.parsed_output. DLL and function names are interned
+// into integer ids, locations are stored rebased in a contiguous array, the location text, return
+// value and arguments of every row are pooled in a single UTF-8 buffer and the suspicious flags are a
+// bitmap. A row costs a few dozen bytes instead of a QJsonObject with six QStrings, which
+// matters for traces with millions of calls.
+class TraceStore
+{
+public:
+    // Location that could not be parsed
+    static const uint64_t InvalidAddress = ~uint64_t(0);
+
+    static std::unique_ptr<TraceStore> build(const QJsonArray& parsedOutput, uintptr_t loadedBase, uintptr_t headerBase, uintptr_t imageSize);
+
+    int size() const { return mAddresses.size(); }
+
+    uint64_t address(int row) const { return mAddresses[row]; }
+    // Location as it appears in the report (not rebased, also if it is not an address)
+    QString location(int row) const { return string(mRowStrings[row]); }
+    quint32 dllId(int row) const { return mDllIds[row]; }
+    quint32 functionId(int row) const { return mFunctionIds[row]; }
+    const QString& dll(int row) const { return mNames[mDllIds[row]]; }
+    const QString& function(int row) const { return mNames[mFunctionIds[row]]; }
+    bool suspicious(int row) const { return mSuspicious.testBit(row); }
+    int argumentCount(int row) const { return int(mRowStrings[row + 1] - mRowStrings[row]) - 2; }
+    QString argument(int row, int index) const { return string(argumentId(row, index)); }
+    // Empty if the function did not return a value ("None" in the report)
+    QString returnValue(int row) const { return string(returnValueId(row)); }
+
+    // Pooled string ids, to order values with compareStrings() without decoding them
+    quint32 argumentId(int row, int index) const { return mRowStrings[row] + 2 + index; }
+    quint32 returnValueId(int row) const { return mRowStrings[row] + 1; }
+    // Case-insensitive for ASCII, by code point otherwise (UTF-8 keeps that order)
+    int compareStrings(quint32 a, quint32 b) const;
+
+    // Interned names, -1 if the name does not occur in the trace
+    int findName(const QString& name) const { return mNameIds.value(name, -1); }
+    const QString& name(quint32 id) const { return mNames[id]; }
+    int nameCount() const { return mNames.size(); }
+
+    uintptr_t loadedBase() const { return mLoadedBase; }
+    uintptr_t headerBase() const { return mHeaderBase; }
+    uintptr_t imageSize() const { return mImageSize; }
+    // Approximate heap size in bytes
+    qint64 memoryUsage() const;
+
+private:
+    TraceStore() = default;
+
+    quint32 intern(const QString& name);
+    void addString(const QString& str);
+    QString string(quint32 index) const;
+
+    // Columns (one entry per row)
+    QVector<uint64_t> mAddresses;
+    QVector<quint32> mDllIds;
+    QVector<quint32> mFunctionIds;
+    QVector<quint32> mRowStrings; // first pooled string (the location) of every row, plus an end marker
+    QBitArray mSuspicious;
+
+    // Interned names
+    QStringList mNames;
+    QHash<QString, quint32> mNameIds;
+
+    // Pooled strings, mStringOffsets has an end marker
+    QByteArray mPool;
+    QVector<quint32> mStringOffsets;
+
+    uintptr_t mLoadedBase = 0;
+    uintptr_t mHeaderBase = 0;
+    uintptr_t mImageSize = 0;
+};
@@ -0,0 +1,46 @@
+# Portable Malcore core (Qt Core + Network only, no x64dbg SDK)
+
+QT += core network
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/AnalysisEngine.cpp \
+    $$PWD/AutoAnalysisPolicy.cpp \
+    $$PWD/CircuitBreaker.cpp \
+    $$PWD/JobJournal.cpp \
+    $$PWD/MalcoreClient.cpp \
+    $$PWD/NotificationClient.cpp \
+    $$PWD/PerfTrace.cpp \
+    $$PWD/RateLimiter.cpp \
+    $$PWD/ReportCache.cpp \
+    $$PWD/ReportIndex.cpp \
+    $$PWD/ReportPrefetcher.cpp \
+    $$PWD/ReportRefresher.cpp \
+    $$PWD/ReportSearchIndex.cpp \
+    $$PWD/SessionCache.cpp \
+    $$PWD/SimilarityIndex.cpp \
+    $$PWD/StallWatchdog.cpp \
+    $$PWD/TraceQuery.cpp \
+    $$PWD/TraceStore.cpp
+
+HEADERS += \
+    $$PWD/AnalysisEngine.h \
+    $$PWD/AutoAnalysisPolicy.h \
+    $$PWD/CircuitBreaker.h \
+    $$PWD/JobJournal.h \
+    $$PWD/MalcoreClient.h \
+    $$PWD/MalcoreReport.h \
+    $$PWD/NotificationClient.h \
+    $$PWD/PerfTrace.h \
+    $$PWD/RateLimiter.h \
+    $$PWD/ReportCache.h \
+    $$PWD/ReportIndex.h \
+    $$PWD/ReportPrefetcher.h \
+    $$PWD/ReportRefresher.h \
+    $$PWD/ReportSearchIndex.h \
+    $$PWD/SessionCache.h \
+    $$PWD/SimilarityIndex.h \
+    $$PWD/Snapshot.h \
+    $$PWD/StallWatchdog.h \
+    $$PWD/TraceQuery.h \
+    $$PWD/TraceStore.h
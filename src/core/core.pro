@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Static library with the portable Malcore core
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = MalcoreCore
+TEMPLATE = lib
+CONFIG += staticlib c++11
+
+include(core.pri)
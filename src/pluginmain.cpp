@@ -1,5 +1,7 @@
 #include "pluginmain.h"
 #include "QtPlugin.h"
+#include "ReportIndex.h"
+#include "PluginCommands.h"
 #include <QDebug>
 
 int Plugin::handle;
@@ -32,6 +34,59 @@ PLUG_EXPORT void CBSTOPDEBUG(CBTYPE, PLUG_CB_STOPDEBUG*)
     QtPlugin::Event(QtPlugin::StopDebug, {});
 }
 
+PLUG_EXPORT void CBADDRINFO(CBTYPE, PLUG_CB_ADDRINFO* info)
+{
+    // NOTE: this is called for every visible line on every repaint, do not allocate here
+    auto addrinfo = info->addrinfo;
+    if(!(addrinfo->flags & flagcomment) || *addrinfo->comment != '\0')
+        return;
+
+    ReportIndex::Reader index;
+    if(!index)
+        return;
+
+    auto entry = index->find(info->addr);
+    if(entry == nullptr)
+        return;
+
+    strncpy_s(addrinfo->comment, index->text(*entry), _TRUNCATE);
+    info->retval = true;
+}
+
+// NOTE: the expression functions are evaluated on every breakpoint hit and trace step
+static duint exprSuspicious(int argc, const duint* argv, void*)
+{
+    ReportIndex::Reader index;
+    if(!index)
+        return 0;
+    auto entry = index->find(argv[0]);
+    return entry != nullptr && (entry->flags & ReportIndex::FlagSuspicious) ? 1 : 0;
+}
+
+static duint exprCalls(int argc, const duint* argv, void*)
+{
+    ReportIndex::Reader index;
+    if(!index)
+        return 0;
+    auto entry = index->find(argv[0]);
+    return entry != nullptr ? entry->calls : 0;
+}
+
+static duint exprIoc(int argc, const duint* argv, void*)
+{
+    ReportIndex::Reader index;
+    if(!index)
+        return 0;
+    auto entry = index->find(argv[0]);
+    return entry != nullptr && (entry->flags & ReportIndex::FlagIoc) ? 1 : 0;
+}
+
+static duint exprScore(int argc, const duint* argv, void*)
+{
+    ReportIndex::Reader index;
+    return index ? duint(index->score() + 0.5) : 0;
+}
+
 PLUG_EXPORT bool pluginit(PLUG_INITSTRUCT* initStruct)
 {
     initStruct->pluginVersion = PLUGIN_VERSION;
@@ -40,6 +95,12 @@ PLUG_EXPORT bool pluginit(PLUG_INITSTRUCT* initStruct)
 
     Plugin::handle = initStruct->pluginHandle;
     QtPlugin::Init();
+
+    _plugin_registerexprfunction(Plugin::handle, "malcore.suspicious", 1, exprSuspicious, nullptr);
+    _plugin_registerexprfunction(Plugin::handle, "malcore.calls", 1, exprCalls, nullptr);
+    _plugin_registerexprfunction(Plugin::handle, "malcore.ioc", 1, exprIoc, nullptr);
+    _plugin_registerexprfunction(Plugin::handle, "malcore.score", 0, exprScore, nullptr);
+    PluginCommands::Register();
     return true;
 }
 
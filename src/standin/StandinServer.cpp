@@ -0,0 +1,465 @@
+#include "StandinServer.h"
+
+#include <QFile>
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QCryptographicHash>
+
+// Throttled responses are written in slices every ThrottleTick ms
+static const int ThrottleTick = 10;
+
+static const char* statusText(int status)
+{
+    switch(status)
+    {
+    case 200:
+        return "OK";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 429:
+        return "Too Many Requests";
+    case 500:
+        return "Internal Server Error";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    }
+    return "Unknown";
+}
+
+static QByteArray errorBody(const QString& message)
+{
+    QJsonObject entry;
+    entry["message"] = message;
+    QJsonArray messages;
+    messages.append(entry);
+    QJsonObject root;
+    root["success"] = false;
+    root["messages"] = messages;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+StandinServer::StandinServer(const Config& config, QObject* parent)
+    : QTcpServer(parent)
+    , mConfig(config)
+    , mRandom(std::random_device()())
+{
+    QFile f(mConfig.reportPath.isEmpty() ? QString(":/example-report.json") : mConfig.reportPath);
+    if(f.open(QIODevice::ReadOnly))
+        mReport = f.readAll();
+    if(mConfig.syntheticCalls > 0)
+        mReport = syntheticReport(mReport, mConfig.syntheticCalls);
+    mReportEtag = "\"" + QCryptographicHash::hash(mReport, QCryptographicHash::Sha1).toHex().left(16) + "\"";
+
+    mThrottleTimer = new QTimer(this);
+    mThrottleTimer->setInterval(ThrottleTick);
+    connect(mThrottleTimer, &QTimer::timeout, this, &StandinServer::throttleTimeout);
+    mClock.start();
+}
+
+void StandinServer::addOptions(QCommandLineParser& parser)
+{
+    parser.addOption(QCommandLineOption("report", "Report served for finished uploads (default: example-report.json).", "file"));
+    parser.addOption(QCommandLineOption("synthetic-calls", "Replace the dynamic analysis with N generated calls.", "N", "0"));
+    parser.addOption(QCommandLineOption("pending-ms", "Time an upload stays pending.", "ms", "2000"));
+    parser.addOption(QCommandLineOption("bandwidth", "Response bandwidth in bytes per second (0: unlimited).", "bytes", "0"));
+    parser.addOption(QCommandLineOption("rate-403", "Probability of an injected 403.", "p", "0"));
+    parser.addOption(QCommandLineOption("rate-429", "Probability of an injected 429.", "p", "0"));
+    parser.addOption(QCommandLineOption("rate-5xx", "Probability of an injected 500/502/503.", "p", "0"));
+    parser.addOption(QCommandLineOption("rate-drop", "Probability of dropping the connection.", "p", "0"));
+    parser.addOption(QCommandLineOption("retry-after", "Retry-After seconds sent with 429.", "s", "1"));
+    parser.addOption(QCommandLineOption("accept-key", "Only accept this API key (default: any).", "key"));
+    parser.addOption(QCommandLineOption("no-events", "Do not offer /api/events (clients fall back to polling)."));
+}
+
+bool StandinServer::parseOptions(const QCommandLineParser& parser, Config& config, QString& error)
+{
+    auto number = [&](const char* name, double& value)
+    {
+        bool ok = false;
+        value = parser.value(name).toDouble(&ok);
+        if(!ok)
+            error = QString("Invalid value for --%1").arg(name);
+        return ok;
+    };
+
+    double synthetic = 0, pending = 0, bandwidth = 0, retryAfter = 0;
+    if(!number("synthetic-calls", synthetic) || !number("pending-ms", pending) || !number("bandwidth", bandwidth) ||
+            !number("rate-403", config.rate403) || !number("rate-429", config.rate429) || !number("rate-5xx", config.rate5xx) ||
+            !number("rate-drop", config.rateDrop) || !number("retry-after", retryAfter))
+        return false;
+
+    config.reportPath = parser.value("report");
+    config.syntheticCalls = int(synthetic);
+    config.pendingMs = int(pending);
+    config.bandwidth = int(bandwidth);
+    config.retryAfter = int(retryAfter);
+    config.apiKey = parser.value("accept-key");
+    config.events = !parser.isSet("no-events");
+    return true;
+}
+
+QByteArray StandinServer::syntheticReport(const QByteArray& templateReport, int calls)
+{
+    static const char* dlls[] = { "KERNEL32", "ntdll", "ADVAPI32", "WS2_32", "USER32" };
+    static const char* functions[] = { "VirtualAlloc", "CreateFileW", "RegOpenKeyExW", "connect", "GetProcAddress", "LoadLibraryA", "WriteProcessMemory", "NtQueryInformationProcess" };
+    const int dllCount = sizeof(dlls) / sizeof(dlls[0]);
+    const int functionCount = sizeof(functions) / sizeof(functions[0]);
+
+    auto hex = [](qulonglong value)
+    {
+        return "0x" + QString::number(value, 16);
+    };
+
+    QJsonArray rows;
+    for(int i = 0; i < calls; i++)
+    {
+        QJsonObject row;
+        row["known_suspicious_function"] = i % 7 == 0;
+        row["dll_name"] = dlls[i % dllCount];
+        row["function_called"] = functions[(i / dllCount) % functionCount];
+        QJsonArray arguments;
+        for(int j = 0; j < i % 4; j++)
+            arguments.append(hex(0x1211f00 + i * 8 + j));
+        row["arguments_passed"] = arguments;
+        row["function_return_value"] = i % 3 == 0 ? QString("None") : hex(i);
+        row["location"] = hex(0x140001000ull + (qulonglong(i) * 0x13) % 0x10000);
+        rows.append(row);
+    }
+
+    auto root = QJsonDocument::fromJson(templateReport).object();
+    auto data = root["data"].toObject();
+    auto dynamicAnalysis = data["dynamic_analysis"].toObject();
+    dynamicAnalysis["parsed_output"] = rows;
+    data["dynamic_analysis"] = dynamicAnalysis;
+    root["data"] = data;
+    root["success"] = true;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+void StandinServer::incomingConnection(qintptr socketDescriptor)
+{
+    auto socket = new QTcpSocket(this);
+    if(!socket->setSocketDescriptor(socketDescriptor))
+    {
+        delete socket;
+        return;
+    }
+    mConnections.insert(socket, Connection());
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]()
+    {
+        readyRead(socket);
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]()
+    {
+        mConnections.remove(socket);
+        socket->deleteLater();
+    });
+}
+
+void StandinServer::readyRead(QTcpSocket* socket)
+{
+    if(!mConnections.contains(socket))
+        return;
+    mConnections[socket].input += socket->readAll();
+
+    while(mConnections.contains(socket))
+    {
+        Request request;
+        if(!parseRequest(mConnections[socket].input, request))
+            break;
+        handleRequest(socket, request);
+    }
+}
+
+bool StandinServer::parseRequest(QByteArray& input, Request& request)
+{
+    auto headerEnd = input.indexOf("\r\n\r\n");
+    if(headerEnd == -1)
+        return false;
+
+    auto lines = input.left(headerEnd).split('\n');
+    auto requestLine = lines[0].trimmed().split(' ');
+    if(requestLine.size() < 2)
+    {
+        input.clear();
+        return false;
+    }
+
+    for(int i = 1; i < lines.size(); i++)
+    {
+        auto colon = lines[i].indexOf(':');
+        if(colon != -1)
+            request.headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+    }
+
+    auto contentLength = request.headers.value("content-length").toInt();
+    auto bodyStart = headerEnd + 4;
+    if(input.size() < bodyStart + contentLength)
+        return false;
+
+    request.method = requestLine[0];
+    request.path = requestLine[1];
+    auto query = request.path.indexOf('?');
+    if(query != -1)
+    {
+        request.query = request.path.mid(query + 1);
+        request.path.truncate(query);
+    }
+    request.body = input.mid(bodyStart, contentLength);
+    input.remove(0, bodyStart + contentLength);
+    return true;
+}
+
+void StandinServer::handleRequest(QTcpSocket* socket, const Request& request)
+{
+    mRequestCounts[QString::fromUtf8(request.path)]++;
+
+    if(chance(mConfig.rateDrop))
+    {
+        socket->abort();
+        return;
+    }
+    if(chance(mConfig.rate5xx))
+    {
+        static const int statuses[] = { 500, 502, 503 };
+        respond(socket, statuses[mRandom() % 3], errorBody("Injected server error"));
+        return;
+    }
+    if(chance(mConfig.rate429))
+    {
+        Headers headers;
+        headers.append(qMakePair(QByteArray("Retry-After"), QByteArray::number(mConfig.retryAfter)));
+        respond(socket, 429, errorBody("Too many requests"), headers);
+        return;
+    }
+
+    int status = 200;
+    QByteArray body;
+    Headers headers;
+    if(request.path == "/auth/login")
+    {
+        body = handleLogin(request, status);
+    }
+    else
+    {
+        auto apiKey = request.headers.value("apikey");
+        if(apiKey.isEmpty() || (!mConfig.apiKey.isEmpty() && apiKey != mConfig.apiKey.toUtf8()) || chance(mConfig.rate403))
+        {
+            respond(socket, 403, errorBody("Invalid API key"));
+            return;
+        }
+
+        if(request.path == "/api/upload")
+            body = handleUpload(request, status);
+        else if(request.path == "/api/status")
+            body = handleStatus(request, status, headers);
+        else if(request.path == "/api/events" && mConfig.events)
+        {
+            handleEvents(socket, request);
+            return;
+        }
+        else
+        {
+            status = 404;
+            body = errorBody("Not found");
+        }
+    }
+
+    // Reports are compressed like the real API does, deflate is zlib (without Qt's size prefix)
+    if(body.size() > 1024 && request.headers.value("accept-encoding").contains("deflate"))
+    {
+        body = qCompress(body).mid(4);
+        headers.append(qMakePair(QByteArray("Content-Encoding"), QByteArray("deflate")));
+    }
+    respond(socket, status, body, headers);
+}
+
+QByteArray StandinServer::handleLogin(const Request& request, int& status)
+{
+    auto json = QJsonDocument::fromJson(request.body).object();
+    if(json["email"].toString().isEmpty() || json["password"].toString().isEmpty())
+    {
+        status = 400;
+        return errorBody("Missing email or password");
+    }
+
+    QJsonObject user;
+    user["apiKey"] = mConfig.apiKey.isEmpty() ? QString("standin") : mConfig.apiKey;
+    QJsonObject data;
+    data["user"] = user;
+    QJsonObject root;
+    root["success"] = true;
+    root["data"] = data;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+QByteArray StandinServer::handleUpload(const Request& request, int& status)
+{
+    if(request.body.isEmpty())
+    {
+        status = 400;
+        return errorBody("No file");
+    }
+
+    auto uuid = QString("standin-%1").arg(mNextUuid++);
+    Upload upload;
+    upload.readyAt = mClock.elapsed() + mConfig.pendingMs;
+    mUploads.insert(uuid, upload);
+
+    QJsonObject data2;
+    data2["uuid"] = uuid;
+    QJsonObject data;
+    data["data"] = data2;
+    QJsonObject root;
+    root["success"] = true;
+    root["data"] = data;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+QByteArray StandinServer::handleStatus(const Request& request, int& status, Headers& headers)
+{
+    auto uuid = QUrlQuery(QString::fromUtf8(request.body)).queryItemValue("uuid");
+    QJsonObject root;
+    root["success"] = true;
+
+    // An empty uuid is used to check the API key
+    if(uuid.isEmpty())
+        return QJsonDocument(root).toJson(QJsonDocument::Compact);
+
+    auto itr = mUploads.find(uuid);
+    if(itr == mUploads.end())
+    {
+        status = 404;
+        return errorBody("Unknown uuid");
+    }
+
+    if(mClock.elapsed() < itr->readyAt)
+    {
+        QJsonObject data;
+        data["status"] = "pending";
+        root["data"] = data;
+        return QJsonDocument(root).toJson(QJsonDocument::Compact);
+    }
+
+    headers.append(qMakePair(QByteArray("ETag"), mReportEtag));
+    if(request.headers.value("if-none-match") == mReportEtag)
+    {
+        status = 304;
+        return QByteArray();
+    }
+    return mReport;
+}
+
+void StandinServer::handleEvents(QTcpSocket* socket, const Request& request)
+{
+    // The stream has no length, it ends when either side closes the connection
+    QByteArray response = "HTTP/1.1 200 OK\r\n";
+    response += "Content-Type: text/event-stream\r\n";
+    response += "Cache-Control: no-cache\r\n";
+    response += "Connection: close\r\n";
+    response += "\r\n";
+    mConnections[socket].output += response;
+    flush(socket);
+
+    // Send the current state of every uuid, then one event when a pending upload is ready
+    auto uuids = QUrlQuery(QString::fromUtf8(request.query)).queryItemValue("uuids").split(',', QString::SkipEmptyParts);
+    for(const auto& uuid : uuids)
+    {
+        auto itr = mUploads.constFind(uuid);
+        if(itr == mUploads.constEnd())
+        {
+            sendEvent(socket, uuid, "unknown");
+            continue;
+        }
+
+        auto remaining = itr->readyAt - mClock.elapsed();
+        if(remaining <= 0)
+        {
+            sendEvent(socket, uuid, "done");
+            continue;
+        }
+        sendEvent(socket, uuid, "pending");
+        // Cancelled when the client closes the stream and the socket is deleted
+        QTimer::singleShot(int(remaining), socket, [this, socket, uuid]()
+        {
+            sendEvent(socket, uuid, "done");
+        });
+    }
+}
+
+void StandinServer::sendEvent(QTcpSocket* socket, const QString& uuid, const QString& status)
+{
+    if(!mConnections.contains(socket))
+        return;
+
+    QJsonObject event;
+    event["uuid"] = uuid;
+    event["status"] = status;
+    mConnections[socket].output += "event: status\ndata: " + QJsonDocument(event).toJson(QJsonDocument::Compact) + "\n\n";
+    flush(socket);
+}
+
+void StandinServer::respond(QTcpSocket* socket, int status, const QByteArray& body, const Headers& headers)
+{
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(status) + " " + statusText(status) + "\r\n";
+    response += "Content-Type: application/json\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    for(const auto& header : headers)
+        response += header.first + ": " + header.second + "\r\n";
+    response += "\r\n";
+    response += body;
+
+    mConnections[socket].output += response;
+    flush(socket);
+}
+
+void StandinServer::flush(QTcpSocket* socket)
+{
+    auto& connection = mConnections[socket];
+    if(mConfig.bandwidth > 0)
+    {
+        if(!mThrottleTimer->isActive())
+            mThrottleTimer->start();
+        return;
+    }
+
+    socket->write(connection.output);
+    connection.output.clear();
+    if(connection.close)
+        socket->disconnectFromHost();
+}
+
+void StandinServer::throttleTimeout()
+{
+    auto slice = qMax(1, mConfig.bandwidth * ThrottleTick / 1000);
+    bool pending = false;
+    for(auto itr = mConnections.begin(); itr != mConnections.end(); ++itr)
+    {
+        auto& connection = itr.value();
+        if(connection.output.isEmpty())
+            continue;
+        auto size = qMin(slice, connection.output.size());
+        itr.key()->write(connection.output.constData(), size);
+        connection.output.remove(0, size);
+        pending |= !connection.output.isEmpty();
+    }
+    if(!pending)
+        mThrottleTimer->stop();
+}
+
+bool StandinServer::chance(double probability)
+{
+    if(probability <= 0.0)
+        return false;
+    return std::uniform_real_distribution<double>(0.0, 1.0)(mRandom) < probability;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QCommandLineParser>
+
+#include <random>
+
+// Local stand-in for api.malcore.io that implements just enough of /auth/login, /api/upload,
+// /api/status and the /api/events completion stream to exercise the plugin and the core without
+// network access. Failures, slow links and server-side queueing can be injected to test the error
+// paths.
+class StandinServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    struct Config
+    {
+        QString reportPath;    // empty: embedded example-report.json
+        int syntheticCalls = 0; // > 0: replace the dynamic analysis with this many generated calls
+        int pendingMs = 2000;  // time an upload stays pending
+        int bandwidth = 0;     // response bytes per second, 0 is unlimited
+        double rate403 = 0.0;  // probability of injected errors/drops per request
+        double rate429 = 0.0;
+        double rate5xx = 0.0;
+        double rateDrop = 0.0;
+        int retryAfter = 1;    // seconds, sent with 429
+        QString apiKey;        // empty: accept any non-empty key
+        bool events = true;    // false: /api/events is not found, clients have to poll
+    };
+
+    explicit StandinServer(const Config& config, QObject* parent = nullptr);
+
+    static void addOptions(QCommandLineParser& parser);
+    static bool parseOptions(const QCommandLineParser& parser, Config& config, QString& error);
+    static QByteArray syntheticReport(const QByteArray& templateReport, int calls);
+
+    QMap<QString, int> requestCounts() const { return mRequestCounts; }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    typedef QList<QPair<QByteArray, QByteArray>> Headers;
+
+    struct Request
+    {
+        QByteArray method;
+        QByteArray path;
+        QByteArray query;
+        QHash<QByteArray, QByteArray> headers; // lowercase names
+        QByteArray body;
+    };
+
+    struct Connection
+    {
+        QByteArray input;
+        QByteArray output;
+        bool close = false;
+    };
+
+    struct Upload
+    {
+        qint64 readyAt = 0;
+    };
+
+    void readyRead(QTcpSocket* socket);
+    bool parseRequest(QByteArray& input, Request& request);
+    void handleRequest(QTcpSocket* socket, const Request& request);
+    void respond(QTcpSocket* socket, int status, const QByteArray& body, const Headers& headers = Headers());
+    void flush(QTcpSocket* socket);
+    void throttleTimeout();
+    bool chance(double probability);
+
+    QByteArray handleLogin(const Request& request, int& status);
+    QByteArray handleUpload(const Request& request, int& status);
+    QByteArray handleStatus(const Request& request, int& status, Headers& headers);
+    void handleEvents(QTcpSocket* socket, const Request& request);
+    void sendEvent(QTcpSocket* socket, const QString& uuid, const QString& status);
+
+    Config mConfig;
+    QByteArray mReport;
+    QByteArray mReportEtag;
+    QHash<QTcpSocket*, Connection> mConnections;
+    QHash<QString, Upload> mUploads;
+    QMap<QString, int> mRequestCounts;
+    QTimer* mThrottleTimer = nullptr;
+    QElapsedTimer mClock;
+    std::mt19937 mRandom;
+    int mNextUuid = 1;
+};
@@ -0,0 +1,39 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include "StandinServer.h"
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("malcore-standin");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Local stand-in for the Malcore API (use http://127.0.0.1:<port> as the base URL).");
+    parser.addHelpOption();
+    QCommandLineOption portOption(QStringList() << "p" << "port", "Port to listen on.", "port", "8080");
+    parser.addOption(portOption);
+    StandinServer::addOptions(parser);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    StandinServer::Config config;
+    QString error;
+    if(!StandinServer::parseOptions(parser, config, error))
+    {
+        err << error << endl;
+        return 1;
+    }
+
+    StandinServer server(config);
+    if(!server.listen(QHostAddress::LocalHost, quint16(parser.value(portOption).toUInt())))
+    {
+        err << "Failed to listen: " << server.errorString() << endl;
+        return 1;
+    }
+    out << "Listening on http://127.0.0.1:" << server.serverPort() << endl;
+    return app.exec();
+}
@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Local stand-in for the Malcore API
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = malcore-standin
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+SOURCES += \
+    main.cpp \
+    StandinServer.cpp
+
+HEADERS += \
+    StandinServer.h
+
+RESOURCES += \
+    standin.qrc